@@ -56,6 +56,184 @@ static axis_fifo_t *axis_fifo = NULL;
 #define FIFO_ISR_RFPF  (0x00100000)   // Receive FIFO programmable full (RX FIFO full threshold crossed)
 #define FIFO_ISR_RFPE  (0x00080000)   // Receive FIFO programmable empty (RX FIFO empty threshold crossed)
 
+#define FIFO_ISR_ERRORS (FIFO_ISR_RPURE | FIFO_ISR_RPORE | FIFO_ISR_RPUE | FIFO_ISR_TPOE | FIFO_ISR_TSE)
+
+/*
+ * Every register access below goes through REG_RD()/REG_WR().  Each one is an uncached bus
+ * transaction, so build with -DMMIO_PROFILE to count the reads and writes of each register,
+ * and the time they take, broken down by the API call that made them.  hwprofile() prints
+ * the tables and also runs at exit.  Without the flag the macros are plain accesses.
+ */
+#ifdef MMIO_PROFILE
+
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+
+#define NREGS (sizeof(axis_fifo_t) / sizeof(uint32_t))
+
+enum { API_INIT, API_READ_EMPTY, API_READ, API_WRITE, NAPIS };
+static const char *api_name[NAPIS] = { "hwinit", "hwread (empty)", "hwread", "hwwrite" };
+static const char *reg_name[NREGS] = { "ISR", "IER", "TDFR", "TDFV", "TDFD", "TLR", "RDFR", "RDFO", "RDFD", "RLR", "SRR", "TDR", "RDR" };
+
+typedef struct prof_s
+{
+	uint64_t calls, ns;           // API calls and the time spent in them
+	uint64_t count[NREGS][2];     // accesses per register: [0] reads, [1] writes
+	uint64_t regns[NREGS][2];     // and the time spent in them
+} prof_t;
+
+static prof_t prof[NAPIS];        // totals per API
+static prof_t call;               // the API call in progress
+static uint64_t call_start;
+static uint64_t clock_ns;         // cost of reading the clock, taken off each access
+
+static uint64_t prof_now( void )
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint32_t prof_rd( volatile uint32_t *r, int reg )
+{
+	uint64_t t0 = prof_now();
+	uint32_t v = *r;
+	uint64_t t = prof_now() - t0;
+
+	call.count[reg][0]++;
+	call.regns[reg][0] += t > clock_ns ? t - clock_ns : 0;
+	return v;
+}
+
+static void prof_wr( volatile uint32_t *r, int reg, uint32_t v )
+{
+	uint64_t t0 = prof_now();
+	*r = v;
+	uint64_t t = prof_now() - t0;
+
+	call.count[reg][1]++;
+	call.regns[reg][1] += t > clock_ns ? t - clock_ns : 0;
+}
+
+// start accounting for an API call
+static void prof_enter( void )
+{
+	memset(&call, 0, sizeof(call));
+	call_start = prof_now();
+}
+
+// charge the call just finished to api
+static void prof_leave( int api )
+{
+	prof_t *p = &prof[api];
+	int r, w;
+
+	p->calls++;
+	p->ns += prof_now() - call_start;
+	for( r = 0; r < NREGS; r++ )
+		for( w = 0; w < 2; w++ )
+		{
+			p->count[r][w] += call.count[r][w];
+			p->regns[r][w] += call.regns[r][w];
+		}
+}
+
+void hwprofile( FILE *fp )
+{
+	int a, r, w;
+
+	fprintf(fp, "MMIO profile (%llu ns of clock overhead removed from each access)\n", (unsigned long long)clock_ns);
+	for( a = 0; a < NAPIS; a++ )
+	{
+		prof_t *p = &prof[a];
+		uint64_t rd = 0, wr = 0;
+
+		if( p->calls == 0 )
+			continue;
+		for( r = 0; r < NREGS; r++ )
+		{
+			rd += p->count[r][0];
+			wr += p->count[r][1];
+		}
+		fprintf(fp, "  %-15s %10llu calls %8.0f ns/call %7.2f reads %7.2f writes per call\n", api_name[a],
+				(unsigned long long)p->calls, (double)p->ns / p->calls, (double)rd / p->calls, (double)wr / p->calls);
+		for( r = 0; r < NREGS; r++ )
+			for( w = 0; w < 2; w++ )
+				if( p->count[r][w] )
+					fprintf(fp, "    %-4s %-5s %12llu %7.2f per call %8.0f ns each\n", reg_name[r], w ? "write" : "read",
+							(unsigned long long)p->count[r][w], (double)p->count[r][w] / p->calls,
+							(double)p->regns[r][w] / p->count[r][w]);
+	}
+}
+
+static void prof_exit( void )
+{
+	hwprofile(stderr);
+}
+
+// measure the clock overhead and arrange the report at exit
+static void prof_init( void )
+{
+	uint64_t t0, t, best = UINT64_MAX;
+	int k;
+
+	for( k = 0; k < 1000; k++ )
+	{
+		t0 = prof_now();
+		if( (t = prof_now() - t0) < best )
+			best = t;
+	}
+	clock_ns = best;
+	atexit(prof_exit);
+}
+
+#define REG_RD(fifo, reg)    prof_rd(&(fifo)->reg, offsetof(axis_fifo_t, reg) / sizeof(uint32_t))
+#define REG_WR(fifo, reg, v) prof_wr(&(fifo)->reg, offsetof(axis_fifo_t, reg) / sizeof(uint32_t), (v))
+#define PROF_INIT()          prof_init()
+#define PROF_ENTER()         prof_enter()
+#define PROF_LEAVE(api)      prof_leave(api)
+
+#else
+
+#define REG_RD(fifo, reg)    ((fifo)->reg)
+#define REG_WR(fifo, reg, v) ((fifo)->reg = (v))
+#define PROF_INIT()
+#define PROF_ENTER()
+#define PROF_LEAVE(api)
+
+#endif /* MMIO_PROFILE */
+
+// running totals for monitoring (see hw.h) - always on, unlike the DEBUG dumps below
+hwstats_t hwstats;
+
+#define STAT_ADD(f,n) atomic_fetch_add_explicit(&hwstats.f, (n), memory_order_relaxed)
+
+// raise a high-water mark; only the driver writes them
+static void hw_stat_max(_Atomic unsigned long long *hwm, unsigned long long v)
+{
+	if( v > atomic_load_explicit(hwm, memory_order_relaxed) )
+		atomic_store_explicit(hwm, v, memory_order_relaxed);
+}
+
+// count the error bits set in an ISR value, then clear them (write 1 to clear) so each is counted once
+static void hw_count_errors(axis_fifo_t *fifo, uint32_t ISR)
+{
+	if( !(ISR & FIFO_ISR_ERRORS) )
+		return;
+	if( ISR & FIFO_ISR_RPURE )
+		STAT_ADD(rpure, 1);
+	if( ISR & FIFO_ISR_RPORE )
+		STAT_ADD(rpore, 1);
+	if( ISR & FIFO_ISR_RPUE )
+		STAT_ADD(rpue, 1);
+	if( ISR & FIFO_ISR_TPOE )
+		STAT_ADD(tpoe, 1);
+	if( ISR & FIFO_ISR_TSE )
+		STAT_ADD(tse, 1);
+	REG_WR(fifo, ISR, (ISR & FIFO_ISR_ERRORS));
+}
+
 #ifdef DEBUG
 
 static void hw_debug_print_ISR(axis_fifo_t *fifo) 
@@ -118,15 +296,17 @@ static void hw_reset( axis_fifo_t *fifo )
 		return;
 
 	// reset the AXIS FIFO on each run
-	fifo->SRR = AXIS_FIFO_RESET_KEY;
+	REG_WR(fifo, SRR, AXIS_FIFO_RESET_KEY);
 	// wait for transmit reset to complete
-	while( !(fifo->ISR & FIFO_ISR_TRC) );
+	while( !(REG_RD(fifo, ISR) & FIFO_ISR_TRC) );
 	// clear transmit complete flag and TFPF flag - seems to get set on reset
-	fifo->ISR = (FIFO_ISR_TRC | FIFO_ISR_TFPF);
+	REG_WR(fifo, ISR, (FIFO_ISR_TRC | FIFO_ISR_TFPF));
 	// wait for receive reset to complete
-	while( !(fifo->ISR & FIFO_ISR_RRC) );
+	while( !(REG_RD(fifo, ISR) & FIFO_ISR_RRC) );
 	// clear receive reset complete flag and RFPF flag - seems to get set on reset
-	fifo->ISR = (FIFO_ISR_RRC | FIFO_ISR_RFPF);
+	REG_WR(fifo, ISR, (FIFO_ISR_RRC | FIFO_ISR_RFPF));
+	// an empty transmit FIFO is all vacancy: that is its size
+	atomic_store(&hwstats.txdepth, REG_RD(fifo, TDFV));
 
 #ifdef DEBUG
 	fprintf(stderr, "*****\nFIFO @ RESET:\n");
@@ -173,7 +353,7 @@ static int hw_init( void )
 	void *mapped_page_vaddr = mmap(NULL,             // map to an arbitrary virtual address
 			               sysconf(_SC_PAGESIZE),    // map a full page
 			               (PROT_READ|PROT_WRITE),   // allow read, write operations
-			               MAP_SHARED,               // sync this page map with any other mapped instances
+			               MAP_SHARED|MAP_POPULATE,  // sync this page map with any other mapped instances, and fault it in now
 			               dmem_fd, 		         // map the /dev/mem interface (physical memory as char device)
 			               page_base_addr);		     // page boundary of page we want to map
 	if( mapped_page_vaddr == MAP_FAILED )
@@ -186,12 +366,23 @@ static int hw_init( void )
 	axis_fifo = (axis_fifo_t *)(((char *)mapped_page_vaddr)+page_offset);
 
 	// reset
+	PROF_INIT();
+	PROF_ENTER();
 	hw_reset(axis_fifo);
+	PROF_LEAVE(API_INIT);
 
 	return 0;
 }
 
 
+// map and reset the FIFO now rather than on the first hwread()/hwwrite()
+int hwinit(int fd)
+{
+	if( axis_fifo != NULL )
+		return 0;
+	return hw_init();
+}
+
 /*
  * Note: fd is ignored in this implementation as we do not yet have a dedicated
  * character device for the AXI FIFOs.  Instead we use an internally-managed
@@ -208,11 +399,17 @@ ssize_t hwread(int fd,void *buf, size_t count)
 			return -1;
 
 	// is a packet available?
-	if( !(axis_fifo->ISR & FIFO_ISR_RC) )
+	PROF_ENTER();
+	uint32_t ISR = REG_RD(axis_fifo, ISR);
+	hw_count_errors(axis_fifo, ISR);
+	if( !(ISR & FIFO_ISR_RC) )
+	{
+		PROF_LEAVE(API_READ_EMPTY);
 		return 0; // no data available
+	}
 
 	// yes, check sizes and read the packet
-	uint32_t length = axis_fifo->RLR;          // Length of packet data (in bytes)
+	uint32_t length = REG_RD(axis_fifo, RLR); // Length of packet data (in bytes)
 	uint32_t word_reads = length / 4;          // Number of full 4-byte words to read
 	if( length % 4 ) 						   // Increment word_reads if a partial read is required
 		word_reads++;           
@@ -224,18 +421,25 @@ ssize_t hwread(int fd,void *buf, size_t count)
 				length, count);
 		// flush packet from RX FIFO
 		for( k = 0; k < word_reads; k++ )
-			devnull = axis_fifo->RDFD;
+			devnull = REG_RD(axis_fifo, RDFD);
 		// write to devnull to override compiler warning / build failure
 		devnull = devnull;
+		STAT_ADD(rxoversize, 1);
+		PROF_LEAVE(API_READ);
 		return -1;
 	}
 
 	// Copy packet into buffer - NOTE (TODO) we assume buffer is large enough to hold unused bytes from a partial FIFO word read
 	for( k = 0; k < word_reads; k++ )
-		((uint32_t *)buf)[k] = axis_fifo->RDFD;
+		((uint32_t *)buf)[k] = REG_RD(axis_fifo, RDFD);
 	
 	// Clear "packet received" flag 
-	axis_fifo->ISR = FIFO_ISR_RC;
+	REG_WR(axis_fifo, ISR, FIFO_ISR_RC);
+
+	STAT_ADD(rxpkts, 1);
+	STAT_ADD(rxbytes, length);
+	hw_stat_max(&hwstats.rxlenmax, length);
+	PROF_LEAVE(API_READ);
 
 	// return number of bytes read
 	return length;
@@ -255,23 +459,34 @@ ssize_t hwwrite(int fd,const void *buf, size_t count)
 	uint32_t word_writes = count / 4;         // Number of full 4-byte words to write
 	if( count % 4 ) 						  // Increment word_writes if a partial write is required
 		word_writes++;           
-	if( word_writes > axis_fifo->TDFV )
+	PROF_ENTER();
+	uint32_t vacancy = REG_RD(axis_fifo, TDFV);
+	if( word_writes > vacancy )
 	{
 		fprintf(stderr, "ERROR hwwrite() packet length (%d) exceeds transmit FIFO capacity.  Dropping.\n",
 				count);
+		STAT_ADD(txfull, 1);
+		PROF_LEAVE(API_WRITE);
 		return -1;
 	}
+	hw_stat_max(&hwstats.txoccmax, atomic_load_explicit(&hwstats.txdepth, memory_order_relaxed) - vacancy + word_writes);
 
 	// Load the FIFO
 	for( k = 0; k < word_writes; k++ )
-		axis_fifo->TDFD = ((uint32_t *)buf)[k];
+		REG_WR(axis_fifo, TDFD, ((uint32_t *)buf)[k]);
 
 	// Send
-	axis_fifo->TLR = count;
+	REG_WR(axis_fifo, TLR, count);
 
 	// Wait for transmit to complete, then clear "transmit complete" flag
-	while( !(axis_fifo->ISR & FIFO_ISR_TC) );
-	axis_fifo->ISR = FIFO_ISR_TC;
+	uint32_t ISR;
+	while( !((ISR = REG_RD(axis_fifo, ISR)) & FIFO_ISR_TC) );
+	REG_WR(axis_fifo, ISR, FIFO_ISR_TC);
+	hw_count_errors(axis_fifo, ISR);
+
+	STAT_ADD(txpkts, 1);
+	STAT_ADD(txbytes, count);
+	PROF_LEAVE(API_WRITE);
 
 	// return number of bytes written
 	return count;
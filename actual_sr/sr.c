@@ -1,62 +1,52 @@
-/* 
+/*
  * sr.c -- send and recieve to hardware
  *
- * Description: This user-space Linuxprogram demonstrates how to send
- * data to the hardware interface and recieve data back from the
- * hardware.
- * 
+ * Description: characterizes the raw fifo in loopback. Sends count
+ * packets of size bytes through the hardware, keeping up to depth of
+ * them outstanding, reads each back with hwread() and reports the
+ * throughput (MB/s and packets/s) and the round trip latency
+ * percentiles. Linked with hw.o it measures the simulator; linked
+ * with the AXIS FIFO driver (actual_sr/hw.c) on the board it measures
+ * the real fifo, which must be looped back.
+ *
+ * This copy is built on the board with the driver beside it, as
+ * gcc -std=c11 -O2 -D_GNU_SOURCE -I. sr.c hw.c -o sr; the fifo's
+ * capacity is read from it when it resets the fifo.
+ *
+ * A packet starts with its 32-bit sequence number; the rest is a
+ * pattern derived from it, checked on the way back. A packet that
+ * comes back with an unknown sequence number, or not at all within
+ * the timeout, is counted and the run carries on. A write the fifo
+ * refuses is tried again once something has come back; one it refuses
+ * with nothing outstanding ends the run.
+ *
+ * usage: sr [-n count] [-s size] [-q depth] [-t ms] [-v]
+ *   -n  packets to send (default 10)
+ *   -s  bytes in each, from 4 up to the fifo's capacity (default 10)
+ *   -q  packets outstanding at once (default 1)
+ *   -t  ms without progress before the outstanding are lost (default 1000)
+ *   -v  print every packet sent and received
+ *
  */
+#define _POSIX_C_SOURCE 200809L					/* clock_gettime, getopt */
 #include <stdio.h>							/* printf */
 #include <stdlib.h>							/* exit codes */
 #include <stdint.h>							/* uint8_t */
-#include <sys/types.h>					    /* open */
+#include <string.h>							/* memcpy */
+#include <time.h>							/* clock_gettime */
+#include <sys/types.h>					/* open */
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <unistd.h>							/* close */
+#include <unistd.h>							/* close, getopt */
 #include "hw.h"									/* hwread, hwwrite */
 
-/* largest message to send to hardware */
-#define MAXBUF 1500
-static uint8_t msgbuf[MAXBUF];			/* a message buffer */
-
-typedef struct c1 {							/* target message */
-	uint8_t type;
-	int8_t lat_deg;
-	uint8_t lat_min;
-	uint8_t lat_sec;
-	int16_t long_deg;
-	uint8_t long_min;
-	uint8_t long_sec;
-	uint8_t weapon;
-	uint8_t msgid;
-} c1_t;
+#define MAXBUF 1500							/* capacity if the driver does not say */
+#define SEQ 4								/* bytes of sequence number in a packet */
 
-/*
- * msgmake() -- builds a message alternating between weapon 1 and 2
- * with message id starting at 1
- */
-#define TARGET 0x20							/* command C3, target type */
-static uint8_t id=0;						/* msgid rolls over at 255 */
-
-int msgmake(uint8_t *bp) {				
-	c1_t *p=(c1_t*)bp;						/* build a target message */
-	p->type = TARGET;
-	p->lat_deg = -64;							/* C0 */
-	p->lat_min = 0x10;
-	p->lat_sec = 0x20;
-	p->long_deg = 180;						/* 180 = B4 00 (Intel=little endian) */
-	p->long_min = 0x30;
-	p->long_sec = 0x40;
-	p->msgid = id++;	 /* every message has unique id */
-	if((id%2)!=0)			 /* alternatve weapons based on msgid */
-		p->weapon = 1;
-	else
-		p->weapon = 2;
-	return sizeof(c1_t);
-}
+static int verbose;
 
 /*
- * printms() -- prints a message on the screen in hex
+ * msgprint() -- prints a message on the screen in hex
  */
 void msgprint(char *tag,uint8_t *bp,int len) {
 	int i;
@@ -69,26 +59,140 @@ void msgprint(char *tag,uint8_t *bp,int len) {
 	printf("(len=%d)\n",len);
 }
 
-int main(void) {
-	int fdout,fdin,i;
-	size_t len;
+static uint64_t nsnow(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+/* the packet of len bytes with sequence number seq */
+static void pktmake(uint8_t *bp,int len,uint32_t seq) {
+	int i;
+
+	memcpy(bp,&seq,SEQ);
+	for(i=SEQ; i<len; i++)
+		bp[i] = seq+i;
+}
+
+/* 1 if the len bytes at bp are the packet with sequence number seq */
+static int pktcheck(const uint8_t *bp,int len,uint32_t seq) {
+	int i;
+
+	for(i=SEQ; i<len; i++)
+		if(bp[i] != (uint8_t)(seq+i))
+			return 0;
+	return 1;
+}
+
+static int cmpu(const void *a,const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double pct(uint64_t *v,uint32_t n,double p) {
+	if(n == 0)
+		return 0;
+	return v[(uint32_t)(p*(n-1))]/1000.0;		/* microseconds */
+}
+
+static void usage(char *prog) {
+	fprintf(stderr,"usage: %s [-n count] [-s size] [-q depth] [-t ms] [-v]\n",prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc,char **argv) {
+	uint32_t count = 10, depth = 1, sent = 0, nrecv = 0, nlost = 0, oldest = 0, seq;
+	uint32_t nstray = 0, ncorrupt = 0, nrefused = 0;
+	uint64_t *sendt, *lat, t0, now, last, timeout = 1000;
+	int fdout, fdin, size = 10, cap, opt;
+	uint8_t *tx, *rx;
 	ssize_t cnt;
 
+	while((opt = getopt(argc,argv,"n:s:q:t:v")) != -1) {
+		switch(opt) {
+		case 'n': count = atol(optarg); break;
+		case 's': size = atoi(optarg); break;
+		case 'q': depth = atol(optarg); break;
+		case 't': timeout = atol(optarg); break;
+		case 'v': verbose = 1; break;
+		default: usage(argv[0]);
+		}
+	}
 	fdout = open(DEVOUT,O_WRONLY);				/* open the hardware for read and write */
 	fdin = open(DEVIN,O_RDONLY);				/* open the hardware for read and write */
+	if(hwinit(fdout) < 0) {
+		fprintf(stderr,"sr: cannot prepare the hardware\n");
+		exit(EXIT_FAILURE);
+	}
+	cap = atomic_load(&hwstats.txdepth) ? (int)atomic_load(&hwstats.txdepth)*4 : MAXBUF;
+	if(count == 0 || depth == 0 || size < SEQ || size > cap)
+		usage(argv[0]);
+	tx = malloc(cap+4);							/* reads are whole words */
+	rx = malloc(cap+4);
+	sendt = calloc(count,sizeof(uint64_t));
+	lat = calloc(count,sizeof(uint64_t));
+	if(tx == NULL || rx == NULL || sendt == NULL || lat == NULL) {
+		fprintf(stderr,"sr: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	timeout *= 1000000;
 
-	for(i=0; i<10; i++) {					/* send and recieve 10 messages */
-		len = msgmake(msgbuf);			/* make ith c1 message */
-		msgprint("send",msgbuf,len);	/* print recvd msg */
-		hwwrite(fdout,(void*)msgbuf,len);				/* send ith message to hardware */
-		while((cnt=hwread(fdin,(void*)msgbuf,MAXBUF))==0) { /* wait for a message */
-			printf(".");											 /* print a dot for debug */
-			fflush(stdout);
+	t0 = last = nsnow();
+	while(nrecv + nlost < count) {
+		while(sent < count && sent - nrecv - nlost < depth) {	/* keep depth outstanding */
+			pktmake(tx,size,sent);
+			sendt[sent] = nsnow();
+			if(hwwrite(fdout,(void*)tx,size) < 0) {
+				sendt[sent] = 0;
+				nrefused++;						/* full: wait for something to come back */
+				if(sent - nrecv - nlost == 0) {
+					fprintf(stderr,"sr: the fifo refuses %d bytes even when empty\n",size);
+					nlost += count - sent;
+				}
+				break;
+			}
+			if(verbose)
+				msgprint("send",tx,size);
+			sent++;
+		}
+		if((cnt = hwread(fdin,(void*)rx,cap)) > 0) {
+			now = nsnow();
+			if(verbose)
+				msgprint("recv",rx,cnt);
+			if(cnt >= SEQ)
+				memcpy(&seq,rx,SEQ);
+			if(cnt < SEQ || seq >= sent || sendt[seq] == 0) {
+				nstray++;						/* never sent, already back, or given up on */
+				continue;
+			}
+			if(cnt != size || !pktcheck(rx,cnt,seq))
+				ncorrupt++;
+			lat[nrecv++] = now - sendt[seq];
+			sendt[seq] = 0;
+			last = now;
+			continue;
 		}
-		printf("\n");
-		msgprint("recv",msgbuf,len);	/* print recvd msg */
+		if((now = nsnow()) - last < timeout)
+			continue;
+		for(; oldest < sent; oldest++)			/* no progress: the outstanding are lost */
+			if(sendt[oldest]) {
+				sendt[oldest] = 0;
+				nlost++;
+			}
+		last = now;
 	}
+	now = nsnow();
+
+	double secs = (now - t0)/1e9;
+	qsort(lat,nrecv,sizeof(uint64_t),cmpu);
+	printf("%u packets of %d bytes, depth %u: %.2f MB/s, %.0f packets/s\n",
+		   count,size,depth,nrecv*(double)size/secs/1e6,nrecv/secs);
+	printf("round trip us: p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+		   pct(lat,nrecv,0.50),pct(lat,nrecv,0.90),pct(lat,nrecv,0.99),pct(lat,nrecv,0.999),pct(lat,nrecv,1.0));
+	printf("%u received, %u lost, %u stray, %u corrupt, %u writes refused\n",
+		   nrecv,nlost,nstray,ncorrupt,nrefused);
 	close(fdout);
 	close(fdin);
-	exit(EXIT_SUCCESS);
-}
\ No newline at end of file
+	exit(nrecv == count ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -8,56 +8,99 @@
  * Description: grabs data from the input and sends to the output
  * NOTE: 10 class to read before the data is returned to simulate 
  * return without data
+ *
+ * Packets are queued in order, as in the real fifo, so several
+ * writes may be outstanding before the first comes back, and a read
+ * with nothing queued returns nothing. A write that does not fit in
+ * the remaining fifo space is refused.
  * 
  */
 #include <stdint.h>
+#include <stdio.h>
 #include <unistd.h>
 #include <hw.h>
 
 int cnt = 0;										/* number of returns without data */
 
 #define MAX 2000								/* the fifo size */
-uint8_t hw[MAX];								/* big enough hardware buffer */
-size_t hwlen;
+static uint8_t hw[MAX];							/* queued packets, back to back, wrapping */
+static size_t hwlen[MAX];						/* and their lengths */
+static size_t start,used;						/* the oldest packet's first byte, bytes queued */
+static int head,npkt;							/* oldest packet, number queued */
 #define RES_S 2
 
+hwstats_t hwstats = { .txdepth = MAX/4 };		/* see hw.h */
 
-ssize_t hwread(int fd,void *buf, size_t count) {
-	uint8_t *bp;
+/* copy out and remove the oldest packet; returns its length */
+static size_t hwpop(uint8_t *bp) {
+	size_t len = hwlen[head];
 	int i;
+
+	for(i=0; i<len; i++)
+		*bp++ = hw[(start+i)%MAX];
+	start = (start+len)%MAX;
+	used -= len;
+	head = (head+1)%MAX;
+	npkt--;
+	return len;
+}
+
+ssize_t hwread(int fd,void *buf, size_t count) {
+	uint8_t drop[MAX];
+	size_t len;
 	
 	cnt++;
-	if((cnt%10)!=0) 							/* return with nothing 10 times */
+	if((cnt%10)!=0 || npkt==0) 				/* return with nothing 10 times */
 		return 0;
-	for(bp=(uint8_t*)buf,i=0; i<hwlen; i++) /* otherwise */
-		*bp++ = hw[i];							/* return the data */
-	return hwlen;			  						/* and its length */
+	if(hwlen[head] > count) {					/* otherwise */
+		fprintf(stderr,"ERROR hwread() packet length (%d) exceeds receive buffer length (%d).  Dropping.\n",
+				(int)hwlen[head],(int)count);
+		hwpop(drop);
+		atomic_fetch_add_explicit(&hwstats.rxoversize,1,memory_order_relaxed);
+		return -1;
+	}
+	len = hwpop(buf);							/* return the data */
+	atomic_fetch_add_explicit(&hwstats.rxpkts,1,memory_order_relaxed);
+	atomic_fetch_add_explicit(&hwstats.rxbytes,len,memory_order_relaxed);
+	return len;			  						/* and its length */
 }
 
 ssize_t hwwrite(int fd,const void *buf, size_t count) {
-	uint8_t *bp;
+	const uint8_t *bp = buf;
 	int i;
 
-	for(bp=(uint8_t*)buf,i=0; i<count; i++) /* copy data to hardware */
-		hw[i] = *bp++;												
-	hwlen = count;								/* record its length */
+	if(count == 0 || used+count > MAX) {
+		fprintf(stderr,"ERROR hwwrite() packet length (%d) exceeds transmit FIFO capacity.  Dropping.\n",
+				(int)count);
+		atomic_fetch_add_explicit(&hwstats.txfull,1,memory_order_relaxed);
+		return -1;
+	}
+	for(i=0; i<count; i++)						/* copy data to hardware */
+		hw[(start+used+i)%MAX] = *bp++;
+	hwlen[(head+npkt)%MAX] = count;				/* record its length */
+	npkt++;
+	used += count;
+	atomic_fetch_add_explicit(&hwstats.txpkts,1,memory_order_relaxed);
+	atomic_fetch_add_explicit(&hwstats.txbytes,count,memory_order_relaxed);
 	return count;									/* say we took count bytes */
 }
 
 
 static uint8_t tar_type = 0x40;
 ssize_t hwresponse(int fd,void *buf, size_t count) {
-	uint8_t *bp;
+	uint8_t *bp, pkt[MAX];						/* the packet it answers */
+	size_t hwlen;
 	
 	cnt++;
-	if((cnt%10)!=0) 							/* return with nothing 10 times */
+	if((cnt%10)!=0 || npkt==0) 				/* return with nothing 10 times */
 		return 0;
 
+	hwpop(pkt);
 	hwlen =2;
 
 	bp = (uint8_t*)buf;
 					/* return iterative response*/
-	if (hw[0] == 0x10 || hw[0] == 0x20 ){
+	if (pkt[0] == 0x10 || pkt[0] == 0x20 ){
 
 		/* randomly set the response message 
 		if aoz/ex respond with ACK/NAK */
@@ -68,12 +111,12 @@ ssize_t hwresponse(int fd,void *buf, size_t count) {
 		else{
 			*bp++ = 0x80;
 		}
-		*bp++ = hw[15];						/* get the message ID */
+		*bp++ = pkt[15];						/* get the message ID */
 
 	}
-	else if(hw[0] == 0x30){
+	else if(pkt[0] == 0x30){
 		*bp++ = tar_type;
-		*bp++ = hw[9];						/* get the message ID */
+		*bp++ = pkt[9];						/* get the message ID */
 	}
 
 	if (tar_type == 0x70) {
@@ -82,8 +125,11 @@ ssize_t hwresponse(int fd,void *buf, size_t count) {
 	else{
 		tar_type += 0x10;
 	}
+	atomic_fetch_add_explicit(&hwstats.rxpkts,1,memory_order_relaxed);
+	atomic_fetch_add_explicit(&hwstats.rxbytes,hwlen,memory_order_relaxed);
 	return hwlen;			  						/* and its length */
 }
 
-
-
+int hwinit(int fd) {
+	return 0;										/* nothing to map */
+}
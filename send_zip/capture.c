@@ -0,0 +1,77 @@
+/*
+ * capture.c -- records the traffic through s_hw (see capture.h)
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "capture.h"
+
+#define CAPBUF (1<<20)						/* stdio buffer: write in large blocks */
+
+static FILE *capfp;
+static uint64_t capt0;						/* monotonic time at the start */
+
+static uint64_t now(clockid_t clk) {
+	struct timespec ts;
+	clock_gettime(clk,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static void put(uint8_t *bp,uint64_t v,int n) {
+	while(n--) {
+		*bp++ = v;
+		v >>= 8;
+	}
+}
+
+uint64_t cap_get64(const uint8_t *bp) {
+	return cap_get32(bp) | (uint64_t)cap_get32(bp+4)<<32;
+}
+
+uint32_t cap_get32(const uint8_t *bp) {
+	return bp[0] | bp[1]<<8 | bp[2]<<16 | (uint32_t)bp[3]<<24;
+}
+
+uint16_t cap_get16(const uint8_t *bp) {
+	return bp[0] | bp[1]<<8;
+}
+
+int cap_open(const char *path) {
+	uint8_t hdr[CAP_HDRSZ];
+
+	if((capfp = fopen(path,"wb")) == NULL)
+		return -1;
+	setvbuf(capfp,NULL,_IOFBF,CAPBUF);
+	memcpy(hdr,CAP_MAGIC,8);
+	put(hdr+8,now(CLOCK_REALTIME),8);
+	capt0 = now(CLOCK_MONOTONIC);
+	if(fwrite(hdr,CAP_HDRSZ,1,capfp) != 1) {
+		fclose(capfp);
+		capfp = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+void cap_write(uint32_t conn,int kind,const uint8_t *bp,int len) {
+	uint8_t rec[CAP_RECSZ];
+
+	if(capfp == NULL)
+		return;
+	put(rec,now(CLOCK_MONOTONIC)-capt0,8);
+	put(rec+8,conn,4);
+	rec[12] = kind;
+	put(rec+13,len,2);
+	fwrite(rec,CAP_RECSZ,1,capfp);
+	if(len > 0)
+		fwrite(bp,len,1,capfp);
+}
+
+void cap_close(void) {
+	if(capfp == NULL)
+		return;
+	fclose(capfp);
+	capfp = NULL;
+}
@@ -0,0 +1,64 @@
+/*
+ * capture.h -- records the traffic through s_hw for later replay
+ *
+ * Description: a capture file is a header followed by one record per
+ * event, in the order s_hw saw them. All fields are little endian.
+ *
+ *   header: "SHWCAP\0\2" (8 bytes), start time in ns since the epoch (8)
+ *   record: ns since the start (8), connection (4), kind (1), length (2),
+ *           then length bytes of message
+ *
+ * Connections are numbered from 1 in the order they were accepted.
+ * Datagrams (s_hw -u) are all recorded on one connection, opened when
+ * s_hw starts. A CAP_OPEN record holds one byte, the connection's
+ * transport (CAP_TCP, CAP_UDP or CAP_UNIX); one with none, from an
+ * older s_hw, is TCP.
+ * A response is recorded as it was sent to the client: the hardware
+ * status followed by the client's own msgid. A response that matched
+ * no request is recorded as it came from the hardware, on connection 0.
+ *
+ */
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+#define CAP_MAGIC "SHWCAP\0\2"				/* format 2: 16-bit lengths */
+#define CAP_HDRSZ 16						/* file header */
+#define CAP_RECSZ 15						/* record header */
+
+#define CAP_OPEN 0							/* client connected */
+#define CAP_MSG  1							/* message from the client */
+#define CAP_RSP  2							/* hardware response to the client */
+#define CAP_CLOSE 3							/* client connection closed */
+
+#define CAP_TCP  0							/* transports, in CAP_OPEN */
+#define CAP_UDP  1							/* datagrams, s_hw -u */
+#define CAP_UNIX 2							/* Unix SOCK_SEQPACKET, s_hw -U */
+
+/*
+ * cap_open() -- starts capturing into path, replacing any file there.
+ *
+ * returns: 0 on success; -1 on error.
+ */
+int cap_open(const char *path);
+
+/*
+ * cap_write() -- records one event; does nothing unless capturing.
+ */
+void cap_write(uint32_t conn,int kind,const uint8_t *bp,int len);
+
+/*
+ * cap_close() -- flushes and closes the capture.
+ */
+void cap_close(void);
+
+/*
+ * cap_get64(), cap_get32(), cap_get16() -- decode little endian fields
+ * of a capture
+ */
+uint64_t cap_get64(const uint8_t *bp);
+uint32_t cap_get32(const uint8_t *bp);
+uint16_t cap_get16(const uint8_t *bp);
+
+#endif /* CAPTURE_H */
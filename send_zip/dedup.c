@@ -0,0 +1,78 @@
+/*
+ * dedup.c -- recent target verdicts, to answer duplicates (see dedup.h)
+ *
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "dedup.h"
+
+#define PROBE 4								/* slots a key may occupy */
+
+int dedup_init(dedup_t *d,uint32_t window,uint32_t slots) {
+	uint32_t n;
+
+	for(n=PROBE; n<slots; n<<=1)			/* round up to a power of two */
+		;
+	d->window = window;
+	d->mask = n-1;
+	if((d->ent = calloc(n,sizeof(dedup_ent_t))) == NULL)
+		return -1;
+	return 0;
+}
+
+void dedup_free(dedup_t *d) {
+	free(d->ent);
+	d->ent = NULL;
+}
+
+uint64_t dedup_key(const uint8_t *bp) {
+	uint64_t key;
+
+	memcpy(&key,bp+1,sizeof(key));			/* lat d/m/s, long d(2)/m/s, weapon */
+	return key;
+}
+
+/* first slot for key: the high bits of a multiplicative hash */
+static uint32_t slotof(const dedup_t *d,uint64_t key) {
+	return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32) & d->mask;
+}
+
+static int fresh(const dedup_t *d,const dedup_ent_t *e,uint32_t now) {
+	return e->used && now - e->when < d->window;	/* wraps safely */
+}
+
+int dedup_get(const dedup_t *d,uint64_t key,uint32_t now,uint8_t *status) {
+	uint32_t s = slotof(d,key);
+	int i;
+
+	for(i=0; i<PROBE; i++) {
+		const dedup_ent_t *e = &d->ent[(s+i) & d->mask];
+		if(e->key == key && fresh(d,e,now)) {
+			*status = e->status;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void dedup_put(dedup_t *d,uint64_t key,uint32_t now,uint8_t status) {
+	uint32_t s = slotof(d,key);
+	dedup_ent_t *e, *victim = NULL;
+	int i;
+
+	for(i=0; i<PROBE; i++) {				/* the same key, else a stale slot, else the oldest */
+		e = &d->ent[(s+i) & d->mask];
+		if(e->used && e->key == key) {
+			victim = e;
+			break;
+		}
+		if(victim == NULL || (fresh(d,victim,now) &&
+			(!fresh(d,e,now) || now - e->when > now - victim->when)))
+			victim = e;
+	}
+	victim->key = key;
+	victim->when = now;
+	victim->status = status;
+	victim->used = 1;
+}
@@ -0,0 +1,69 @@
+/*
+ * dedup.h -- recent target verdicts, to answer duplicates
+ *
+ * Description: producers resend the same target (same lat/long and
+ * weapon) when a response is slow in coming. The verdict the hardware
+ * gave a target is kept for a window of milliseconds after it arrived,
+ * keyed on the target's fields, so a copy that arrives within the
+ * window is answered without going to the hardware. A verdict is not
+ * refreshed by the copies it answers: once the window has passed the
+ * next copy goes to the hardware again. A copy that arrives while the
+ * target is still at the hardware is the caller's to hold: it has no
+ * verdict here yet.
+ *
+ * Verdicts are kept in a fixed table, open addressed over a few slots
+ * per key; when those are all in use the oldest verdict gives way. A
+ * verdict lost that way only costs a trip to the hardware.
+ *
+ */
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+
+typedef struct dedup_ent {
+	uint64_t key;							/* target fields */
+	uint32_t when;							/* ms the verdict arrived */
+	uint8_t status;							/* the verdict */
+	uint8_t used;
+} dedup_ent_t;
+
+typedef struct dedup {
+	uint32_t window;						/* ms a verdict is reused for */
+	uint32_t mask;							/* slots - 1 */
+	dedup_ent_t *ent;
+} dedup_t;
+
+/*
+ * dedup_init() -- creates a table of slots verdicts (rounded up to a
+ * power of two), each reused for window ms.
+ *
+ * returns: 0 on success; -1 if out of memory.
+ */
+int dedup_init(dedup_t *d,uint32_t window,uint32_t slots);
+
+/*
+ * dedup_free() -- releases the table
+ */
+void dedup_free(dedup_t *d);
+
+/*
+ * dedup_key() -- the key of the target message at bp: its lat, long
+ * and weapon fields, in either format.
+ */
+uint64_t dedup_key(const uint8_t *bp);
+
+/*
+ * dedup_get() -- looks up the verdict for key at time now (ms).
+ *
+ * returns: 1 and the verdict in *status if one arrived within the
+ * window; 0 if not.
+ */
+int dedup_get(const dedup_t *d,uint64_t key,uint32_t now,uint8_t *status);
+
+/*
+ * dedup_put() -- records the verdict status for key, arrived at now.
+ */
+void dedup_put(dedup_t *d,uint64_t key,uint32_t now,uint8_t status);
+
+#endif /* DEDUP_H */
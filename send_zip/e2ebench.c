@@ -0,0 +1,549 @@
+/*
+ * e2ebench.c -- end-to-end loopback benchmark for s_hw
+ *
+ * Description: starts s_hw (with the simulator linked in) on a free
+ * loopback port and drives it with an open-loop client at each of
+ * several offered loads. An AOZ is uploaded first so every target is
+ * valid and answered. Targets use the extended format so each one
+ * carries a unique 32-bit msgid, which times its round trip. For
+ * each load it reports achieved throughput, latency percentiles and
+ * the CPU used by the server and the system calls its event loop made
+ * per message (scraped from its metrics), and writes the same as CSV.
+ *
+ * With -u the targets go as UDP datagrams (s_hw -u) instead, conns
+ * being the number of client sockets; the AOZ still goes over TCP.
+ * With -U they go over Unix SOCK_SEQPACKET connections (s_hw -U), to
+ * compare the latency of a local transport with loopback TCP.
+ * Passing -I to the server (e2ebench -- -I) compares its io_uring
+ * backend with epoll. With -D (e2ebench -- -D ms) the server sheds
+ * what it cannot answer in time: targets answered BUSY are counted
+ * apart and left out of the latencies.
+ *
+ * With -k each connection asks the server for its credit (a CREDIT
+ * message) and keeps within it, getting one more back with each
+ * response, instead of sending open loop: targets that are due wait
+ * in the client rather than being lost when the server falls behind,
+ * and a step ends once what was sent by its end has been answered.
+ *
+ * With -t the targets are timed (MSG_TIME, see msg.h), and the
+ * latency is also split by hop, from the times in the responses: to
+ * the server, waiting there for the hardware, at the hardware, and
+ * back to the client. The hops' percentiles are printed under each
+ * load's and added to the CSV.
+ *
+ * usage: e2ebench [-s server] [-c conns] [-d secs] [-l load,load,...]
+ *                 [-o file.csv] [-u | -U] [-k | -t] [-- server options]
+ *
+ */
+#include <stdio.h>		/* printf */
+#include <stdlib.h> 		/* EXIT_FAILURE & EXIT_SUCCESS */
+#include <string.h>		/* memset */
+#include <arpa/inet.h>		/* htons & inet_addr */
+#include <sys/socket.h>		/* socket calls */
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <netinet/tcp.h>	/* TCP_NODELAY */
+#include <unistd.h>		/* close */
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include "defs.h"
+#include "msg.h"
+
+#define MAXCONNS 256
+#define MAXARGS 32
+#define LOADS "1000,5000,20000,50000,100000"
+#define DRAIN_NS 1000000000ull				/* wait for stragglers after a step */
+#define UDPBATCH 64							/* datagrams per sendmmsg and recvmmsg */
+#define SYSCALLS "shw_event_loop_syscalls_total"
+#define CREDITID 0xffffffffu				/* msgid of a credit query */
+#define HOPS 4								/* to s_hw, queued, hardware, back */
+
+typedef struct cconn {						/* a client connection */
+	int fd;
+	int credit;								/* targets it may send now (-k) */
+	int out;								/* targets sent and not yet answered */
+	int asking;								/* a credit query is outstanding */
+	size_t rlen;
+	uint8_t rbuf[64*RSIZE_T];
+} cconn_t;
+
+static cconn_t cc[MAXCONNS];
+static uint64_t *sendt;						/* send time by msgid */
+static uint64_t *lat;						/* latencies received this step */
+static uint64_t *hop[HOPS];					/* and their hops (-t) */
+static uint32_t nsent,nrecv,nbusy;
+static int udp;								/* targets as datagrams */
+static int credits;							/* keep within the server's credit (-k) */
+static int timed;							/* timed targets (-t) */
+static int msz = TSIZE_X, rsz = RSIZE_X;	/* their length, and their responses' */
+static char unixpath[64];					/* or over this Unix socket */
+static char metricspath[64];				/* the server's metrics */
+
+static uint64_t nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+/* the time of day, as timed messages carry it */
+static uint64_t nsreal(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+/* a port nobody is listening on right now */
+static uint16_t freeport(void) {
+	struct sockaddr_in a;
+	socklen_t len = sizeof(a);
+	int s = socket(AF_INET,SOCK_STREAM,0);
+
+	memset(&a,0,sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(s,(struct sockaddr*)&a,sizeof(a)) < 0 || getsockname(s,(struct sockaddr*)&a,&len) < 0)
+		errorExit("e2ebench: cannot find a free port\n");
+	close(s);
+	return ntohs(a.sin_port);
+}
+
+/* a TCP connection, or a connected UDP socket, to the server */
+static int dial(uint16_t port,int type) {
+	struct sockaddr_in a;
+	int s, one = 1, big = 4<<20;
+
+	memset(&a,0,sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_port = htons(port);
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if((s = socket(AF_INET,type,0)) < 0)
+		return -1;
+	if(connect(s,(struct sockaddr*)&a,sizeof(a)) < 0) {
+		close(s);
+		return -1;
+	}
+	if(type == SOCK_STREAM)
+		setsockopt(s,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+	else
+		setsockopt(s,SOL_SOCKET,SO_RCVBUF,&big,sizeof(big));	/* each response costs ~1KB of it */
+	return s;
+}
+
+/* a SOCK_SEQPACKET connection to the server's Unix socket */
+static int dialunix(void) {
+	struct sockaddr_un a;
+	int s;
+
+	memset(&a,0,sizeof(a));
+	a.sun_family = AF_UNIX;
+	strcpy(a.sun_path,unixpath);
+	if((s = socket(AF_UNIX,SOCK_SEQPACKET,0)) < 0)
+		return -1;
+	if(connect(s,(struct sockaddr*)&a,sizeof(a)) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+/* a counter from the server's metrics; 0 if it cannot be read */
+static double scrape(const char *name) {
+	static char buf[1<<16];
+	struct sockaddr_un a;
+	const char *req = "GET /metrics HTTP/1.0\r\n\r\n";
+	char *p;
+	size_t len = 0;
+	ssize_t n;
+	int s;
+
+	memset(&a,0,sizeof(a));
+	a.sun_family = AF_UNIX;
+	strcpy(a.sun_path,metricspath);
+	if((s = socket(AF_UNIX,SOCK_STREAM,0)) < 0)
+		return 0;
+	if(connect(s,(struct sockaddr*)&a,sizeof(a)) < 0 || send(s,req,strlen(req),0) < 0) {
+		close(s);
+		return 0;
+	}
+	while(len < sizeof(buf)-1 && (n = recv(s,buf+len,sizeof(buf)-1-len,0)) > 0)
+		len += n;
+	close(s);
+	buf[len] = '\0';
+	for(p = buf; (p = strstr(p,name)) != NULL; p++)
+		if(p[-1] == '\n' && p[strlen(name)] == ' ')
+			return atof(p+strlen(name));
+	return 0;
+}
+
+/* server CPU time so far, in seconds */
+static double cputime(pid_t pid) {
+	char path[64], buf[1024], *p;
+	unsigned long ut, st;
+	FILE *f;
+	int i;
+
+	snprintf(path,sizeof(path),"/proc/%d/stat",(int)pid);
+	if((f = fopen(path,"r")) == NULL)
+		return 0;
+	if(fgets(buf,sizeof(buf),f) == NULL) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	p = strrchr(buf,')');					/* skip pid and (comm) */
+	for(i=0; p && i<12; i++)				/* utime is field 14 */
+		p = strchr(p+1,' ');
+	if(p == NULL || sscanf(p," %lu %lu",&ut,&st) != 2)
+		return 0;
+	return (double)(ut+st)/sysconf(_SC_CLK_TCK);
+}
+
+static int cmpu(const void *a,const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static double pct(uint64_t *v,uint32_t n,double p) {
+	if(n == 0)
+		return 0;
+	return v[(uint32_t)(p*(n-1))]/1000.0;		/* microseconds */
+}
+
+/* ask the server for c's credit */
+static void ask(cconn_t *c) {
+	uint8_t q[KSIZE_X] = { CREDIT|MSG_EXT };
+
+	msgid_set(q,KSIZE_X,CREDITID);
+	if(send(c->fd,q,KSIZE_X,MSG_DONTWAIT|MSG_NOSIGNAL) == KSIZE_X)
+		c->asking = 1;
+}
+
+/* the time from a to b, clocks being what they are: never negative */
+static uint64_t span(uint64_t a,uint64_t b) {
+	return b > a ? b-a : 0;
+}
+
+/* split the round trip of the timed response rsp, received at real, by hop */
+static void hops(const uint8_t *rsp,uint64_t real) {
+	uint64_t ts[4];
+
+	rsptimes(rsp,ts);
+	hop[0][nrecv] = span(ts[0],ts[1]);
+	hop[1][nrecv] = span(ts[1],ts[2]);
+	hop[2][nrecv] = span(ts[2],ts[3]);
+	hop[3][nrecv] = span(ts[3],real);
+}
+
+/* time the response rsp, received at now on c */
+static void got(cconn_t *c,const uint8_t *rsp,uint64_t now) {
+	uint32_t id = msgid_get(rsp,rsz);
+
+	if(id == CREDITID) {
+		c->credit = rsp[0];
+		c->asking = 0;
+		return;
+	}
+	if(id < nsent && sendt[id]) {
+		c->credit++;
+		c->out--;
+		if(rsp[timed] == BUSY)				/* a timed response starts with the type */
+			nbusy++;
+		else {
+			if(timed)
+				hops(rsp,nsreal());
+			lat[nrecv++] = now - sendt[id];
+		}
+		sendt[id] = 0;
+	}
+}
+
+/* collect every complete response waiting on c */
+static void recv_responses(cconn_t *c) {
+	ssize_t n;
+	size_t i;
+
+	while((n = recv(c->fd,c->rbuf+c->rlen,sizeof(c->rbuf)-c->rlen,MSG_DONTWAIT)) > 0) {
+		uint64_t now = nsnow();
+		c->rlen += n;
+		for(i=0; i+rsz <= c->rlen; i+=rsz)
+			got(c,c->rbuf+i,now);
+		memmove(c->rbuf,c->rbuf+i,c->rlen-i);
+		c->rlen -= i;
+	}
+}
+
+/* as recv_responses(), a batch of datagrams at a time */
+static void recv_datagrams(cconn_t *c) {
+	static uint8_t buf[UDPBATCH][RSIZE_T];
+	struct mmsghdr mm[UDPBATCH];
+	struct iovec iov[UDPBATCH];
+	int i, n;
+
+	memset(mm,0,sizeof(mm));
+	for(i=0; i<UDPBATCH; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = rsz;
+		mm[i].msg_hdr.msg_iov = &iov[i];
+		mm[i].msg_hdr.msg_iovlen = 1;
+	}
+	while((n = recvmmsg(c->fd,mm,UDPBATCH,MSG_DONTWAIT,NULL)) > 0) {
+		uint64_t now = nsnow();
+		for(i=0; i<n; i++)
+			if(mm[i].msg_len == (unsigned)rsz)
+				got(c,buf[i],now);
+	}
+}
+
+/* send up to UDPBATCH of the targets due, as datagrams in one call */
+static void send_datagrams(cconn_t *c,const uint8_t *msg,uint32_t due,uint32_t *dropped) {
+	static uint8_t buf[UDPBATCH][TSIZE_T];
+	struct mmsghdr mm[UDPBATCH];
+	struct iovec iov[UDPBATCH];
+	uint32_t first = nsent;
+	uint64_t now = nsnow();
+	int i, n, k;
+
+	memset(mm,0,sizeof(mm));
+	for(k=0; nsent < due && k < UDPBATCH && (!credits || k < c->credit); k++, nsent++) {
+		memcpy(buf[k],msg,msz);
+		if(timed)
+			msgtime_set(buf[k],msz,nsreal());
+		msgid_set(buf[k],msz,nsent);
+		sendt[nsent] = now;
+		iov[k].iov_base = buf[k];
+		iov[k].iov_len = msz;
+		mm[k].msg_hdr.msg_iov = &iov[k];
+		mm[k].msg_hdr.msg_iovlen = 1;
+	}
+	n = sendmmsg(c->fd,mm,k,MSG_DONTWAIT);
+	c->credit -= n < 0 ? 0 : n;
+	c->out += n < 0 ? 0 : n;
+	for(i = n < 0 ? 0 : n; i<k; i++) {		/* client socket full: shed here */
+		sendt[first+i] = 0;
+		(*dropped)++;
+	}
+}
+
+/* the next connection from next on with credit to send; -1 if none has, asking those with nothing out */
+static int credited(int next,int conns) {
+	int i, k;
+
+	for(i=0; i<conns; i++) {
+		k = (next+i)%conns;
+		if(!credits || cc[k].credit > 0)
+			return k;
+	}
+	for(k=0; k<conns; k++)
+		if(cc[k].out == 0 && !cc[k].asking)
+			ask(&cc[k]);
+	return -1;
+}
+
+/* drive one offered load (msgs/s) and report on it */
+static void run_load(FILE *out,pid_t pid,int conns,double secs,long load) {
+	uint32_t total = (uint32_t)(load*secs);
+	uint64_t t0, tend, now;
+	uint8_t msg[TSIZE_T];
+	double cpu0, cpu1, sys0, sys1, elapsed;
+	uint32_t dropped = 0, want = total;
+	int ep, i, n, next = 0, k;
+	struct epoll_event ev, evs[MAXCONNS];
+
+	sendt = calloc(total+1,sizeof(uint64_t));
+	lat = calloc(total+1,sizeof(uint64_t));
+	for(i=0; timed && i<HOPS; i++)
+		hop[i] = calloc(total+1,sizeof(uint64_t));
+	nsent = nrecv = nbusy = 0;
+	ep = epoll_create1(0);
+	for(i=0; i<conns; i++) {
+		ev.events = EPOLLIN;
+		ev.data.u32 = i;
+		epoll_ctl(ep,EPOLL_CTL_ADD,cc[i].fd,&ev);
+		cc[i].credit = cc[i].out = cc[i].asking = 0;
+	}
+
+	c1_t *p = (c1_t*)msg;					/* a target inside the AOZ */
+	p->type = timed ? TARGET|MSG_EXT|MSG_TIME : TARGET|MSG_EXT;
+	p->lat_deg = 10;
+	p->lat_min = p->lat_sec = 0;
+	p->long_deg = 100;
+	p->long_min = p->long_sec = 0;
+	p->weapon = 1;
+
+	sys0 = scrape(SYSCALLS);
+	cpu0 = cputime(pid);
+	t0 = nsnow();
+	tend = t0 + (uint64_t)(secs*1e9);
+	while((now = nsnow()) < tend + DRAIN_NS && nrecv+nbusy+dropped < want) {
+		if(credits && now >= tend)			/* what is still due was never sent */
+			want = nsent;
+		else if(nsent < total) {			/* send what is due by now */
+			uint32_t due = now < tend ? (uint32_t)((now-t0)*(double)load/1e9) : total;
+			if(due > total) due = total;
+			if(udp && nsent < due && (k = credited(next,conns)) >= 0) {	/* a batch, then collect: datagrams do not wait */
+				send_datagrams(&cc[k],msg,due,&dropped);
+				next = (k+1)%conns;
+			}
+			while(!udp && nsent < due && (k = credited(next,conns)) >= 0) {
+				msgid_set(msg,msz,nsent);
+				if(timed)
+					msgtime_set(msg,msz,nsreal());
+				sendt[nsent] = nsnow();
+				if(send(cc[k].fd,msg,msz,MSG_DONTWAIT|MSG_NOSIGNAL) != msz) {
+					sendt[nsent] = 0;		/* client socket full: shed here */
+					dropped++;
+				}
+				else {
+					cc[k].credit--;
+					cc[k].out++;
+				}
+				nsent++;
+				next = (k+1)%conns;
+			}
+		}
+		n = epoll_wait(ep,evs,MAXCONNS,0);
+		for(i=0; i<n; i++)
+			if(udp)
+				recv_datagrams(&cc[evs[i].data.u32]);
+			else
+				recv_responses(&cc[evs[i].data.u32]);
+	}
+	elapsed = (double)(nsnow()-t0)/1e9;		/* includes draining the last responses */
+	cpu1 = cputime(pid);
+	sys1 = scrape(SYSCALLS);
+	close(ep);
+
+	qsort(lat,nrecv,sizeof(uint64_t),cmpu);
+	double tput = nrecv/elapsed;
+	double spm = nrecv+nbusy ? (sys1-sys0)/(nrecv+nbusy) : 0;
+	printf("%8ld %10.0f %8u %8u %8u %8.1f %8.1f %8.1f %8.1f %8.1f %6.1f %7.2f\n",
+		   load,tput,nrecv,nbusy,nsent-nrecv-nbusy,
+		   pct(lat,nrecv,0.50),pct(lat,nrecv,0.90),pct(lat,nrecv,0.99),pct(lat,nrecv,0.999),
+		   pct(lat,nrecv,1.0),100*(cpu1-cpu0)/elapsed,spm);
+	fprintf(out,"%ld,%d,%.0f,%u,%u,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f",
+			load,conns,tput,nsent,nrecv,nbusy,dropped,
+			pct(lat,nrecv,0.50),pct(lat,nrecv,0.90),pct(lat,nrecv,0.99),pct(lat,nrecv,0.999),
+			pct(lat,nrecv,1.0),100*(cpu1-cpu0)/elapsed,spm);
+	if(timed) {
+		static const char *name[HOPS] = { "to server", "queued", "hardware", "to client" };
+		for(i=0; i<HOPS; i++) {
+			qsort(hop[i],nrecv,sizeof(uint64_t),cmpu);
+			printf("%18s %8.1f p50us %8.1f p99us\n",name[i],pct(hop[i],nrecv,0.50),pct(hop[i],nrecv,0.99));
+			fprintf(out,",%.1f,%.1f",pct(hop[i],nrecv,0.50),pct(hop[i],nrecv,0.99));
+			free(hop[i]);
+		}
+	}
+	fprintf(out,"\n");
+	fflush(stdout);
+
+	for(i=0; i<conns; i++) {				/* late responses must not leak into the next step */
+		close(cc[i].fd);
+		cc[i].rlen = 0;
+	}
+	free(sendt);
+	free(lat);
+}
+
+static void usage(char *prog) {
+	fprintf(stderr,"usage: %s [-s server] [-c conns] [-d secs] [-l load,load,...] [-o file.csv] [-u | -U] [-k | -t] [-- server options]\n",prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc,char **argv) {
+	char *server = "./s_hw", *loads = LOADS, *outname = "bench-e2e.csv";
+	char *sargv[MAXARGS], portstr[16], *tok;
+	int conns = 8, opt, i, sargc = 0;
+	double secs = 2;
+	uint16_t port;
+	pid_t pid;
+	FILE *out;
+
+	while((opt = getopt(argc,argv,"s:c:d:l:o:uUkt")) != -1) {
+		switch(opt) {
+		case 's': server = optarg; break;
+		case 'c': conns = atoi(optarg); break;
+		case 'd': secs = atof(optarg); break;
+		case 'l': loads = optarg; break;
+		case 'o': outname = optarg; break;
+		case 'u': udp = 1; break;
+		case 'k': credits = 1; break;
+		case 't': timed = 1; msz = TSIZE_T; rsz = RSIZE_T; break;
+		case 'U': snprintf(unixpath,sizeof(unixpath),"/tmp/e2ebench.%d.sock",(int)getpid()); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(conns <= 0 || conns > MAXCONNS || secs <= 0 || (udp && unixpath[0]) || (credits && timed))	/* credit answers are untimed */
+		usage(argv[0]);
+
+	port = freeport();
+	snprintf(portstr,sizeof(portstr),"%d",port);
+	sargv[sargc++] = server;
+	sargv[sargc++] = "-q";
+	sargv[sargc++] = "-p";
+	sargv[sargc++] = portstr;
+	if(udp) {								/* the same port number, for datagrams */
+		sargv[sargc++] = "-u";
+		sargv[sargc++] = portstr;
+	}
+	if(unixpath[0]) {
+		sargv[sargc++] = "-U";
+		sargv[sargc++] = unixpath;
+	}
+	snprintf(metricspath,sizeof(metricspath),"/tmp/e2ebench.%d.metrics",(int)getpid());
+	sargv[sargc++] = "-m";
+	sargv[sargc++] = metricspath;
+	for(i=optind; i<argc && sargc<MAXARGS-1; i++)	/* extra server options */
+		sargv[sargc++] = argv[i];
+	sargv[sargc] = NULL;
+
+	if((pid = fork()) < 0)
+		errorExit("e2ebench: fork failed\n");
+	if(pid == 0) {
+		prctl(PR_SET_PDEATHSIG,SIGTERM);		/* do not outlive the benchmark */
+		freopen("/dev/null","w",stdout);
+		execv(server,sargv);
+		fprintf(stderr,"e2ebench: cannot run %s\n",server);
+		_exit(EXIT_FAILURE);
+	}
+	for(i=0; i<100 && (cc[0].fd = dial(port,SOCK_STREAM)) < 0; i++)	/* wait for it to listen */
+		usleep(20000);
+	if(cc[0].fd < 0) {
+		kill(pid,SIGTERM);
+		errorExit("e2ebench: server did not start\n");
+	}
+
+	uint8_t aoz[A_ESIZE] = { AOZ, 9,0,0, 90,0,0,0, 11,0,0, 110,0,0,0, 0 };
+	uint8_t rsp[RSIZE];
+	if(send(cc[0].fd,aoz,A_ESIZE,0) != A_ESIZE || recv(cc[0].fd,rsp,RSIZE,MSG_WAITALL) != RSIZE) {
+		kill(pid,SIGTERM);
+		errorExit("e2ebench: could not upload the AOZ\n");
+	}
+	close(cc[0].fd);
+
+	if((out = fopen(outname,"w")) == NULL) {
+		kill(pid,SIGTERM);
+		errorExit("e2ebench: cannot open output file\n");
+	}
+	fprintf(out,"load,conns,throughput,sent,received,busy,shed,p50_us,p90_us,p99_us,p999_us,max_us,server_cpu_pct,server_syscalls_per_msg%s\n",
+			timed ? ",to_server_p50_us,to_server_p99_us,queued_p50_us,queued_p99_us,hardware_p50_us,hardware_p99_us,to_client_p50_us,to_client_p99_us" : "");
+	printf("s_hw on port %d, %d %s, %.1fs per load\n",port,conns,
+		   udp ? "UDP sockets" : unixpath[0] ? "Unix connections" : "connections",secs);
+	printf("%8s %10s %8s %8s %8s %8s %8s %8s %8s %8s %6s %7s\n",
+		   "offered","msgs/s","recv","busy","lost","p50us","p90us","p99us","p999us","maxus","cpu%","sys/msg");
+	for(tok = strtok(strdup(loads),","); tok; tok = strtok(NULL,",")) {
+		for(i=0; i<conns; i++)
+			if((cc[i].fd = unixpath[0] ? dialunix() : dial(port,udp ? SOCK_DGRAM : SOCK_STREAM)) < 0) {
+				kill(pid,SIGTERM);
+				errorExit("e2ebench: cannot connect\n");
+			}
+		run_load(out,pid,conns,secs,atol(tok));
+	}
+	fclose(out);
+	kill(pid,SIGTERM);
+	waitpid(pid,NULL,0);
+	printf("results written to %s\n",outname);
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,117 @@
+/*
+ * handoff.c -- passing s_hw's sockets to its successor (see handoff.h)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "handoff.h"
+
+typedef struct hohdr {						/* starts every packet */
+	uint8_t kind;
+	uint32_t alen,blen;
+} hohdr_t;
+
+static int ho_addr(const char *path,struct sockaddr_un *un) {
+	memset(un,0,sizeof(*un));
+	un->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(un->sun_path))
+		return -1;
+	strcpy(un->sun_path,path);
+	return 0;
+}
+
+int ho_listen(const char *path) {
+	struct sockaddr_un un;
+	int s;
+
+	if(ho_addr(path,&un) < 0)
+		return -1;
+	unlink(path);							/* left by the predecessor */
+	if((s = socket(AF_UNIX,SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC,0)) < 0)
+		return -1;
+	if(bind(s,(struct sockaddr*)&un,sizeof(un)) < 0 || listen(s,1) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+int ho_connect(const char *path) {
+	struct sockaddr_un un;
+	int s;
+
+	if(ho_addr(path,&un) < 0 || (s = socket(AF_UNIX,SOCK_SEQPACKET|SOCK_CLOEXEC,0)) < 0)
+		return -1;
+	if(connect(s,(struct sockaddr*)&un,sizeof(un)) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+int ho_send(int sock,int kind,int fd,const void *a,uint32_t alen,const void *b,uint32_t blen) {
+	hohdr_t h = { kind, alen, blen };
+	struct iovec iov[3] = { { &h, sizeof(h) }, { (void*)a, alen }, { (void*)b, blen } };
+	union {									/* aligned for the cmsghdr */
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr m;
+
+	if((size_t)alen + blen > HO_BUFSZ)
+		return -1;
+	memset(&m,0,sizeof(m));
+	m.msg_iov = iov;
+	m.msg_iovlen = 3;
+	if(fd >= 0) {
+		struct cmsghdr *cm;
+		m.msg_control = ctl.buf;
+		m.msg_controllen = sizeof(ctl.buf);
+		cm = CMSG_FIRSTHDR(&m);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cm),&fd,sizeof(int));
+	}
+	return sendmsg(sock,&m,MSG_NOSIGNAL) == (ssize_t)(sizeof(h)+alen+blen) ? 0 : -1;
+}
+
+int ho_recv(int sock,int *fd,uint8_t *buf,uint32_t *alen,uint32_t *blen) {
+	hohdr_t h;
+	struct iovec iov[2] = { { &h, sizeof(h) }, { buf, HO_BUFSZ } };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr m;
+	struct cmsghdr *cm;
+	ssize_t n;
+
+	memset(&m,0,sizeof(m));
+	m.msg_iov = iov;
+	m.msg_iovlen = 2;
+	m.msg_control = ctl.buf;
+	m.msg_controllen = sizeof(ctl.buf);
+	*fd = -1;
+	if((n = recvmsg(sock,&m,MSG_CMSG_CLOEXEC)) < (ssize_t)sizeof(h))
+		return -1;
+	for(cm = CMSG_FIRSTHDR(&m); cm != NULL; cm = CMSG_NXTHDR(&m,cm))
+		if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+			memcpy(fd,CMSG_DATA(cm),sizeof(int));
+	if((m.msg_flags & (MSG_TRUNC|MSG_CTRUNC)) || (size_t)n != sizeof(h)+h.alen+h.blen) {
+		if(*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		return -1;
+	}
+	*alen = h.alen;
+	*blen = h.blen;
+	return h.kind;
+}
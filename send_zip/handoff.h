@@ -0,0 +1,66 @@
+/*
+ * handoff.h -- passing s_hw's sockets to the process that replaces it
+ *
+ * Description: an s_hw started with -H path listens for its successor
+ * on a Unix SOCK_SEQPACKET socket at path. A new s_hw given the same
+ * path connects there instead of binding its own sockets. The old one
+ * stops taking messages and waits for the hardware to answer what is
+ * in flight. It then sends, one packet each, its listening sockets,
+ * its zones and every open client connection, with the bytes it had
+ * read but not handled and the responses not yet sent. Descriptors go
+ * over the socket with SCM_RIGHTS. Then it exits. The listening
+ * sockets are never closed, so a producer never sees a refusal:
+ * connections made meanwhile wait in the backlog for the successor.
+ *
+ */
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define HO_LISTEN 1							/* the TCP listening socket */
+#define HO_UDP    2							/* the UDP socket (-u) */
+#define HO_UNIX   3							/* the Unix listening socket (-U) */
+#define HO_CONN   4							/* a TCP client: unread bytes, then unsent */
+#define HO_PACKET 5							/* a Unix client: the same */
+#define HO_ZONES  6							/* part of zones_save()'s buffer; no descriptor */
+#define HO_END    7							/* the last packet */
+
+#define HO_CHUNK 65536						/* zone bytes in a packet */
+#define HO_BUFSZ (HO_CHUNK+4096)			/* most data bytes in a packet: a grown rbuf and a wbuf */
+
+/*
+ * ho_listen() -- listens for a successor at path, replacing any socket
+ * left there
+ *
+ * returns: the listening socket (non-blocking); -1 on error.
+ */
+int ho_listen(const char *path);
+
+/*
+ * ho_connect() -- connects to a running s_hw listening at path
+ *
+ * returns: the connection; -1 if nothing is listening there.
+ */
+int ho_connect(const char *path);
+
+/*
+ * ho_send() -- sends one packet of kind, with descriptor fd unless it
+ * is -1, carrying alen bytes at a then blen bytes at b, together at
+ * most HO_BUFSZ
+ *
+ * returns: 0 on success; -1 on error.
+ */
+int ho_send(int sock,int kind,int fd,const void *a,uint32_t alen,const void *b,uint32_t blen);
+
+/*
+ * ho_recv() -- receives one packet into buf, of HO_BUFSZ bytes: its
+ * descriptor in *fd (-1 if none), its two parts' lengths in *alen and
+ * *blen, the parts one after the other in buf
+ *
+ * returns: the packet's kind; -1 on error or if the sender has gone.
+ */
+int ho_recv(int sock,int *fd,uint8_t *buf,uint32_t *alen,uint32_t *blen);
+
+#endif /* HANDOFF_H */
@@ -1,80 +1,137 @@
-/* 
+/*
  * hw.c --- simulates the fifo
- * 
+ *
  * Author: Stephen Taylor
  * Created: 12-21-2020
- * Version: 1.0
- * 
+ * Version: 1.1
+ *
  * Description: grabs data from the input and sends to the output
- * NOTE: 10 class to read before the data is returned to simulate 
+ * NOTE: 10 class to read before the data is returned to simulate
  * return without data
- * 
+ *
+ * Packets are queued in order, as in the real fifo, so several
+ * writes may be outstanding before the first response comes back.
+ * A write that does not fit in the remaining fifo space is dropped.
+ *
  */
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <hw.h>
+#include "msg.h"
 
 int cnt = 0;										/* number of returns without data */
 
 #define MAX 2000								/* the fifo size */
-uint8_t hw[MAX];								/* big enough hardware buffer */
-size_t hwlen;
+#define PKTMAX 64								/* largest simulated packet */
+#define NPKT (MAX/TSIZE)						/* most packets the fifo can hold */
+
+static uint8_t hw[NPKT][PKTMAX];				/* queued packets */
+static size_t hwlen[NPKT];						/* and their lengths */
+static int head,tail,npkt;						/* oldest, next free, number queued */
+static size_t used;								/* bytes in the fifo */
 #define RES_S 2
 
+hwstats_t hwstats = { .txdepth = MAX/4, .pktmax = PKTMAX };	/* see hw.h */
+
+#define STAT_ADD(f,n) atomic_fetch_add_explicit(&hwstats.f,(n),memory_order_relaxed)
+
+/* raise a high-water mark; only the driver writes them */
+static void stat_max(_Atomic unsigned long long *hwm,unsigned long long v) {
+	if(v > atomic_load_explicit(hwm,memory_order_relaxed))
+		atomic_store_explicit(hwm,v,memory_order_relaxed);
+}
+
+/* remove the oldest packet from the fifo */
+static void hwpop(void) {
+	used -= hwlen[head];
+	head = (head+1)%NPKT;
+	npkt--;
+}
 
 ssize_t hwread(int fd,void *buf, size_t count) {
-	uint8_t *bp;
-	int i;
-	
+	size_t len;
+
 	cnt++;
-	if((cnt%10)!=0) 							/* return with nothing 10 times */
+	if((cnt%10)!=0 || npkt==0) 				/* return with nothing 10 times */
 		return 0;
-	for(bp=(uint8_t*)buf,i=0; i<hwlen; i++) /* otherwise */
-		*bp++ = hw[i];							/* return the data */
-	return hwlen;			  						/* and its length */
+	len = hwlen[head];							/* otherwise */
+	if(len > count) {
+		fprintf(stderr,"ERROR hwread() packet length (%d) exceeds receive buffer length (%d).  Dropping.\n",
+				(int)len,(int)count);
+		hwpop();
+		STAT_ADD(rxoversize,1);
+		return -1;
+	}
+	memcpy(buf,hw[head],len);					/* return the data */
+	hwpop();
+	STAT_ADD(rxpkts,1);
+	STAT_ADD(rxbytes,len);
+	stat_max(&hwstats.rxlenmax,len);
+	return len;			  						/* and its length */
 }
 
 ssize_t hwwrite(int fd,const void *buf, size_t count) {
-	uint8_t *bp;
-	int i;
-
-	for(bp=(uint8_t*)buf,i=0; i<count; i++) /* copy data to hardware */
-		hw[i] = *bp++;												
-	hwlen = count;								/* record its length */
+	if(count > PKTMAX || npkt == NPKT || used+count > MAX) {
+		fprintf(stderr,"ERROR hwwrite() packet length (%d) exceeds transmit FIFO capacity.  Dropping.\n",
+				(int)count);
+		STAT_ADD(txfull,1);
+		return -1;
+	}
+	memcpy(hw[tail],buf,count);					/* copy data to hardware */
+	hwlen[tail] = count;						/* record its length */
+	tail = (tail+1)%NPKT;
+	npkt++;
+	used += count;
+	STAT_ADD(txpkts,1);
+	STAT_ADD(txbytes,count);
+	stat_max(&hwstats.txoccmax,(used+3)/4);
 	return count;									/* say we took count bytes */
 }
 
 
 static uint8_t tar_type = 0x40;
 ssize_t hwresponse(int fd,void *buf, size_t count) {
-	uint8_t *bp;
-	
+	uint8_t *bp,*pkt;
+	size_t len;
+
 	cnt++;
-	if((cnt%10)!=0) 							/* return with nothing 10 times */
+	if((cnt%10)!=0 || npkt==0) 				/* return with nothing 10 times */
 		return 0;
 
-	hwlen =2;
-
+	pkt = hw[head];
+	len = hwlen[head];
 	bp = (uint8_t*)buf;
 					/* return iterative response*/
-	if (hw[0] == 0x10 || hw[0] == 0x20 ){
+	if (MSG_TYPE(pkt[0]) == AOZ || MSG_TYPE(pkt[0]) == EZ ){
 
-		/* randomly set the response message 
+		/* randomly set the response message
 		if aoz/ex respond with ACK/NAK */
 		int n = tar_type / 0x10;
 		if (n %0x2 != 0){
-			*bp++ = 0x81;
+			*bp++ = NAK;
 		}
 		else{
-			*bp++ = 0x80;
+			*bp++ = ACK;
 		}
-		*bp++ = hw[15];						/* get the message ID */
 
 	}
-	else if(hw[0] == 0x30){
+	else {
 		*bp++ = tar_type;
-		*bp++ = hw[9];						/* get the message ID */
 	}
+	if (pkt[0] & MSG_EXT) {						/* echo the 32-bit message ID */
+		memcpy(bp,pkt+len-4,4);
+		len = RSIZE_X;
+	}
+	else {
+		*bp = pkt[len-1];						/* get the message ID */
+		len = RSIZE;
+	}
+	hwpop();
+	STAT_ADD(rxpkts,1);
+	STAT_ADD(rxbytes,len);
+	stat_max(&hwstats.rxlenmax,len);
 
 	if (tar_type == 0x70) {
 		tar_type = 0x40;
@@ -82,8 +139,11 @@ ssize_t hwresponse(int fd,void *buf, size_t count) {
 	else{
 		tar_type += 0x10;
 	}
-	return hwlen;			  						/* and its length */
+	return len;			  						/* and its length */
 }
 
-
-
+int hwinit(int fd) {
+	memset(hw,0,sizeof(hw));					/* fault in the simulated fifo */
+	memset(hwlen,0,sizeof(hwlen));
+	return 0;
+}
@@ -10,7 +10,17 @@
  * write interface but initially assumes there is just a single piece
  * of hardware to work with.
  * 
+ * Programs linked with hwclient.o rather than the driver get the
+ * same interface by way of hwbroker, which owns the hardware and
+ * shares it between them (see hwshm.h).
+ * 
+ * A packet must fit the transmit fifo; longer payloads go in chunks,
+ * reassembled in place on the far side (see hwseg.h).
+ * 
  */
+#ifndef HW_H
+#define HW_H
+
 #define DEVOUT "/dev/null"				/* currently unused */
 #define DEVIN "/dev/null"				/* currently unused */
 
@@ -39,3 +49,43 @@ ssize_t hwwrite(int fd,const void *buf, size_t count);
  */
 ssize_t hwresponse(int fd,void *buf, size_t count);
 
+/* 
+ * hwinit() -- Prepares the hardware ahead of the first read or
+ * write, so that the first message does not pay for mapping and
+ * resetting it. Optional: hwread() and hwwrite() do it on first use.
+ * 
+ * returns: 0 on success; -1 on error.
+ */
+int hwinit(int fd);
+
+/* 
+ * hwstats -- running totals kept by the driver since it started.
+ *   They are atomic so that another thread may read them while the
+ *   hardware is in use; only the driver writes them.
+ */
+#include <stdatomic.h>
+typedef struct hwstats {
+	_Atomic unsigned long long txpkts,txbytes;	/* taken by hwwrite() */
+	_Atomic unsigned long long rxpkts,rxbytes;	/* returned by hwread() and hwresponse() */
+	_Atomic unsigned long long txfull;			/* writes refused for want of vacancy */
+	_Atomic unsigned long long rxoversize;		/* packets dropped as too big for the buffer */
+	_Atomic unsigned long long rpure,rpore,rpue,tpoe,tse;	/* ISR error bits seen */
+	_Atomic unsigned long long txdepth;			/* transmit fifo size, in 32-bit words */
+	_Atomic unsigned long long pktmax;			/* longest packet hwwrite() takes, in bytes; 0 if only txdepth limits it */
+	_Atomic unsigned long long txoccmax;		/* most words ever queued to transmit */
+	_Atomic unsigned long long rxlenmax;		/* largest packet received, in bytes */
+} hwstats_t;
+
+extern hwstats_t hwstats;
+
+#ifdef MMIO_PROFILE
+#include <stdio.h>
+/* 
+ * hwprofile() -- prints the register reads and writes made by each
+ *   call, and the time they took. Only the real driver, built with
+ *   -DMMIO_PROFILE, has it; it also runs at exit.
+ */
+void hwprofile(FILE *fp);
+#endif
+
+#endif /* HW_H */
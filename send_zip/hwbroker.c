@@ -0,0 +1,346 @@
+/*
+ * hwbroker.c -- owns the hardware and shares it between local programs
+ *
+ * Description: the only process to map the device. Programs linked
+ * with hwclient.o connect to its Unix socket and get a region of
+ * shared memory with a submission and a completion ring (see
+ * hwshm.h). The broker polls every submission ring in turn, writes
+ * what it finds to the device while the transmit fifo has room, and
+ * returns each answer to the ring of the program that asked.
+ *
+ * Two programs may use the same msgids, so each packet's msgid is
+ * replaced on its way to the device by the broker's own sequence
+ * number (see seqwin.h) and restored on the answer. Only the control
+ * socket makes system calls: the rings are polled, and when there is
+ * nothing to do the broker yields the processor rather than sleep.
+ *
+ * A packet the device has not answered within the timeout is given
+ * up on, so that lost answers do not hold its place in the window and
+ * the fifo for ever; its client is told through the region's lost
+ * count. An answer that comes after that is dropped as stray.
+ *
+ * usage: hwbroker [-s path] [-w window] [-t ms] [-r] [-q]
+ *   -s  the socket clients connect to (default HWB_PATH)
+ *   -w  packets in flight to the device, at most 128 (default 128)
+ *   -t  ms to wait for an answer before giving up (default 1000)
+ *   -r  collect answers with hwread(), for a device that echoes,
+ *       rather than hwresponse()
+ *   -q  print nothing but errors
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hw.h"
+#include "defs.h"
+#include "msg.h"
+#include "seqwin.h"
+#include "hwshm.h"
+
+#define MAXCLIENTS 64
+#define BATCH 8								/* packets taken from a ring before the next */
+#define IDLESPIN 64							/* empty passes before yielding */
+#define CTLEVERY 4096						/* passes between looks at the socket */
+#define TIMEOUT 1000						/* ms to wait for an answer */
+
+typedef struct client {
+	int sock;								/* -1 if the slot is free */
+	hwb_shm_t *shm;
+	uint32_t inflight;						/* its packets at the device */
+	int gone;								/* disconnected; freed once inflight is 0 */
+} client_t;
+
+typedef struct pend {						/* a packet at the device */
+	client_t *c;
+	uint32_t msgid;							/* the client's own */
+	uint32_t words;
+	uint64_t sent;							/* when it went to the device, ms */
+	struct pend *next;						/* free list */
+} pend_t;
+
+static client_t cl[MAXCLIENTS];
+static int nclients;
+static int rr;								/* the client to serve first */
+static pend_t pend[128], *freepend;
+static seqwin_t win;
+static uint64_t txdepth;					/* the device's fifo words; 0 if unknown */
+static uint64_t fifowords;					/* words in flight */
+static int fdout,fdin;
+static ssize_t (*devread)(int,void*,size_t) = hwresponse;
+static volatile sig_atomic_t stop;
+static int quiet;
+static uint64_t timeout = TIMEOUT;			/* -t, ms */
+static unsigned long long npkts,nanswers,ngone,nstray,nlost;
+
+static void onsignal(int sig) {
+	stop = 1;
+}
+
+static uint64_t now_ms(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static int listen_at(const char *path) {
+	struct sockaddr_un un;
+	int s;
+
+	memset(&un,0,sizeof(un));
+	un.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(un.sun_path))
+		return -1;
+	strcpy(un.sun_path,path);
+	unlink(path);							/* left by an earlier broker */
+	if((s = socket(AF_UNIX,SOCK_SEQPACKET|SOCK_NONBLOCK|SOCK_CLOEXEC,0)) < 0)
+		return -1;
+	if(bind(s,(struct sockaddr*)&un,sizeof(un)) < 0 || listen(s,LISTENQ) < 0) {
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+static void client_accept(int lsock) {
+	hwb_hello_t h = { HWB_VERSION, HWB_SLOTS, txdepth };
+	client_t *c = NULL;
+	int s,fd,i;
+
+	if((s = accept4(lsock,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC)) < 0)
+		return;
+	for(i=0; i<MAXCLIENTS && c == NULL; i++)
+		if(cl[i].sock < 0)
+			c = &cl[i];
+	if(c == NULL || (c->shm = hwshm_create(&fd)) == NULL) {
+		fprintf(stderr,"BROKER: client refused\n");
+		close(s);
+		return;
+	}
+	if(hwshm_sendfd(s,&h,fd) < 0) {
+		hwshm_unmap(c->shm);
+		close(fd);
+		close(s);
+		return;
+	}
+	close(fd);
+	c->sock = s;
+	c->inflight = 0;
+	c->gone = 0;
+	nclients++;
+	if(!quiet)
+		printf("[client %d attached]\n",(int)(c-cl));
+}
+
+static void client_free(client_t *c) {
+	hwshm_unmap(c->shm);
+	close(c->sock);
+	c->sock = -1;
+	c->shm = NULL;
+	nclients--;
+	if(!quiet)
+		printf("[client %d detached]\n",(int)(c-cl));
+}
+
+/* look at the socket: new clients, and clients that have gone */
+static void control(int lsock,int timeout) {
+	struct pollfd pfd[MAXCLIENTS+1];
+	client_t *who[MAXCLIENTS+1];
+	uint8_t junk[64];
+	int n = 0,i;
+
+	pfd[n].fd = lsock;
+	pfd[n++].events = POLLIN;
+	for(i=0; i<MAXCLIENTS; i++)
+		if(cl[i].sock >= 0 && !cl[i].gone) {
+			who[n] = &cl[i];
+			pfd[n].fd = cl[i].sock;
+			pfd[n++].events = POLLIN;
+		}
+	if(poll(pfd,n,timeout) <= 0)
+		return;
+	if(pfd[0].revents & POLLIN)
+		client_accept(lsock);
+	for(i=1; i<n; i++)
+		if(pfd[i].revents && recv(pfd[i].fd,junk,sizeof(junk),MSG_DONTWAIT) <= 0) {
+			who[i]->gone = 1;				/* clients send nothing: this is the close */
+			if(who[i]->inflight == 0)
+				client_free(who[i]);
+		}
+}
+
+/* take packets from the submission rings, in turn, while the device has room */
+static int feed(void) {
+	uint8_t pkt[HWB_PKTMAX];
+	int32_t len;
+	uint32_t words;
+	int n,k,done = 0;
+
+	for(n=0; n<MAXCLIENTS; n++) {
+		int i = (rr+n)%MAXCLIENTS;
+		client_t *c = &cl[i];
+		pend_t *p;
+
+		if(c->sock < 0 || c->gone)
+			continue;
+		for(k=0; k<BATCH && (len = hwshm_peek(&c->shm->sq,pkt)) > 0; k++) {
+			words = (len+3)/4;
+			if(seqwin_full(&win) || (txdepth != 0 && fifowords + words > txdepth)) {
+				rr = i;						/* it goes first when there is room */
+				return done;
+			}
+			p = freepend;
+			p->c = c;
+			p->msgid = msgid_get(pkt,len);
+			p->words = words;
+			p->sent = now_ms();
+			msgid_set(pkt,len,seqwin_open(&win,p));
+			if(hwwrite(fdout,(void*)pkt,len) < 0) {
+				seqwin_ack(&win,msgid_get(pkt,len));
+				rr = i;
+				return done;
+			}
+			freepend = p->next;
+			hwshm_drop(&c->shm->sq);
+			fifowords += words;
+			c->inflight++;
+			npkts++;
+			done = 1;
+		}
+	}
+	rr = (rr+1)%MAXCLIENTS;
+	return done;
+}
+
+/* a packet is done with, answered or not: its place at the device is free */
+static void pend_done(pend_t *p) {
+	client_t *c = p->c;
+
+	fifowords -= p->words;
+	p->next = freepend;
+	freepend = p;
+	c->inflight--;
+	if(c->gone && c->inflight == 0)
+		client_free(c);
+}
+
+/* return an answer from the device to the client that asked */
+static int collect(void) {
+	uint8_t rsp[HWB_PKTMAX];
+	ssize_t cnt;
+	pend_t *p;
+	client_t *c;
+
+	if(win.inflight == 0 || (cnt = devread(fdin,(void*)rsp,sizeof(rsp))) <= 0)
+		return 0;
+	if((p = seqwin_ack(&win,msgid_get(rsp,cnt))) == NULL) {
+		nstray++;
+		fprintf(stderr,"BROKER: answer to unknown msgid dropped\n");
+		return 1;
+	}
+	c = p->c;
+	msgid_set(rsp,cnt,p->msgid);
+	nanswers++;
+	if(c->gone)
+		ngone++;
+	else if(hwshm_put(&c->shm->cq,rsp,cnt) < 0)
+		ngone++;							/* it wrote more than it read back */
+	pend_done(p);
+	return 1;
+}
+
+/* give up on the packets the device has not answered in time, oldest first */
+static void expire(void) {
+	uint64_t now = now_ms();
+	uint32_t seq;
+	pend_t *p;
+
+	while((p = seqwin_oldest(&win,&seq)) != NULL && now - p->sent >= timeout) {
+		seqwin_ack(&win,seq);
+		if(!p->c->gone)
+			atomic_fetch_add_explicit(&p->c->shm->lost,1,memory_order_relaxed);
+		pend_done(p);
+		nlost++;
+	}
+}
+
+static void usage(char *prog) {
+	fprintf(stderr,"usage: %s [-s path] [-w window] [-t ms] [-r] [-q]\n",prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+	char *path = HWB_PATH;
+	uint32_t wsize = 128;
+	uint64_t passes = 0;
+	int lsock,opt,i,idle = 0;
+	struct sigaction sa;
+
+	while((opt = getopt(argc,argv,"s:w:t:rq")) != -1) {
+		switch(opt) {
+		case 's': path = optarg; break;
+		case 'w': wsize = atoi(optarg); break;
+		case 't': timeout = atol(optarg); break;
+		case 'r': devread = hwread; break;
+		case 'q': quiet = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if(wsize == 0 || wsize > 128 || timeout == 0 || seqwin_init(&win,wsize,8) < 0)
+		usage(argv[0]);
+	for(i=0; i<MAXCLIENTS; i++)
+		cl[i].sock = -1;
+	for(i=0; i<128; i++) {
+		pend[i].next = freepend;
+		freepend = &pend[i];
+	}
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler = onsignal;
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
+	signal(SIGPIPE,SIG_IGN);
+
+	fdout = open(DEVOUT,O_WRONLY);			/* open the hardware for read and write */
+	fdin = open(DEVIN,O_RDONLY);
+	if(hwinit(fdout) < 0)
+		errorExit("BROKER: Error preparing the hardware\n");
+	txdepth = atomic_load(&hwstats.txdepth);
+	if((lsock = listen_at(path)) < 0)
+		errorExit("BROKER: Error listening\n");
+	if(!quiet)
+		printf("[Brokering at %s...]\n",path);
+	fflush(stdout);
+
+	while(!stop) {
+		int done = feed() | collect();
+
+		if(++passes % CTLEVERY == 0) {
+			control(lsock,0);
+			expire();
+		}
+		if(done) {
+			idle = 0;
+			continue;
+		}
+		if(++idle < IDLESPIN)
+			continue;
+		control(lsock,nclients == 0 ? 100 : 0);	/* nobody to poll for: sleep in poll() */
+		expire();
+		sched_yield();
+	}
+	unlink(path);
+	if(!quiet)
+		printf("[%llu packets, %llu answers, %llu dropped for gone clients, %llu stray, %llu lost]\n",
+			   npkts,nanswers,ngone,nstray,nlost);
+	return 0;
+}
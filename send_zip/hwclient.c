@@ -0,0 +1,122 @@
+/*
+ * hwclient.c --- the device driver, by way of hwbroker
+ *
+ * Description: implements hw.h over the rings of hwshm.h, so that a
+ * program linked with hwclient.o instead of hw.o shares the device
+ * with the others through the broker. The fd arguments are ignored.
+ * The first call (or hwinit()) connects to the broker; after that no
+ * call makes a system call but an occasional sched_yield() while
+ * polling an empty ring. hwread() and hwresponse() both return the
+ * device's next answer, whichever the broker was started to collect.
+ * hwwrite() refuses, as the driver does when the fifo is full, when
+ * the ring is full or a ring's worth of packets is unanswered.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "hw.h"
+#include "hwshm.h"
+
+hwstats_t hwstats;							/* see hw.h */
+
+#define STAT_ADD(f,n) atomic_fetch_add_explicit(&hwstats.f,(n),memory_order_relaxed)
+
+static hwb_shm_t *shm;
+static int ctl = -1;						/* kept open: closing it detaches */
+static int failed;							/* said so once already */
+static unsigned empty;						/* polls that found nothing */
+static _Atomic uint32_t unanswered;			/* written and not yet read back */
+
+static int hwc_attach(void) {
+	struct sockaddr_un un;
+	hwb_hello_t h;
+	const char *path = getenv("HWBROKER");
+	int fd;
+
+	if(shm != NULL)
+		return 0;
+	if(failed)
+		return -1;
+	if(path == NULL)
+		path = HWB_PATH;
+	memset(&un,0,sizeof(un));
+	un.sun_family = AF_UNIX;
+	if(strlen(path) < sizeof(un.sun_path) && (ctl = socket(AF_UNIX,SOCK_SEQPACKET|SOCK_CLOEXEC,0)) >= 0) {
+		strcpy(un.sun_path,path);
+		if(connect(ctl,(struct sockaddr*)&un,sizeof(un)) == 0 && hwshm_recvfd(ctl,&h,&fd) == 0) {
+			shm = hwshm_map(fd);
+			close(fd);
+			if(shm != NULL) {
+				atomic_store(&hwstats.txdepth,h.txdepth);
+				atomic_store(&hwstats.pktmax,HWB_PKTMAX);	/* what a slot holds */
+				return 0;
+			}
+		}
+		close(ctl);
+		ctl = -1;
+	}
+	fprintf(stderr,"ERROR hwclient: no hardware broker at %s\n",path);
+	failed = 1;
+	return -1;
+}
+
+int hwinit(int fd) {
+	return hwc_attach();
+}
+
+ssize_t hwwrite(int fd,const void *buf, size_t count) {
+	if(hwc_attach() < 0)
+		return -1;
+	if(atomic_load_explicit(&shm->lost,memory_order_relaxed))	/* the broker gave up on them */
+		atomic_fetch_sub_explicit(&unanswered,atomic_exchange(&shm->lost,0),memory_order_relaxed);
+	if(count > HWB_PKTMAX || atomic_load_explicit(&unanswered,memory_order_relaxed) >= HWB_SLOTS ||
+	   hwshm_put(&shm->sq,buf,count) < 0) {
+		STAT_ADD(txfull,1);
+		return -1;
+	}
+	atomic_fetch_add_explicit(&unanswered,1,memory_order_relaxed);
+	STAT_ADD(txpkts,1);
+	STAT_ADD(txbytes,count);
+	return count;
+}
+
+/* the next answer from the completion ring */
+static ssize_t hwc_get(void *buf,size_t count) {
+	uint8_t pkt[HWB_PKTMAX];
+	int32_t len;
+
+	if(hwc_attach() < 0 || (len = hwshm_peek(&shm->cq,pkt)) == 0) {
+		if(shm != NULL && ++empty % 64 == 0)
+			sched_yield();					/* let the broker run if it shares our cpu */
+		return 0;
+	}
+	hwshm_drop(&shm->cq);
+	atomic_fetch_sub_explicit(&unanswered,1,memory_order_relaxed);
+	if((size_t)len > count) {
+		fprintf(stderr,"ERROR hwread() packet length (%d) exceeds receive buffer length (%d).  Dropping.\n",
+				(int)len,(int)count);
+		STAT_ADD(rxoversize,1);
+		return -1;
+	}
+	memcpy(buf,pkt,len);
+	STAT_ADD(rxpkts,1);
+	STAT_ADD(rxbytes,len);
+	if((unsigned long long)len > atomic_load_explicit(&hwstats.rxlenmax,memory_order_relaxed))
+		atomic_store_explicit(&hwstats.rxlenmax,len,memory_order_relaxed);
+	return len;
+}
+
+ssize_t hwread(int fd,void *buf, size_t count) {
+	return hwc_get(buf,count);
+}
+
+ssize_t hwresponse(int fd,void *buf, size_t count) {
+	return hwc_get(buf,count);
+}
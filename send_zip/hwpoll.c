@@ -0,0 +1,219 @@
+/*
+ * hwpoll.c -- dedicated hardware polling thread (see hwpoll.h)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "hw.h"
+#include "msg.h"
+#include "hwpoll.h"
+
+#define SLOTSZ 32							/* bytes per ring slot */
+#define CACHELINE 64
+
+typedef struct slot {
+	int32_t len;
+	uint8_t data[SLOTSZ-sizeof(int32_t)];
+} slot_t;
+
+typedef struct ring {						/* single producer, single consumer */
+	_Atomic uint32_t head;					/* next slot to take */
+	char pad1[CACHELINE-sizeof(uint32_t)];
+	_Atomic uint32_t tail;					/* next slot to fill */
+	char pad2[CACHELINE-sizeof(uint32_t)];
+	uint32_t mask;
+	slot_t *slot;
+} ring_t;
+
+static ring_t subq,cmpq;					/* requests in, responses out */
+static pthread_t poller;
+static _Atomic int stopping;
+static int efd = -1;
+static int hwout,hwin;
+static int lockerr;							/* errno of a failed mlockall(), or 0 */
+static uint64_t *sendt;						/* hwwrite() time of each request in flight */
+static uint32_t sthead,sttail,stmask;
+
+static _Atomic uint64_t polls;				/* statistics since the last report */
+static _Atomic uint64_t nrsp,latsum,latmin,latmax;
+static uint64_t lastreport;
+
+static uint64_t nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static int ring_init(ring_t *r,uint32_t depth) {
+	uint32_t n;
+
+	for(n=1; n<depth; n<<=1)
+		;
+	if((r->slot = calloc(n,sizeof(slot_t))) == NULL)
+		return -1;
+	r->mask = n-1;
+	atomic_init(&r->head,0);
+	atomic_init(&r->tail,0);
+	return 0;
+}
+
+static int ring_put(ring_t *r,const uint8_t *bp,int32_t len) {
+	uint32_t t = atomic_load_explicit(&r->tail,memory_order_relaxed);
+	int n = len < 0 ? -len : len;
+
+	if(t - atomic_load_explicit(&r->head,memory_order_acquire) > r->mask || n > (int)sizeof(r->slot->data))
+		return -1;
+	r->slot[t & r->mask].len = len;
+	memcpy(r->slot[t & r->mask].data,bp,n);
+	atomic_store_explicit(&r->tail,t+1,memory_order_release);
+	return 0;
+}
+
+static int32_t ring_get(ring_t *r,uint8_t *bp) {
+	uint32_t h = atomic_load_explicit(&r->head,memory_order_relaxed);
+	int32_t len;
+
+	if(h == atomic_load_explicit(&r->tail,memory_order_acquire))
+		return 0;
+	len = r->slot[h & r->mask].len;
+	memcpy(bp,r->slot[h & r->mask].data,len < 0 ? -len : len);
+	atomic_store_explicit(&r->head,h+1,memory_order_release);
+	return len;
+}
+
+/* the polling loop: no sleeping, no system calls but the wakeup, no stdio */
+static void *hwpoll_run(void *arg) {
+	uint8_t buf[SLOTSZ], rsp[SLOTSZ];
+	int32_t len;
+	ssize_t cnt;
+	uint64_t one = 1;
+
+	while(!atomic_load_explicit(&stopping,memory_order_relaxed)) {
+		int done = 0;
+
+		atomic_fetch_add_explicit(&polls,1,memory_order_relaxed);
+		while((len = ring_get(&subq,buf)) > 0) {
+			if(hwwrite(hwout,(void*)buf,len) < 0)
+				ring_put(&cmpq,buf,-len);	/* hand the refusal back */
+			else
+				sendt[sttail++ & stmask] = nsnow();
+			done = 1;
+		}
+		if(sthead != sttail && (cnt = hwresponse(hwin,(void*)rsp,sizeof(rsp))) > 0) {
+			uint64_t lat = nsnow() - sendt[sthead++ & stmask];	/* the fifo answers in order */
+			atomic_fetch_add_explicit(&nrsp,1,memory_order_relaxed);
+			atomic_fetch_add_explicit(&latsum,lat,memory_order_relaxed);
+			if(lat < atomic_load_explicit(&latmin,memory_order_relaxed))
+				atomic_store_explicit(&latmin,lat,memory_order_relaxed);
+			if(lat > atomic_load_explicit(&latmax,memory_order_relaxed))
+				atomic_store_explicit(&latmax,lat,memory_order_relaxed);
+			ring_put(&cmpq,rsp,cnt);
+			done = 1;
+		}
+		if(done)
+			write(efd,&one,sizeof(one));	/* wake the event loop */
+	}
+	return NULL;
+}
+
+int hwpoll_start(int fdout,int fdin,int cpu,int prio,uint32_t depth) {
+	pthread_attr_t attr;
+	cpu_set_t cpus;
+	struct sched_param sp;
+	uint32_t n;
+
+	if(mlockall(MCL_CURRENT|MCL_FUTURE) < 0) {	/* prefault and pin everything */
+		lockerr = errno;
+		perror("hwpoll: mlockall");
+	}
+	if(ring_init(&subq,depth) < 0 || ring_init(&cmpq,2*depth) < 0)
+		return -1;
+	for(n=1; n<depth; n<<=1)
+		;
+	if((sendt = calloc(n,sizeof(uint64_t))) == NULL)
+		return -1;
+	stmask = n-1;
+	memset(subq.slot,0,(subq.mask+1)*sizeof(slot_t));	/* touch every page now */
+	memset(cmpq.slot,0,(cmpq.mask+1)*sizeof(slot_t));
+	hwout = fdout;
+	hwin = fdin;
+	if(hwinit(fdout) < 0)					/* map and reset before the first message */
+		return -1;
+	if((efd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC)) < 0)
+		return -1;
+	atomic_store(&latmin,UINT64_MAX);
+	lastreport = nsnow();
+
+	pthread_attr_init(&attr);
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu,&cpus);
+	pthread_attr_setaffinity_np(&attr,sizeof(cpus),&cpus);
+	if(prio > 0) {
+		pthread_attr_setinheritsched(&attr,PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr,SCHED_FIFO);
+		sp.sched_priority = prio;
+		pthread_attr_setschedparam(&attr,&sp);
+	}
+	if(pthread_create(&poller,&attr,hwpoll_run,NULL) != 0) {
+		if(prio <= 0)
+			return -1;
+		fprintf(stderr,"hwpoll: cannot use SCHED_FIFO, polling at normal priority\n");
+		pthread_attr_setinheritsched(&attr,PTHREAD_INHERIT_SCHED);
+		if(pthread_create(&poller,&attr,hwpoll_run,NULL) != 0)
+			return -1;
+	}
+	pthread_attr_destroy(&attr);
+	return efd;
+}
+
+int hwpoll_submit(const uint8_t *bp,int len) {
+	return ring_put(&subq,bp,len);
+}
+
+int hwpoll_complete(uint8_t *bp) {
+	return ring_get(&cmpq,bp);
+}
+
+void hwpoll_report(FILE *fp) {
+	uint64_t now = nsnow();
+	uint64_t p = atomic_exchange(&polls,0);
+	uint64_t n = atomic_exchange(&nrsp,0);
+	uint64_t sum = atomic_exchange(&latsum,0);
+	uint64_t lo = atomic_exchange(&latmin,UINT64_MAX);
+	uint64_t hi = atomic_exchange(&latmax,0);
+	double secs = (now-lastreport)/1e9;
+
+	lastreport = now;
+	if(lockerr)
+		fprintf(fp,"hwpoll: memory not locked (%s), latencies may include page faults\n",strerror(lockerr));
+	if(n == 0) {
+		fprintf(fp,"hwpoll: %.0f polls/s, no responses\n",p/secs);
+		return;
+	}
+	fprintf(fp,"hwpoll: %.0f polls/s, %llu responses, latency min %.2fus mean %.2fus max %.2fus, jitter %.2fus\n",
+			p/secs,(unsigned long long)n,lo/1e3,(double)sum/n/1e3,hi/1e3,(hi-lo)/1e3);
+}
+
+int hwpoll_locked(void) {
+	return lockerr == 0;
+}
+
+void hwpoll_stop(void) {
+	if(efd < 0)
+		return;
+	atomic_store(&stopping,1);
+	pthread_join(poller,NULL);
+	close(efd);
+	efd = -1;
+}
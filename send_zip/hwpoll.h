@@ -0,0 +1,72 @@
+/*
+ * hwpoll.h -- dedicated hardware polling thread for low latency
+ *
+ * Description: in this mode one thread owns the hardware. It is
+ * pinned to a core (ideally one isolated from the scheduler with
+ * isolcpus), may run SCHED_FIFO, and busy-polls the fifo without
+ * sleeping or doing any stdio. Requests reach it through a
+ * single-producer ring and responses come back through another; an
+ * eventfd wakes the server's event loop when responses are waiting.
+ * Memory is locked with mlockall() and the hardware is mapped and
+ * reset at startup, so the first messages do not take page faults.
+ * Without the privilege to lock memory the thread still runs, but
+ * every report says so.
+ *
+ * The thread counts its polls and times every request from hwwrite()
+ * to its response, for hwpoll_report().
+ *
+ */
+#ifndef HWPOLL_H
+#define HWPOLL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * hwpoll_start() -- locks memory, prepares the hardware and starts the
+ * polling thread on cpu, at SCHED_FIFO priority prio if prio > 0.
+ * depth is the most requests that may be in flight at once.
+ *
+ * returns: an eventfd that becomes readable when responses are
+ * waiting; -1 on error.
+ */
+int hwpoll_start(int fdout,int fdin,int cpu,int prio,uint32_t depth);
+
+/*
+ * hwpoll_submit() -- queues a request for hwwrite(). Fails only if
+ * more than depth requests are in flight.
+ *
+ * returns: 0 on success; -1 if the ring is full.
+ */
+int hwpoll_submit(const uint8_t *bp,int len);
+
+/*
+ * hwpoll_complete() -- takes the next response off the ring. A write
+ * the hardware refused comes back as the request itself, with its
+ * length negated.
+ *
+ * returns: the response length (negated for a refused write); 0 if
+ * there is none.
+ */
+int hwpoll_complete(uint8_t *bp);
+
+/*
+ * hwpoll_report() -- prints the achieved poll frequency and the
+ * spread of response latencies since the last report.
+ */
+void hwpoll_report(FILE *fp);
+
+/*
+ * hwpoll_locked() -- tells whether hwpoll_start() could lock memory
+ *
+ * returns: 1 if memory is locked; 0 if page faults may still stall
+ * the polling thread.
+ */
+int hwpoll_locked(void);
+
+/*
+ * hwpoll_stop() -- stops the polling thread
+ */
+void hwpoll_stop(void);
+
+#endif /* HWPOLL_H */
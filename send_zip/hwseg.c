@@ -0,0 +1,139 @@
+/*
+ * hwseg.c -- payloads larger than the fifo (see hwseg.h)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "hw.h"
+#include "hwseg.h"
+
+static uint32_t chunk;						/* payload bytes in a chunk */
+static uint16_t nextid;
+static uint8_t *spare;						/* a packet that may not fit where it belongs */
+
+static void put32(uint8_t *bp,uint32_t v) {
+	bp[0] = v;								/* little endian */
+	bp[1] = v>>8;
+	bp[2] = v>>16;
+	bp[3] = v>>24;
+}
+
+static uint32_t get32(const uint8_t *bp) {
+	return bp[0] | bp[1]<<8 | bp[2]<<16 | (uint32_t)bp[3]<<24;
+}
+
+int hwseg_init(uint32_t pktmax) {
+	uint32_t most = atomic_load(&hwstats.pktmax);
+
+	if(pktmax == 0)
+		pktmax = atomic_load(&hwstats.txdepth)*4;
+	if(most && (pktmax == 0 || pktmax > most))
+		pktmax = most;						/* the driver refuses any longer */
+	if(pktmax < HWSEG_TRL+4)
+		return -1;
+	free(spare);
+	if((spare = malloc(pktmax+4)) == NULL)	/* the driver reads whole words */
+		return -1;
+	chunk = (pktmax-HWSEG_TRL) & ~3u;		/* every chunk starts on a word */
+	return chunk;
+}
+
+void hwseg_send(hwseg_tx_t *tx,void *buf,uint32_t len) {
+	tx->buf = buf;
+	tx->len = len;
+	tx->off = 0;
+	tx->id = nextid++;
+}
+
+int hwseg_write(int fd,hwseg_tx_t *tx) {
+	uint32_t n;
+	uint8_t *p = tx->buf + tx->off, save[HWSEG_TRL];
+	ssize_t ret;
+
+	if(chunk == 0 && hwseg_init(0) < 0)
+		return -1;
+	n = tx->len - tx->off < chunk ? tx->len - tx->off : chunk;
+	memcpy(save,p+n,HWSEG_TRL);				/* the next chunk's first bytes, or the slack */
+	put32(p+n,tx->len);
+	put32(p+n+4,tx->off);
+	p[n+8] = tx->id;
+	p[n+9] = tx->id>>8;
+	p[n+10] = HWSEG_MAGIC & 0xff;
+	p[n+11] = HWSEG_MAGIC>>8;
+	ret = hwwrite(fd,p,n+HWSEG_TRL);
+	memcpy(p+n,save,HWSEG_TRL);
+	if(ret < 0)
+		return -1;
+	tx->off += n;
+	return tx->off == tx->len;
+}
+
+void hwseg_recv(hwseg_rx_t *rx,void *buf,uint32_t cap) {
+	memset(rx,0,sizeof(*rx));
+	rx->buf = buf;
+	rx->cap = cap;
+}
+
+/* throw away the payload being received */
+static void drop(hwseg_rx_t *rx) {
+	rx->dropped++;
+	rx->total = 0;
+	rx->len = 0;
+}
+
+int hwseg_read(int fd,hwseg_rx_t *rx) {
+	uint32_t at = rx->total ? rx->len : 0;	/* where the next chunk goes */
+	uint8_t *p = rx->buf + at, *t;
+	uint32_t n, total, off, room = rx->cap-at+HWSEG_TRL;
+	uint16_t id;
+	ssize_t cnt;
+
+	if(chunk == 0 && hwseg_init(0) < 0)
+		return 0;
+	if(at && room < chunk+HWSEG_TRL) {		/* no room for another payload's first chunk */
+		p = spare;
+		room = chunk+HWSEG_TRL;
+	}
+	if((cnt = hwread(fd,p,room)) == 0)
+		return 0;
+	if(cnt < HWSEG_TRL || get32(p+cnt-4)>>16 != HWSEG_MAGIC) {
+		rx->dropped++;						/* too long for the buffer, or not a chunk */
+		return 0;
+	}
+	t = p+cnt-HWSEG_TRL;
+	n = cnt-HWSEG_TRL;
+	total = get32(t);
+	off = get32(t+4);
+	id = t[8] | t[9]<<8;
+	if(off == 0) {							/* a new payload, and any before it is lost */
+		if(rx->total)
+			drop(rx);
+		if(total > rx->cap || n > total) {
+			drop(rx);
+			return 0;
+		}
+		if(p != rx->buf)
+			memmove(rx->buf,p,n);			/* it landed where the lost one's next chunk would */
+		rx->total = total;
+		rx->id = id;
+		rx->len = 0;
+	}
+	else if(rx->total == 0 || id != rx->id || off != rx->len || total != rx->total || n > total-off) {
+		if(rx->total)						/* a chunk is missing */
+			drop(rx);
+		else
+			rx->dropped++;					/* the rest of one already dropped */
+		return 0;
+	}
+	else if(p == spare)
+		memcpy(rx->buf+at,spare,n);
+	rx->chunks++;
+	rx->len += n;
+	if(rx->len < rx->total)
+		return 0;
+	rx->total = 0;							/* rx->len stays the payload's length */
+	return 1;
+}
@@ -0,0 +1,96 @@
+/*
+ * hwseg.h -- payloads larger than the fifo, in fifo-sized chunks
+ *
+ * Description: the driver refuses a packet longer than the transmit
+ * fifo's vacancy, which limits a packet to a few hundred words. A
+ * payload of any length up to 4GB instead goes as a run of chunks
+ * that each fit, and is put back together on the receiving side.
+ *
+ * Each chunk ends with a trailer (HWSEG_TRL bytes, little endian):
+ * the payload's length, the chunk's offset in it, the payload's id and
+ * HWSEG_MAGIC. The trailer goes at the end, not the front, so that the
+ * receiver can read every chunk straight into its place in the
+ * caller's buffer: the trailer lands on the bytes where the next chunk
+ * goes, and is overwritten by it. Nothing is copied on either side,
+ * except when a payload is part received and there is less than a
+ * packet of room left after it: the next packet may be the first
+ * chunk of another payload, if chunks were lost, so it is read aside
+ * and copied into place.
+ * The sender borrows the bytes just past each chunk of the caller's
+ * buffer to hold its trailer, and puts them back once it has gone.
+ * So both buffers need HWSEG_SLACK bytes of room past the payload.
+ *
+ * The fifo keeps packets in order, so a chunk at any other offset
+ * than the next one expected means chunks were lost, and the payload
+ * is dropped.
+ *
+ */
+#ifndef HWSEG_H
+#define HWSEG_H
+
+#include <stdint.h>
+
+#define HWSEG_TRL 12						/* trailer bytes */
+#define HWSEG_SLACK (HWSEG_TRL+4)			/* and the driver reads whole words */
+#define HWSEG_MAGIC 0x5347
+
+typedef struct hwseg_tx {					/* a payload being sent */
+	uint8_t *buf;							/* the caller's, with HWSEG_SLACK to spare */
+	uint32_t len;
+	uint32_t off;							/* bytes gone */
+	uint16_t id;
+} hwseg_tx_t;
+
+typedef struct hwseg_rx {					/* a payload being received */
+	uint8_t *buf;							/* the caller's, with HWSEG_SLACK to spare */
+	uint32_t cap;							/* longest payload it holds */
+	uint32_t len;							/* bytes in place */
+	uint32_t total;							/* the payload's length; 0 until a first chunk */
+	uint16_t id;
+	unsigned long long chunks;				/* chunks taken into a payload */
+	unsigned long long dropped;				/* packets and part payloads thrown away */
+} hwseg_rx_t;
+
+/*
+ * hwseg_init() -- sets the longest packet to send to pktmax bytes, or
+ * if 0, to the transmit fifo's size as the driver reports it (call
+ * hwinit() first), and at most the longest packet the driver takes.
+ *
+ * Both sides should use the same pktmax.
+ *
+ * returns: the payload bytes in a chunk; -1 if pktmax is too small or
+ * out of memory.
+ */
+int hwseg_init(uint32_t pktmax);
+
+/*
+ * hwseg_send() -- starts sending the len bytes at buf, which must have
+ * HWSEG_SLACK bytes of room after them. The buffer is the caller's
+ * again once hwseg_write() has returned 1.
+ */
+void hwseg_send(hwseg_tx_t *tx,void *buf,uint32_t len);
+
+/*
+ * hwseg_write() -- writes the payload's next chunk to the hardware.
+ *
+ * returns: 1 once the last chunk has gone; 0 while chunks remain; -1
+ * if the driver refused the chunk, which the next call tries again.
+ */
+int hwseg_write(int fd,hwseg_tx_t *tx);
+
+/*
+ * hwseg_recv() -- starts receiving payloads of up to cap bytes into
+ * buf, which must have HWSEG_SLACK bytes of room after them.
+ */
+void hwseg_recv(hwseg_rx_t *rx,void *buf,uint32_t cap);
+
+/*
+ * hwseg_read() -- reads the next packet from the hardware, if there
+ * is one, into its place in the payload.
+ *
+ * returns: 1 when a whole payload of rx->len bytes is in rx->buf, and
+ * the next call starts on another; 0 otherwise.
+ */
+int hwseg_read(int fd,hwseg_rx_t *rx);
+
+#endif /* HWSEG_H */
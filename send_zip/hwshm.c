@@ -0,0 +1,121 @@
+/*
+ * hwshm.c -- the rings shared between hwbroker and its clients (see hwshm.h)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "hwshm.h"
+
+#define HWB_MASK (HWB_SLOTS-1)
+
+hwb_shm_t *hwshm_create(int *fd) {
+	hwb_shm_t *shm;
+
+	if((*fd = memfd_create("hwbroker",MFD_CLOEXEC)) < 0)
+		return NULL;
+	if(ftruncate(*fd,sizeof(hwb_shm_t)) < 0 || (shm = hwshm_map(*fd)) == NULL) {
+		close(*fd);
+		return NULL;
+	}
+	atomic_init(&shm->sq.head,0);
+	atomic_init(&shm->sq.tail,0);
+	atomic_init(&shm->cq.head,0);
+	atomic_init(&shm->cq.tail,0);
+	return shm;
+}
+
+hwb_shm_t *hwshm_map(int fd) {
+	void *p = mmap(NULL,sizeof(hwb_shm_t),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,0);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+void hwshm_unmap(hwb_shm_t *shm) {
+	munmap(shm,sizeof(hwb_shm_t));
+}
+
+int hwshm_put(hwb_ring_t *r,const uint8_t *bp,int32_t len) {
+	uint32_t t = atomic_load_explicit(&r->tail,memory_order_relaxed);
+
+	if(t - atomic_load_explicit(&r->head,memory_order_acquire) > HWB_MASK || len <= 0 || len > HWB_PKTMAX)
+		return -1;
+	r->slot[t & HWB_MASK].len = len;
+	memcpy(r->slot[t & HWB_MASK].data,bp,len);
+	atomic_store_explicit(&r->tail,t+1,memory_order_release);
+	return 0;
+}
+
+int32_t hwshm_peek(hwb_ring_t *r,uint8_t *bp) {
+	uint32_t h = atomic_load_explicit(&r->head,memory_order_relaxed);
+	int32_t len;
+
+	if(h == atomic_load_explicit(&r->tail,memory_order_acquire))
+		return 0;
+	len = r->slot[h & HWB_MASK].len;		/* the other side may scribble: check */
+	if(len <= 0 || len > HWB_PKTMAX)
+		len = HWB_PKTMAX;
+	memcpy(bp,r->slot[h & HWB_MASK].data,len);
+	return len;
+}
+
+void hwshm_drop(hwb_ring_t *r) {
+	atomic_store_explicit(&r->head,atomic_load_explicit(&r->head,memory_order_relaxed)+1,memory_order_release);
+}
+
+int hwshm_sendfd(int sock,const hwb_hello_t *h,int fd) {
+	struct iovec iov = { (void*)h, sizeof(*h) };
+	union {									/* aligned for the cmsghdr */
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr m;
+	struct cmsghdr *cm;
+
+	memset(&m,0,sizeof(m));
+	m.msg_iov = &iov;
+	m.msg_iovlen = 1;
+	m.msg_control = ctl.buf;
+	m.msg_controllen = sizeof(ctl.buf);
+	cm = CMSG_FIRSTHDR(&m);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm),&fd,sizeof(int));
+	return sendmsg(sock,&m,MSG_NOSIGNAL) == (ssize_t)sizeof(*h) ? 0 : -1;
+}
+
+int hwshm_recvfd(int sock,hwb_hello_t *h,int *fd) {
+	struct iovec iov = { h, sizeof(*h) };
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} ctl;
+	struct msghdr m;
+	struct cmsghdr *cm;
+
+	memset(&m,0,sizeof(m));
+	m.msg_iov = &iov;
+	m.msg_iovlen = 1;
+	m.msg_control = ctl.buf;
+	m.msg_controllen = sizeof(ctl.buf);
+	*fd = -1;
+	if(recvmsg(sock,&m,MSG_CMSG_CLOEXEC) != (ssize_t)sizeof(*h))
+		return -1;
+	for(cm = CMSG_FIRSTHDR(&m); cm != NULL; cm = CMSG_NXTHDR(&m,cm))
+		if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+			memcpy(fd,CMSG_DATA(cm),sizeof(int));
+	if(*fd < 0 || h->version != HWB_VERSION || h->slots != HWB_SLOTS) {
+		if(*fd >= 0)
+			close(*fd);
+		*fd = -1;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * hwshm.h -- the rings shared between hwbroker and its clients
+ *
+ * Description: the hardware driver maps the fifo into one process
+ * and keeps its state there, so only one program may use the device
+ * at a time. hwbroker owns the device instead, and each program that
+ * links hwclient.o in place of hw.o talks to it through a region of
+ * shared memory holding two single-producer, single-consumer rings:
+ * packets for the device go in the submission ring, and the device's
+ * answers come back in the completion ring. Both sides poll, so no
+ * system call is made per packet.
+ *
+ * A client connects to the broker's Unix SOCK_SEQPACKET socket, at
+ * HWB_PATH unless the HWBROKER environment variable names another,
+ * and receives a hello carrying the region's descriptor. Closing the
+ * connection detaches it; answers still due to it are dropped. A
+ * packet whose answer the device has not returned in time is given
+ * up on and counted in lost, which the client takes back off the
+ * packets it has unanswered.
+ *
+ */
+#ifndef HWSHM_H
+#define HWSHM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HWB_PATH "/tmp/hwbroker.sock"		/* the broker's default socket */
+#define HWB_VERSION 2
+#define HWB_SLOTS 256						/* packets per ring (power of two) */
+#define HWB_PKTMAX 60						/* largest packet in a slot */
+#define HWB_CACHELINE 64
+
+typedef struct hwb_slot {
+	int32_t len;
+	uint8_t data[HWB_PKTMAX];
+} hwb_slot_t;
+
+typedef struct hwb_ring {					/* single producer, single consumer */
+	_Atomic uint32_t head;					/* next slot to take */
+	char pad1[HWB_CACHELINE-sizeof(uint32_t)];
+	_Atomic uint32_t tail;					/* next slot to fill */
+	char pad2[HWB_CACHELINE-sizeof(uint32_t)];
+	hwb_slot_t slot[HWB_SLOTS];
+} hwb_ring_t;
+
+typedef struct hwb_shm {
+	hwb_ring_t sq;							/* client to broker */
+	hwb_ring_t cq;							/* broker to client */
+	_Atomic uint32_t lost;					/* packets whose answer will never come */
+} hwb_shm_t;
+
+typedef struct hwb_hello {					/* sent with the region's descriptor */
+	uint32_t version;
+	uint32_t slots;
+	uint64_t txdepth;						/* the device's transmit fifo, in words */
+} hwb_hello_t;
+
+/*
+ * hwshm_create() -- makes a fresh region and maps it
+ *
+ * returns: the region, its descriptor in *fd; NULL on error.
+ */
+hwb_shm_t *hwshm_create(int *fd);
+
+/*
+ * hwshm_map() -- maps the region passed as fd
+ *
+ * returns: the region; NULL on error.
+ */
+hwb_shm_t *hwshm_map(int fd);
+
+/*
+ * hwshm_unmap() -- releases a mapped region
+ */
+void hwshm_unmap(hwb_shm_t *shm);
+
+/*
+ * hwshm_put() -- appends len bytes at bp to ring r
+ *
+ * returns: 0 on success; -1 if the ring is full or len too big.
+ */
+int hwshm_put(hwb_ring_t *r,const uint8_t *bp,int32_t len);
+
+/*
+ * hwshm_peek() -- copies the oldest packet in ring r to bp, of
+ * HWB_PKTMAX bytes, leaving it in the ring
+ *
+ * returns: its length; 0 if the ring is empty.
+ */
+int32_t hwshm_peek(hwb_ring_t *r,uint8_t *bp);
+
+/*
+ * hwshm_drop() -- removes the oldest packet from ring r
+ */
+void hwshm_drop(hwb_ring_t *r);
+
+/*
+ * hwshm_sendfd(), hwshm_recvfd() -- pass the hello and the region's
+ * descriptor over the broker's socket
+ *
+ * returns: 0 on success; -1 on error.
+ */
+int hwshm_sendfd(int sock,const hwb_hello_t *h,int fd);
+int hwshm_recvfd(int sock,hwb_hello_t *h,int *fd);
+
+#endif /* HWSHM_H */
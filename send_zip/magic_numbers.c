@@ -15,16 +15,10 @@
 #include <fcntl.h>
 #include "hw.h"
 #include "defs.h"
-#include "msg.c"
+#include "msg.h"
 
 /* largest message to send to hardware */
 #define MAXBUF  1500
-#define RSIZE   2
-#define TSIZE   10
-#define A_ESIZE 16
-#define TARGET  0x30
-#define AOZ     0x10
-#define EZ      0x20
 
 static uint8_t msgbuf[MAXBUF];			/* a message buffer */     /* table of EZ */
 
@@ -0,0 +1,221 @@
+/*
+ * metrics.c -- serves the s_hw and fifo counters (see metrics.h)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include "hw.h"
+#include "metrics.h"
+#include "zones.h"
+
+#define IOTIMEOUT 1							/* seconds a scraper may stall us */
+
+metrics_t metrics;
+
+static int msock = -1;
+static pthread_t server;
+static char *upath;							/* Unix socket to remove at exit */
+
+static const char *tname[MSGTYPES] = { "other", "aoz", "ez", "target", "credit", "bulk", "zdel", "zttl", NULL, "tbatch" };
+
+static unsigned long long get(_Atomic unsigned long long *v) {
+	return atomic_load_explicit(v,memory_order_relaxed);
+}
+
+static void head(FILE *fp,const char *name,const char *type,const char *help) {
+	fprintf(fp,"# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+}
+
+static void one(FILE *fp,const char *name,const char *type,const char *help,unsigned long long v) {
+	head(fp,name,type,help);
+	fprintf(fp,"%s %llu\n",name,v);
+}
+
+void metrics_delay(unsigned long long us) {
+	int b = us ? 64-__builtin_clzll(us) : 0;	/* us < 1<<b */
+
+	METRIC_INC(delays[b < DELAYS ? b : DELAYS-1]);
+	METRIC_ADD(delaysum,us);
+}
+
+/* the queue delays as a summary; a quantile is the top of the power of two it falls in */
+static void delays(FILE *fp) {
+	static const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+	unsigned long long n[DELAYS], total = 0, seen;
+	int b, i;
+
+	for(b=0; b<DELAYS; b++)
+		total += n[b] = get(&metrics.delays[b]);
+	head(fp,"shw_queue_delay_seconds","summary","Time messages for the device waited in s_hw before being sent or shed.");
+	for(i=0; i<4; i++) {
+		for(b=0, seen=n[0]; b<DELAYS-1 && seen < q[i]*total; seen += n[++b])
+			;
+		fprintf(fp,"shw_queue_delay_seconds{quantile=\"%g\"} %g\n",q[i],total ? (1ull<<b)/1e6 : 0);
+	}
+	fprintf(fp,"shw_queue_delay_seconds_sum %g\n",get(&metrics.delaysum)/1e6);
+	fprintf(fp,"shw_queue_delay_seconds_count %llu\n",total);
+}
+
+void metrics_print(FILE *fp) {
+	int i;
+
+	head(fp,"shw_fifo_packets_total","counter","Packets through the fifo.");
+	fprintf(fp,"shw_fifo_packets_total{direction=\"tx\"} %llu\n",get(&hwstats.txpkts));
+	fprintf(fp,"shw_fifo_packets_total{direction=\"rx\"} %llu\n",get(&hwstats.rxpkts));
+	head(fp,"shw_fifo_bytes_total","counter","Bytes through the fifo.");
+	fprintf(fp,"shw_fifo_bytes_total{direction=\"tx\"} %llu\n",get(&hwstats.txbytes));
+	fprintf(fp,"shw_fifo_bytes_total{direction=\"rx\"} %llu\n",get(&hwstats.rxbytes));
+	head(fp,"shw_fifo_drops_total","counter","Packets the fifo driver dropped.");
+	fprintf(fp,"shw_fifo_drops_total{reason=\"tx_full\"} %llu\n",get(&hwstats.txfull));
+	fprintf(fp,"shw_fifo_drops_total{reason=\"rx_oversize\"} %llu\n",get(&hwstats.rxoversize));
+	head(fp,"shw_fifo_isr_errors_total","counter","Error bits seen in the fifo interrupt status register.");
+	fprintf(fp,"shw_fifo_isr_errors_total{bit=\"RPURE\"} %llu\n",get(&hwstats.rpure));
+	fprintf(fp,"shw_fifo_isr_errors_total{bit=\"RPORE\"} %llu\n",get(&hwstats.rpore));
+	fprintf(fp,"shw_fifo_isr_errors_total{bit=\"RPUE\"} %llu\n",get(&hwstats.rpue));
+	fprintf(fp,"shw_fifo_isr_errors_total{bit=\"TPOE\"} %llu\n",get(&hwstats.tpoe));
+	fprintf(fp,"shw_fifo_isr_errors_total{bit=\"TSE\"} %llu\n",get(&hwstats.tse));
+	one(fp,"shw_fifo_tx_depth_words","gauge","Transmit fifo size in 32-bit words.",get(&hwstats.txdepth));
+	one(fp,"shw_fifo_tx_occupancy_max_words","gauge","Most words ever queued in the transmit fifo.",get(&hwstats.txoccmax));
+	one(fp,"shw_fifo_rx_packet_max_bytes","gauge","Largest packet received from the fifo.",get(&hwstats.rxlenmax));
+
+	head(fp,"shw_messages_total","counter","Messages received from clients, by type.");
+	for(i=0; i<MSGTYPES; i++)
+		if(tname[i] != NULL)
+			fprintf(fp,"shw_messages_total{type=\"%s\"} %llu\n",tname[i],get(&metrics.msgs[i]));
+	head(fp,"shw_responses_total","counter","Responses returned to clients, by request type.");
+	for(i=0; i<MSGTYPES; i++)
+		if(tname[i] != NULL)
+			fprintf(fp,"shw_responses_total{type=\"%s\"} %llu\n",tname[i],get(&metrics.rsps[i]));
+	one(fp,"shw_targets_rejected_total","counter","Targets that failed the zone check, answered NAK by s_hw.",get(&metrics.badtarget));
+	head(fp,"shw_drops_total","counter","Messages and responses s_hw dropped.");
+	fprintf(fp,"shw_drops_total{reason=\"unknown_type\"} %llu\n",get(&metrics.badtype));
+	fprintf(fp,"shw_drops_total{reason=\"hw_refused\"} %llu\n",get(&metrics.refused));
+	fprintf(fp,"shw_drops_total{reason=\"unmatched_response\"} %llu\n",get(&metrics.unmatched));
+	fprintf(fp,"shw_drops_total{reason=\"client_gone\"} %llu\n",get(&metrics.gone));
+	fprintf(fp,"shw_drops_total{reason=\"packet_malformed\"} %llu\n",get(&metrics.badpacket));
+	fprintf(fp,"shw_drops_total{reason=\"udp_malformed\"} %llu\n",get(&metrics.udpbad));
+	fprintf(fp,"shw_drops_total{reason=\"udp_unsent\"} %llu\n",get(&metrics.udpunsent));
+	one(fp,"shw_udp_overflow_total","counter","Datagrams the kernel dropped before s_hw could read them, the socket buffer being full.",get(&metrics.udpoverflow));
+	one(fp,"shw_udp_datagrams_total","counter","Datagrams received.",get(&metrics.udpdgrams));
+	one(fp,"shw_udp_msgid_gaps_total","counter","Msgids UDP senders skipped: datagrams lost on the way.",get(&metrics.udpgaps));
+	one(fp,"shw_udp_msgid_reordered_total","counter","Datagrams that arrived behind a later msgid from the same sender.",get(&metrics.udpreorder));
+	one(fp,"shw_target_duplicates_total","counter","Targets answered with the verdict of an identical target, recent or still at the device.",get(&metrics.dupes));
+	one(fp,"shw_connections_total","counter","Client connections accepted.",get(&metrics.accepted));
+	one(fp,"shw_connections","gauge","Client connections open.",get(&metrics.open));
+	one(fp,"shw_device_window","gauge","Most requests allowed at the device.",get(&metrics.devwin));
+	one(fp,"shw_device_inflight","gauge","Requests at the device.",get(&metrics.inflight));
+	one(fp,"shw_device_fifo_words","gauge","Transmit fifo words taken by the requests at the device.",get(&metrics.fifowords));
+	one(fp,"shw_credit_waits_total","counter","Times a client was stopped, and not read from, for want of room at the device.",get(&metrics.creditwaits));
+	one(fp,"shw_device_inflight_max","gauge","Most requests ever at the device.",get(&metrics.inflightmax));
+	one(fp,"shw_observers","gauge","Response observers connected.",get(&metrics.observers));
+	one(fp,"shw_observer_skipped_total","counter","Responses skipped by observers that fell a whole ring behind.",get(&metrics.obskipped));
+	one(fp,"shw_observer_dropped_total","counter","Observers disconnected for falling behind.",get(&metrics.obsdropped));
+	one(fp,"shw_shed_total","counter","Messages answered BUSY, not sent to the device: their deadline could not be met.",get(&metrics.shed));
+	one(fp,"shw_batched_targets_total","counter","Targets received in TBATCH messages.",get(&metrics.batched));
+	one(fp,"shw_zone_check_steals_total","counter","Chunks of a TBATCH zone check taken by a thread from another's share.",get(&metrics.steals));
+	one(fp,"shw_poll_memory_unlocked","gauge","1 if the hardware polling thread could not lock its memory and may take page faults.",get(&metrics.unlocked));
+	one(fp,"shw_device_rtt_microseconds","gauge","Device round trip, averaged over recent responses.",get(&metrics.hwrtt));
+	delays(fp);
+	one(fp,"shw_event_loop_syscalls_total","counter","System calls the event loop made for clients, timers and the hardware.",get(&metrics.syscalls));
+	one(fp,"shw_zones","gauge","Zones stored.",get(&zonestats.stored));
+	one(fp,"shw_zones_expiring","gauge","Zones stored with a time to live.",get(&zonestats.expiring));
+	one(fp,"shw_zones_expired_total","counter","Zones removed when their time to live ran out.",get(&zonestats.expired));
+	one(fp,"shw_zones_deleted_total","counter","Zones removed by ZDEL.",get(&zonestats.deleted));
+	one(fp,"shw_zone_arena_bytes","gauge","Memory held by the zone store.",get(&zonestats.bytes));
+}
+
+/* answer one scrape: whatever the request, the reply is the metrics */
+static void serve(int fd) {
+	char req[1024], *body = NULL;
+	size_t len = 0;
+	FILE *fp;
+	ssize_t n, sent;
+
+	if(recv(fd,req,sizeof(req),0) <= 0)		/* the request line is enough */
+		return;
+	if((fp = open_memstream(&body,&len)) == NULL)
+		return;
+	metrics_print(fp);
+	fclose(fp);
+	dprintf(fd,"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",len);
+	for(sent=0; sent<(ssize_t)len; sent+=n)
+		if((n = send(fd,body+sent,len-sent,MSG_NOSIGNAL)) <= 0)
+			break;
+	free(body);
+}
+
+static void *metrics_run(void *arg) {
+	struct timeval tv = { IOTIMEOUT, 0 };
+	int fd;
+
+	while((fd = accept(msock,NULL,NULL)) >= 0) {
+		setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+		setsockopt(fd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+		serve(fd);
+		close(fd);
+	}
+	return NULL;							/* metrics_stop() shut the socket */
+}
+
+int metrics_start(const char *where) {
+	int yes = 1;
+
+	if(strchr(where,'/') != NULL) {
+		struct sockaddr_un un;
+
+		memset(&un,0,sizeof(un));
+		un.sun_family = AF_UNIX;
+		if(strlen(where) >= sizeof(un.sun_path))
+			return -1;
+		strcpy(un.sun_path,where);
+		unlink(where);						/* left by an earlier run */
+		if((msock = socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0)) < 0)
+			return -1;
+		if(bind(msock,(struct sockaddr*)&un,sizeof(un)) < 0)
+			goto fail;
+		upath = strdup(where);
+	}
+	else {
+		struct sockaddr_in in;
+
+		memset(&in,0,sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_port = htons(atoi(where));
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);	/* local scrapers only */
+		if((msock = socket(AF_INET,SOCK_STREAM|SOCK_CLOEXEC,0)) < 0)
+			return -1;
+		setsockopt(msock,SOL_SOCKET,SO_REUSEADDR,&yes,sizeof(yes));
+		if(bind(msock,(struct sockaddr*)&in,sizeof(in)) < 0)
+			goto fail;
+	}
+	if(listen(msock,4) < 0 || pthread_create(&server,NULL,metrics_run,NULL) != 0)
+		goto fail;
+	return 0;
+
+ fail:
+	close(msock);
+	msock = -1;
+	return -1;
+}
+
+void metrics_stop(void) {
+	if(msock < 0)
+		return;
+	shutdown(msock,SHUT_RDWR);				/* wakes the accept() */
+	pthread_join(server,NULL);
+	close(msock);
+	msock = -1;
+	if(upath != NULL) {
+		unlink(upath);
+		free(upath);
+		upath = NULL;
+	}
+}
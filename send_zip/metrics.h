@@ -0,0 +1,99 @@
+/*
+ * metrics.h -- s_hw and fifo counters in the Prometheus text format
+ *
+ * Description: s_hw counts what it does in metrics and the driver
+ * counts what the fifo does in hwstats (see hw.h). A thread of its
+ * own serves both over HTTP, on a port bound to the loopback address
+ * or on a Unix socket, so a scrape never waits on the event loop:
+ *
+ *   curl http://127.0.0.1:9100/metrics
+ *   curl --unix-socket /tmp/s_hw.sock http://localhost/metrics
+ *
+ * Everything is a running total or a high-water mark since s_hw
+ * started; rates (messages of each type per second, fifo bytes per
+ * second) are left to the scraper.
+ *
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include "msg.h"
+
+/* index of msgs[] and rsps[]: the high bits of the type (AOZ 1, EZ 2, ...) */
+#define METRIC_TYPE(t) ((MSG_TYPE(t) >> 4) & 15)
+#define MSGTYPES 16
+
+#define DELAYS 24							/* queue delays by powers of two microseconds, to 8s */
+
+typedef struct metrics {
+	_Atomic unsigned long long msgs[MSGTYPES];		/* messages received, by type */
+	_Atomic unsigned long long rsps[MSGTYPES];		/* responses returned, by request type */
+	_Atomic unsigned long long badtype;		/* drops: unknown message type */
+	_Atomic unsigned long long badtarget;	/* targets failed the zone check: NAK */
+	_Atomic unsigned long long refused;		/* drops: the hardware would not take it */
+	_Atomic unsigned long long unmatched;	/* drops: response to no request in flight */
+	_Atomic unsigned long long gone;		/* drops: client closed before its response */
+	_Atomic unsigned long long badpacket;	/* drops: Unix packet not exactly one message */
+	_Atomic unsigned long long udpbad;		/* drops: datagram not exactly one message */
+	_Atomic unsigned long long udpunsent;	/* drops: datagram response not sent */
+	_Atomic unsigned long long udpdgrams;	/* datagrams received */
+	_Atomic unsigned long long udpgaps;		/* msgids senders skipped */
+	_Atomic unsigned long long udpreorder;	/* datagrams behind their sender's msgids */
+	_Atomic unsigned long long dupes;		/* targets answered with a recent or pending verdict */
+	_Atomic unsigned long long accepted;	/* connections accepted */
+	_Atomic unsigned long long open;		/* connections open now */
+	_Atomic unsigned long long devwin;		/* device window size */
+	_Atomic unsigned long long inflight;	/* requests at the device now */
+	_Atomic unsigned long long inflightmax;	/* and the most there have been */
+	_Atomic unsigned long long observers;	/* response observers connected */
+	_Atomic unsigned long long obskipped;	/* responses observers fell too far behind to get */
+	_Atomic unsigned long long obsdropped;	/* observers disconnected for falling behind */
+	_Atomic unsigned long long syscalls;	/* system calls made by the event loop */
+	_Atomic unsigned long long fifowords;	/* transmit fifo words of the requests at the device */
+	_Atomic unsigned long long creditwaits;	/* clients stopped for want of room at the device */
+	_Atomic unsigned long long udpoverflow;	/* datagrams the kernel dropped, its socket buffer full */
+	_Atomic unsigned long long shed;		/* answered BUSY: could not be answered in time */
+	_Atomic unsigned long long hwrtt;		/* device round trip, microseconds, averaged */
+	_Atomic unsigned long long delays[DELAYS];	/* messages for the device, by time waiting in s_hw */
+	_Atomic unsigned long long delaysum;	/* and the total, microseconds */
+	_Atomic unsigned long long batched;		/* targets received in TBATCH messages */
+	_Atomic unsigned long long steals;		/* zone check chunks stolen by an idle thread */
+	_Atomic unsigned long long unlocked;	/* 1 if the polling thread's memory is not locked */
+} metrics_t;
+
+extern metrics_t metrics;
+
+#define METRIC_ADD(f,n) atomic_fetch_add_explicit(&metrics.f,(n),memory_order_relaxed)
+#define METRIC_INC(f) METRIC_ADD(f,1)
+#define METRIC_DEC(f) atomic_fetch_sub_explicit(&metrics.f,1,memory_order_relaxed)
+#define METRIC_SET(f,v) atomic_store_explicit(&metrics.f,(v),memory_order_relaxed)
+
+/*
+ * metrics_delay() -- counts a message for the device that waited us
+ * microseconds in s_hw before being sent or shed
+ */
+void metrics_delay(unsigned long long us);
+
+/*
+ * metrics_start() -- starts serving the metrics at where: a path
+ * (anything containing a '/') for a Unix socket, otherwise a TCP port
+ * on 127.0.0.1.
+ *
+ * returns: 0 on success; -1 on error.
+ */
+int metrics_start(const char *where);
+
+/*
+ * metrics_print() -- writes the current metrics to fp in the
+ * Prometheus text format.
+ */
+void metrics_print(FILE *fp);
+
+/*
+ * metrics_stop() -- stops serving and removes any Unix socket.
+ */
+void metrics_stop(void);
+
+#endif /* METRICS_H */
@@ -0,0 +1,459 @@
+/*
+ * microbench.c -- microbenchmarks for the message, zone and hardware
+ * interface code
+ *
+ * Description: runs each benchmark for a number of warmup iterations,
+ * then times a number of repeats of n iterations each. Reports ns/op
+ * (best and median of the repeats), ops/s and CPU cycles/op, on the
+ * screen and as CSV so results can be compared between releases.
+ * Cycles come from the perf cycle counter, or the time stamp counter
+ * on x86 where perf is unavailable; 0 means neither could be read.
+ *
+ * usage: microbench [-n iters] [-w warmup] [-r repeats] [-o file.csv] [name...]
+ *
+ */
+#include <stdio.h>							/* printf */
+#include <stdlib.h>							/* exit codes */
+#include <stdint.h>							/* uint8_t */
+#include <string.h>
+#include <time.h>							/* clock_gettime */
+#include <fcntl.h>
+#include <unistd.h>							/* close */
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "hw.h"
+#include "defs.h"
+#include "msg.h"
+#include "zones.h"
+#include "pool.h"
+#include "hwseg.h"
+
+#define MAXBUF 1500
+static uint8_t msgbuf[MAXBUF];
+static uint8_t target[TSIZE];
+static int fdout,fdin;
+static volatile long sink;					/* keeps results alive */
+
+typedef struct bench {
+	char *name;
+	long param;								/* e.g. zone count; -1 if unused */
+	int scale;								/* iterations divisor for slow benches */
+	void (*setup)(long param);
+	long (*run)(long n);
+} bench_t;
+
+/* -------- message benches -------- */
+
+static long run_msgmake1(long n) {
+	long s = 0;
+	while(n--) s += msgmake1(msgbuf);
+	return s;
+}
+
+static long run_msgmake2(long n) {
+	long s = 0;
+	while(n--) s += msgmake2(msgbuf);
+	return s;
+}
+
+static long run_msgmake1x(long n) {
+	long s = 0;
+	while(n--) s += msgmake1x(msgbuf);
+	return s;
+}
+
+static long run_msgprint(long n) {
+	int len = msgmake2(msgbuf);
+	while(n--) msgprint("send hw",msgbuf,len);
+	fflush(stdout);
+	return len;
+}
+
+/* -------- zone benches -------- */
+
+/* an AOZ/EZ box around lat,long (arc-minutes) with half-width w arc-minutes */
+static int zone(uint8_t *bp,uint8_t type,int lat,int lng,int w) {
+	int i;
+	int corners[2][2] = { { lat-w, lng-w }, { lat+w, lng+w } };
+
+	*bp++ = type;
+	for(i=0; i<2; i++) {					/* degrees and minutes only */
+		int la = corners[i][0], lo = corners[i][1];
+		*bp++ = la/60;
+		*bp++ = la%60;
+		*bp++ = 0;
+		*bp++ = (lo/60) & 0xff;
+		*bp++ = (lo/60) >> 8;
+		*bp++ = lo%60;
+		*bp++ = 0;
+	}
+	*bp = 0;
+	return A_ESIZE;
+}
+
+/* param AOZs of which only the last holds the target, and param/10 EZs that miss it */
+static void setup_zones(long param) {
+	long i;
+
+	if(param >= 0)
+		zones_reset();
+	for(i=0; i<param; i++) {
+		int hit = (i == param-1);
+		zone(msgbuf,AOZ,hit ? 10*60 : 20*60,hit ? 100*60 : (int)(i%170)*60,30);
+		checkTables(msgbuf,A_ESIZE);
+	}
+	for(i=0; i<param/10; i++) {		/* none for param -1 */
+		zone(msgbuf,EZ,30*60,(int)(i%170)*60,30);
+		checkTables(msgbuf,A_ESIZE);
+	}
+	c1_t *p=(c1_t*)target;
+	p->type = TARGET;
+	p->lat_deg = 10;
+	p->lat_min = p->lat_sec = 0;
+	p->long_deg = 100;
+	p->long_min = p->long_sec = 0;
+}
+
+/*
+ * an L-shaped polygon zone of 16 vertices filling three quarters of the
+ * square of side 2w arc-minutes at lat,long: the missing quarter is
+ * the one at the top right
+ */
+static int polyzone(uint8_t *bp,uint8_t type,int lat,int lng,int w) {
+	static const int L[6][2] = { {0,0}, {0,2}, {1,2}, {1,1}, {2,1}, {2,0} };
+	int32_t la[16],lo[16];
+	int i,k,n = 0;
+
+	for(i=0; i<6; i++) {						/* the corners, with extra points */
+		const int *a = L[i], *b = L[(i+1)%6];
+		int steps = (i == 0 || i == 5) ? 4 : 2;	/* on the long sides */
+		for(k=0; k<steps && n<16; k++) {
+			la[n] = (lat + w*(a[0]*steps + (b[0]-a[0])*k) / steps) * 60;
+			lo[n] = (lng + w*(a[1]*steps + (b[1]-a[1])*k) / steps) * 60;
+			n++;
+		}
+	}
+	return msgmakepoly(bp,type,n,la,lo);
+}
+
+/* param polygon AOZs of which only the last holds the target, and one
+ * in ten of the others has the target inside its bounding box */
+static void setup_polys(long param) {
+	long i;
+
+	zones_reset();
+	for(i=0; i<param; i++) {
+		if(i == param-1)
+			polyzone(msgbuf,AOZ,10*60-10,100*60-10,15);	/* target in the lower left */
+		else if(i%10 == 0)
+			polyzone(msgbuf,AOZ,10*60-20,100*60-20,15);	/* target in the missing quarter */
+		else
+			polyzone(msgbuf,AOZ,20*60,(int)(i%170)*60,15);
+		checkTables(msgbuf,msgsize(msgbuf,MAXBUF));
+	}
+	setup_zones(-1);							/* just the target */
+}
+
+/* param circle AOZs of radius 30km of which only the last holds the
+ * target, and one in ten of the others has it in the corner of its
+ * bounding box, outside the circle */
+static void setup_circles(long param) {
+	long i;
+
+	zones_reset();
+	for(i=0; i<param; i++) {
+		if(i == param-1)
+			msgmakecircle(msgbuf,AOZ,10*3600+600,100*3600+600,30000);
+		else if(i%10 == 0)
+			msgmakecircle(msgbuf,AOZ,10*3600+900,100*3600+900,30000);
+		else
+			msgmakecircle(msgbuf,AOZ,20*3600,(int)(i%170)*3600,30000);
+		checkTables(msgbuf,CSIZE);
+	}
+	setup_zones(-1);							/* just the target */
+}
+
+static long run_checkTables(long n) {
+	long s = 0;
+	while(n--) s += checkTables(target,TSIZE);
+	return s;
+}
+
+/* param helper threads check batches of TBATCH_MAX targets, as s_hw -T does, against 1000 polygon AOZs */
+static uint8_t batch[TBATCH_MAX*TREC];
+static int batchok[TBATCH_MAX];
+
+static void setup_batch(long param) {
+	int i;
+
+	setup_polys(1000);
+	for(i=0; i<TBATCH_MAX; i++)
+		memcpy(batch+i*TREC,target,TREC);
+	pool_stop();
+	if(pool_start(param) < 0)
+		errorExit("microbench: cannot start threads\n");
+}
+
+static void check_batch(void *arg,int lo,int hi) {
+	int i;
+
+	for(i=lo; i<hi; i++)
+		batchok[i] = checkTables(batch+i*TREC,TSIZE) == 0;
+}
+
+static long run_checkTables_batch(long n) {
+	long s = 0;
+	int k;
+
+	for(; n > 0; n -= k) {						/* an op is one target */
+		k = n < TBATCH_MAX ? n : TBATCH_MAX;
+		pool_run(check_batch,NULL,k,16);
+		s += batchok[0];
+	}
+	return s;
+}
+
+/* -------- simulator benches -------- */
+
+static long run_hwread_empty(long n) {
+	long s = 0;
+	while(n--) s += hwread(fdin,(void*)msgbuf,MAXBUF);
+	return s;
+}
+
+static long run_hwwrite_hwread(long n) {
+	long s = 0;
+	int len = msgmake1(target);
+	while(n--) {
+		hwwrite(fdout,(void*)target,len);
+		while(hwread(fdin,(void*)msgbuf,MAXBUF)==0)
+			s++;
+	}
+	return s;
+}
+
+static long run_hwwrite_hwresponse(long n) {
+	long s = 0;
+	int len = msgmake1(target);
+	while(n--) {
+		hwwrite(fdout,(void*)target,len);
+		while(hwresponse(fdin,(void*)msgbuf,MAXBUF)==0)
+			s++;
+	}
+	return s;
+}
+
+/* -------- segmented payloads -------- */
+
+#define SEGWIN 16							/* chunks in the fifo at once */
+static uint8_t *segout, *segin;
+static long seglen;
+static unsigned long long written;			/* chunks written so far */
+
+/* sends one payload through the fifo and waits for it to come back */
+static long segtrip(hwseg_tx_t *tx,hwseg_rx_t *rx) {
+	int sent = 0, got = 0;
+
+	hwseg_send(tx,segout,seglen);
+	while(!got) {
+		if(!sent && written - rx->chunks < SEGWIN) {
+			int ret = hwseg_write(fdout,tx);
+			written += ret >= 0;
+			sent = ret == 1;
+		}
+		got = hwseg_read(fdin,rx);
+	}
+	return rx->len == seglen;
+}
+
+/*
+ * a payload of param bytes to send through the fifo in chunks as long
+ * as the driver takes; one trip is checked here, outside the timing
+ */
+static void setup_hwseg(long param) {
+	hwseg_tx_t tx;
+	hwseg_rx_t rx;
+	long i;
+
+	free(segout);
+	free(segin);
+	segout = malloc(param+HWSEG_SLACK);
+	segin = malloc(param+HWSEG_SLACK);
+	for(i=0; i<param; i++)
+		segout[i] = i*7;
+	seglen = param;
+	written = 0;
+	if(hwseg_init(0) < 0)
+		errorExit("microbench: hwseg_init failed\n");
+	hwseg_recv(&rx,segin,seglen);
+	if(!segtrip(&tx,&rx) || memcmp(segin,segout,seglen) != 0)
+		errorExit("microbench: payload came back changed\n");
+}
+
+static long run_hwseg(long n) {
+	hwseg_tx_t tx;
+	hwseg_rx_t rx;
+	long s = 0;
+
+	hwseg_recv(&rx,segin,seglen);
+	written = 0;
+	while(n--)
+		s += segtrip(&tx,&rx);
+	return s;
+}
+
+static bench_t benches[] = {
+	{ "msgmake1", -1, 1, NULL, run_msgmake1 },
+	{ "msgmake2", -1, 1, NULL, run_msgmake2 },
+	{ "msgmake1x", -1, 1, NULL, run_msgmake1x },
+	{ "msgprint", -1, 100, NULL, run_msgprint },
+	{ "checkTables", 0, 1, setup_zones, run_checkTables },
+	{ "checkTables", 10, 1, setup_zones, run_checkTables },
+	{ "checkTables", 100, 10, setup_zones, run_checkTables },
+	{ "checkTables", 1000, 100, setup_zones, run_checkTables },
+	{ "checkTables", 1500, 100, setup_zones, run_checkTables },
+	{ "checkTables", 10000, 1000, setup_zones, run_checkTables },
+	{ "checkTables_poly", 10, 1, setup_polys, run_checkTables },
+	{ "checkTables_poly", 100, 10, setup_polys, run_checkTables },
+	{ "checkTables_poly", 1000, 100, setup_polys, run_checkTables },
+	{ "checkTables_poly", 1500, 100, setup_polys, run_checkTables },
+	{ "checkTables_circle", 10, 1, setup_circles, run_checkTables },
+	{ "checkTables_circle", 100, 10, setup_circles, run_checkTables },
+	{ "checkTables_circle", 1000, 100, setup_circles, run_checkTables },
+	{ "checkTables_circle", 1500, 100, setup_circles, run_checkTables },
+	{ "checkTables_batch", 0, 100, setup_batch, run_checkTables_batch },
+	{ "checkTables_batch", 1, 100, setup_batch, run_checkTables_batch },
+	{ "checkTables_batch", 3, 100, setup_batch, run_checkTables_batch },
+	{ "hwread_empty", -1, 1, NULL, run_hwread_empty },
+	{ "hwwrite_hwread", -1, 10, NULL, run_hwwrite_hwread },
+	{ "hwwrite_hwresponse", -1, 10, NULL, run_hwwrite_hwresponse },
+	{ "hwseg", MSGSZ*8, 100, setup_hwseg, run_hwseg },
+	{ "hwseg", 65536, 1000, setup_hwseg, run_hwseg },
+};
+#define NBENCH (sizeof(benches)/sizeof(benches[0]))
+
+/* -------- timing -------- */
+
+static int cycfd = -1;
+
+static void cycles_open(void) {
+	struct perf_event_attr attr;
+
+	memset(&attr,0,sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	cycfd = syscall(SYS_perf_event_open,&attr,0,-1,-1,0);
+}
+
+static uint64_t cycles(void) {
+	uint64_t c;
+
+	if(cycfd >= 0 && read(cycfd,&c,sizeof(c)) == sizeof(c))
+		return c;
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static uint64_t nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+static int cmpd(const void *a,const void *b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static int selected(char *name,int argc,char **argv) {
+	int i;
+
+	if(optind >= argc)
+		return 1;
+	for(i=optind; i<argc; i++)
+		if(strcmp(argv[i],name) == 0)
+			return 1;
+	return 0;
+}
+
+static void usage(char *prog) {
+	fprintf(stderr,"usage: %s [-n iters] [-w warmup] [-r repeats] [-o file.csv] [name...]\n",prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc,char **argv) {
+	long iters = 1000000, warmup = 10000;
+	int repeats = 5, opt, r;
+	char *outname = "bench.csv";
+	FILE *out;
+	size_t b;
+	double *ns, *cyc;
+	int devnull, saved;
+
+	while((opt = getopt(argc,argv,"n:w:r:o:")) != -1) {
+		switch(opt) {
+		case 'n': iters = atol(optarg); break;
+		case 'w': warmup = atol(optarg); break;
+		case 'r': repeats = atoi(optarg); break;
+		case 'o': outname = optarg; break;
+		default: usage(argv[0]);
+		}
+	}
+	if(iters <= 0 || repeats <= 0 || warmup < 0)
+		usage(argv[0]);
+	if((out = fopen(outname,"w")) == NULL)
+		errorExit("microbench: cannot open output file\n");
+	ns = calloc(repeats,sizeof(double));
+	cyc = calloc(repeats,sizeof(double));
+
+	fdout = open(DEVOUT,O_WRONLY);				/* open the hardware for read and write */
+	fdin = open(DEVIN,O_RDONLY);
+	if(hwinit(fdout) < 0)
+		errorExit("microbench: cannot open the hardware\n");
+	devnull = open("/dev/null",O_WRONLY);
+	cycles_open();
+
+	fprintf(out,"name,param,iters,repeats,ns_per_op_min,ns_per_op_median,ops_per_s,cycles_per_op\n");
+	printf("%-20s %6s %10s %12s %12s %14s %12s\n",
+		   "bench","param","iters","ns/op(min)","ns/op(med)","ops/s","cycles/op");
+	for(b=0; b<NBENCH; b++) {
+		bench_t *bp = &benches[b];
+		long n = iters/bp->scale > 0 ? iters/bp->scale : 1;
+		long w = warmup/bp->scale;
+
+		if(!selected(bp->name,argc,argv))
+			continue;
+		if(bp->setup)
+			bp->setup(bp->param);
+		fflush(stdout);
+		saved = dup(1);						/* msgprint output goes nowhere */
+		dup2(devnull,1);
+		sink = bp->run(w);
+		for(r=0; r<repeats; r++) {
+			uint64_t t0 = nsnow(), c0 = cycles();
+			sink = bp->run(n);
+			uint64_t c1 = cycles(), t1 = nsnow();
+			ns[r] = (double)(t1-t0)/n;
+			cyc[r] = (double)(c1-c0)/n;
+		}
+		fflush(stdout);
+		dup2(saved,1);
+		close(saved);
+		qsort(ns,repeats,sizeof(double),cmpd);
+		qsort(cyc,repeats,sizeof(double),cmpd);
+		double med = ns[repeats/2];
+		printf("%-20s %6ld %10ld %12.1f %12.1f %14.0f %12.1f\n",
+			   bp->name,bp->param,n,ns[0],med,1e9/med,cyc[repeats/2]);
+		fprintf(out,"%s,%ld,%ld,%d,%.2f,%.2f,%.0f,%.2f\n",
+				bp->name,bp->param,n,repeats,ns[0],med,1e9/med,cyc[repeats/2]);
+	}
+	fclose(out);
+	printf("results written to %s\n",outname);
+	exit(EXIT_SUCCESS);
+}
@@ -1,42 +1,24 @@
 /* 
- * msg.h -- 
+ * msg.c -- builds and prints messages (see msg.h)
  * 
  * Author: Antony Guzman
  * Created: 01-2-2020
- * Version: 1.0
+ * Version: 1.1
  * 
  */
 #include <stdio.h>							/* printf */
 #include <stdlib.h>							/* exit codes */
 #include <stdint.h>							/* uint8_t */
+#include <string.h>							/* memcpy */
 #include <sys/types.h>					/* open */
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>							/* close */
 #include "hw.h"	
+#include "msg.h"
 
-#define TARGET 0x30							/* command C3, target type */
-#define AOZ 0x10							/* command C3, target type */
-#define EZ 0x20							/* command C3, target type */
-#define R_SIZE 2 
 static uint8_t id=0;						/* msgid rolls over at 255 */
-
-typedef struct c1 {							/* target message */
-	uint8_t type;
-
-	int8_t lat_deg;
-	uint8_t lat_min;
-	uint8_t lat_sec;
-	int16_t long_deg;
-	uint8_t long_min;
-	uint8_t long_sec;
-
-	uint8_t weapon;
-
-	uint8_t msgid;
-} c1_t;
-
-
+static uint32_t xid=0;						/* extended msgid, rolls over at 2^32 */
 
 int msgmake1(uint8_t *bp) {				
 	c1_t *p=(c1_t*)bp;						/* build a target message */
@@ -79,6 +61,344 @@ int msgmake2(uint8_t *bp) {
 	return 16;
 }
 
+int msgmake1x(uint8_t *bp) {
+	msgmake1(bp);								/* same fields as a target */
+	bp[0] |= MSG_EXT;
+	msgid_set(bp,TSIZE_X,xid++);
+	return TSIZE_X;
+}
+
+int msgmake2x(uint8_t *bp) {
+	msgmake2(bp);								/* same fields as an AOZ/EZ */
+	bp[0] |= MSG_EXT;
+	msgid_set(bp,A_ESIZE_X,xid++);
+	return A_ESIZE_X;
+}
+
+int msgmake1t(uint8_t *bp,uint64_t now) {
+	msgmake1(bp);
+	bp[0] |= MSG_EXT|MSG_TIME;
+	msgtime_set(bp,TSIZE_T,now);
+	msgid_set(bp,TSIZE_T,xid++);
+	return TSIZE_T;
+}
+
+int msgmake2t(uint8_t *bp,uint64_t now) {
+	msgmake2(bp);
+	bp[0] |= MSG_EXT|MSG_TIME;
+	msgtime_set(bp,A_ESIZE_T,now);
+	msgid_set(bp,A_ESIZE_T,xid++);
+	return A_ESIZE_T;
+}
+
+/* a corner in the target layout from arc-seconds */
+static uint8_t *putcorner(uint8_t *bp,int32_t lat,int32_t lng) {
+	int32_t a = lat < 0 ? -lat : lat, o = lng < 0 ? -lng : lng;
+	int deg = lat < 0 ? -(a/3600) : a/3600;
+	int16_t ldeg = lng < 0 ? -(o/3600) : o/3600;
+
+	*bp++ = deg;
+	*bp++ = a/60%60;
+	*bp++ = a%60;
+	*bp++ = ldeg & 0xff;					/* little endian */
+	*bp++ = (uint16_t)ldeg >> 8;
+	*bp++ = o/60%60;
+	*bp++ = o%60;
+	return bp;
+}
+
+int msgmakepoly(uint8_t *bp,uint8_t type,int n,const int32_t *lat,const int32_t *lng) {
+	uint8_t *p = bp;
+	int i;
+
+	*p++ = type | MSG_POLY;
+	*p++ = n;
+	for(i=0; i<n; i++)
+		p = putcorner(p,lat[i],lng[i]);
+	*p = id++;
+	return PSIZE(n);
+}
+
+int msgmakepolyx(uint8_t *bp,uint8_t type,int n,const int32_t *lat,const int32_t *lng) {
+	msgmakepoly(bp,type|MSG_EXT,n,lat,lng);
+	msgid_set(bp,PSIZE_X(n),xid++);
+	return PSIZE_X(n);
+}
+
+int msgmakecircle(uint8_t *bp,uint8_t type,int32_t lat,int32_t lng,uint32_t radius) {
+	uint8_t *p = bp;
+
+	*p++ = type | MSG_CIRCLE;
+	p = putcorner(p,lat,lng);
+	*p++ = radius;							/* little endian */
+	*p++ = radius>>8;
+	*p++ = radius>>16;
+	*p++ = radius>>24;
+	*p = id++;
+	return CSIZE;
+}
+
+int msgmakecirclex(uint8_t *bp,uint8_t type,int32_t lat,int32_t lng,uint32_t radius) {
+	msgmakecircle(bp,type|MSG_EXT,lat,lng,radius);
+	msgid_set(bp,CSIZE_X,xid++);
+	return CSIZE_X;
+}
+
+int msgmakebulk(uint8_t *bp,const uint8_t *zones,int len,int count) {
+	int n, i, size = BULK_HDR;
+
+	for(i=0; i<count; i++) {					/* each zone less its msgid */
+		if((n = msgsize(zones,len)) <= 0 || n > len || size+n > BULK_MAX)
+			return 0;
+		memcpy(bp+size,zones,n-1);
+		size += n-1;
+		zones += n;
+		len -= n;
+	}
+	size++;										/* and one msgid for them all */
+	bp[0] = BULK;
+	bp[1] = size;
+	bp[2] = size>>8;
+	bp[3] = count;
+	bp[4] = count>>8;
+	bp[size-1] = id++;
+	return size;
+}
+
+int msgmakebulkx(uint8_t *bp,const uint8_t *zones,int len,int count) {
+	int size = msgmakebulk(bp,zones,len,count);
+
+	if(size == 0 || size+3 > BULK_MAX)
+		return 0;
+	size += 3;
+	bp[0] |= MSG_EXT;
+	bp[1] = size;
+	bp[2] = size>>8;
+	msgid_set(bp,size,xid++);
+	return size;
+}
+
+int msgmaketbatch(uint8_t *bp,const uint8_t *targets,int len,int count) {
+	int size;
+
+	if(count > TBATCH_MAX || (size = msgmakebulk(bp,targets,len,count)) == 0)
+		return 0;
+	bp[0] = TBATCH;
+	return size;
+}
+
+int msgmaketbatchx(uint8_t *bp,const uint8_t *targets,int len,int count) {
+	int size;
+
+	if(count > TBATCH_MAX || (size = msgmakebulkx(bp,targets,len,count)) == 0)
+		return 0;
+	bp[0] = TBATCH|MSG_EXT;
+	return size;
+}
+
+int rspbatch(uint8_t *bp,uint8_t type,uint32_t msgid,int count,const uint8_t *verdict) {
+	int size = BULK_HDR + count + ((type & MSG_EXT) ? 4 : 1);
+
+	bp[0] = type;
+	bp[1] = size;
+	bp[2] = size>>8;
+	bp[3] = count;
+	bp[4] = count>>8;
+	if(verdict != NULL)
+		memcpy(bp+BULK_HDR,verdict,count);
+	else
+		memset(bp+BULK_HDR,BUSY,count);
+	msgid_set(bp,size,msgid);
+	return size;
+}
+
+/* the length of a zone record (a legacy zone less its msgid); 0 if not a zone, -1 if it cannot yet tell */
+static int recsize(const uint8_t *bp,int have) {
+	if(have < 1)
+		return -1;
+	switch(bp[0]) {
+	case AOZ: case EZ:
+		return A_ESIZE-1;
+	case AOZ|MSG_CIRCLE: case EZ|MSG_CIRCLE:
+		return CSIZE-1;
+	case AOZ|MSG_POLY: case EZ|MSG_POLY: {
+		int n = msgsize(bp,have);
+		return n > 0 ? n-1 : n;
+	}
+	}
+	return 0;
+}
+
+int msgmakedel(uint8_t *bp,const uint8_t *zone) {
+	int n = recsize(zone,PSIZE(MAXVERT));
+
+	if(n <= 0)
+		return 0;
+	bp[0] = ZDEL;
+	memcpy(bp+1,zone,n);
+	bp[n+1] = id++;
+	return n+2;
+}
+
+int msgmakettl(uint8_t *bp,uint16_t ttl,const uint8_t *zone) {
+	int n = recsize(zone,PSIZE(MAXVERT));
+
+	if(n <= 0)
+		return 0;
+	bp[0] = ZTTL;
+	bp[1] = ttl;
+	bp[2] = ttl>>8;
+	memcpy(bp+3,zone,n);
+	bp[n+3] = id++;
+	return n+4;
+}
+
+int msglen(uint8_t type) {
+	switch(type) {
+	case TARGET:				return TSIZE;
+	case AOZ: case EZ:			return A_ESIZE;
+	case TARGET|MSG_EXT:		return TSIZE_X;
+	case AOZ|MSG_EXT:
+	case EZ|MSG_EXT:			return A_ESIZE_X;
+	case AOZ|MSG_CIRCLE:
+	case EZ|MSG_CIRCLE:			return CSIZE;
+	case AOZ|MSG_CIRCLE|MSG_EXT:
+	case EZ|MSG_CIRCLE|MSG_EXT:	return CSIZE_X;
+	case TARGET|MSG_EXT|MSG_TIME:	return TSIZE_T;
+	case AOZ|MSG_EXT|MSG_TIME:
+	case EZ|MSG_EXT|MSG_TIME:	return A_ESIZE_T;
+	case CREDIT:				return KSIZE;
+	case CREDIT|MSG_EXT:		return KSIZE_X;
+	}
+	return 0;
+}
+
+int msgsize(const uint8_t *bp,int have) {
+	if((bp[0] & MSG_TIME) && msglen(bp[0]) == 0)
+		return 0;							/* only the fixed-size ones are timed */
+	switch(MSG_TYPE(bp[0])) {
+	case AOZ|MSG_POLY:
+	case EZ|MSG_POLY:
+		if(have < 2)
+			return -1;
+		if(bp[1] < 3 || bp[1] > MAXVERT)
+			return 0;
+		return (bp[0] & MSG_EXT) ? PSIZE_X(bp[1]) : PSIZE(bp[1]);
+	case ZDEL:
+	case ZTTL: {
+		int hdr = MSG_TYPE(bp[0]) == ZDEL ? 1 : 3, n;
+		if(have <= hdr)
+			return -1;
+		if((n = recsize(bp+hdr,have-hdr)) <= 0)
+			return n;
+		return hdr + n + ((bp[0] & MSG_EXT) ? 4 : 1);
+	}
+	case BULK: {
+		int len;
+		if(have < 3)
+			return -1;
+		len = bp[1] | bp[2]<<8;
+		return len < BULK_HDR + ((bp[0] & MSG_EXT) ? 4 : 1) ? 0 : len;
+	}
+	case TBATCH: {
+		int len, count;
+		if(have < BULK_HDR)
+			return -1;
+		len = bp[1] | bp[2]<<8;
+		count = bp[3] | bp[4]<<8;
+		if(count < 1 || count > TBATCH_MAX || len != BULK_HDR + count*TREC + ((bp[0] & MSG_EXT) ? 4 : 1))
+			return 0;
+		return len;
+	}
+	}
+	return msglen(bp[0]);
+}
+
+int rsplen(uint8_t type) {
+	if(type & MSG_TIME)
+		return RSIZE_T;
+	return (type & MSG_EXT) ? RSIZE_X : RSIZE;
+}
+
+static void put64(uint8_t *bp,uint64_t v) {
+	int i;
+
+	for(i=0; i<8; i++)						/* little endian */
+		bp[i] = v >> 8*i;
+}
+
+static uint64_t get64(const uint8_t *bp) {
+	uint64_t v = 0;
+	int i;
+
+	for(i=7; i>=0; i--)
+		v = v<<8 | bp[i];
+	return v;
+}
+
+uint64_t msgtime_get(const uint8_t *bp,int len) {
+	return (bp[0] & MSG_TIME) ? get64(bp+len-4-TSTAMP) : 0;
+}
+
+void msgtime_set(uint8_t *bp,int len,uint64_t t) {
+	put64(bp+len-4-TSTAMP,t);
+}
+
+int msgbody(const uint8_t *bp,int len) {
+	if(bp[0] & MSG_TIME)
+		return len-4-TSTAMP;
+	return (bp[0] & MSG_EXT) ? len-4 : len-1;
+}
+
+int rspmake(uint8_t *bp,uint8_t type,uint8_t status,uint32_t msgid,const uint64_t *ts) {
+	int i, rlen = rsplen(type);
+
+	if(!(type & MSG_TIME)) {
+		bp[0] = status;
+		msgid_set(bp,rlen,msgid);
+		return rlen;
+	}
+	bp[0] = type;							/* so that it reads as extended */
+	bp[1] = status;
+	for(i=0; i<4; i++)
+		put64(bp+2+i*TSTAMP,ts != NULL ? ts[i] : 0);
+	msgid_set(bp,rlen,msgid);
+	return rlen;
+}
+
+void rsptimes(const uint8_t *bp,uint64_t *ts) {
+	int i;
+
+	for(i=0; i<4; i++)
+		ts[i] = get64(bp+2+i*TSTAMP);
+}
+
+/* a response is status and msgid; anything longer is a message with a type byte */
+static int isext(const uint8_t *bp,int len) {
+	if(len <= RSIZE_X)
+		return len == RSIZE_X;
+	return (bp[0] & MSG_EXT) != 0;
+}
+
+uint32_t msgid_get(const uint8_t *bp,int len) {
+	if(!isext(bp,len))
+		return bp[len-1];
+	bp += len-4;							/* little endian trailer */
+	return bp[0] | bp[1]<<8 | bp[2]<<16 | (uint32_t)bp[3]<<24;
+}
+
+void msgid_set(uint8_t *bp,int len,uint32_t msgid) {
+	if(!isext(bp,len)) {
+		bp[len-1] = (uint8_t)msgid;
+		return;
+	}
+	bp += len-4;
+	bp[0] = msgid;
+	bp[1] = msgid>>8;
+	bp[2] = msgid>>16;
+	bp[3] = msgid>>24;
+}
+
 void msgprint(char *tag,uint8_t *bp,int len) {
 	int i;
 
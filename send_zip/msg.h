@@ -0,0 +1,293 @@
+/*
+ * msg.h -- the message formats exchanged between clients, the server
+ * and the hardware
+ *
+ * Author: Antony Guzman
+ * Created: 01-2-2020
+ * Version: 1.1
+ *
+ * Description: every message starts with a type byte and ends with
+ * its msgid. The legacy formats carry an 8-bit msgid that rolls over
+ * at 255. Setting MSG_EXT in the type byte selects the extended
+ * format, in which the trailing msgid is a 32-bit little endian
+ * sequence number, and the 2-byte response grows to 5 bytes.
+ *
+ * An AOZ or EZ normally carries the two corners of a box. With
+ * MSG_POLY set in the type byte it carries a polygon instead: a vertex
+ * count, then that many corners in the target layout, then the msgid.
+ * The server keeps polygon zones itself and answers them with ACK or
+ * NAK; they are never sent to the hardware.
+ *
+ * With MSG_CIRCLE set instead, an AOZ or EZ is a circle: its center,
+ * as a corner in the target layout, then its radius in metres (32
+ * bits, little endian, at most CIRCLE_MAX), then the msgid. Circle
+ * zones are kept by the server too.
+ *
+ * A BULK message uploads many zones at once: its total length (16
+ * bits, little endian), a zone count (16 bits), then that many zone
+ * records, then the msgid. A record is a legacy AOZ or EZ message, box
+ * or polygon, without its msgid. The server stores all the zones or
+ * none of them, and answers the batch with one ACK or NAK.
+ *
+ * ZDEL deletes a zone: it carries a zone record, as in a BULK
+ * message, then the msgid. ZTTL stores a zone that expires: a time to
+ * live in seconds (16 bits, little endian), a zone record, the msgid.
+ * Both are answered by the server with ACK, or NAK if there was no
+ * such zone to delete or no room for the new one.
+ *
+ * Any message for the hardware may instead be answered BUSY, when the
+ * server is too far behind to have it answered in time (s_hw -D), or
+ * the fifo refused it. It was not acted on, and may be sent again.
+ *
+ * A TBATCH message carries many targets: its total length and a
+ * target count (16 bits each, little endian, at most TBATCH_MAX), that
+ * many target records, then the msgid. A record is a legacy target
+ * message without its msgid. The server checks them all against the
+ * zones at once, sends the hardware only the valid ones, and answers
+ * with one frame laid out the same way: type, length, count, then a
+ * verdict byte per target in order, then the msgid. A verdict is the
+ * hardware's status for the target, NAK if it failed the zone check,
+ * or BUSY if it was not sent. TBATCH is not taken as a datagram.
+ *
+ * Setting MSG_TIME as well as MSG_EXT in the type byte of a target or
+ * a box AOZ or EZ times it hop by hop: the message carries the
+ * client's send time (TSTAMP bytes) just before its msgid, and its
+ * response grows to RSIZE_T bytes: the type byte, the status, the
+ * client's send time, when the server read the message, submitted it
+ * to the hardware and got the hardware's answer, then the msgid. A
+ * time is nanoseconds since the epoch (CLOCK_REALTIME), 64 bits, little
+ * endian; the server echoes the client's unread, and gives 0 for a hop
+ * the message never took. The hardware never sees the send time.
+ *
+ * A CREDIT message is only a type byte and a msgid. The server answers
+ * it at once, whatever is in flight, with a response whose status byte
+ * is the client's credit: how many more messages it may send now
+ * without any having to wait, given its own requests in flight and
+ * queued, and the room left at the device and in its fifo. A client
+ * that keeps within its credit never finds the server behind; each
+ * response it gets back frees one more.
+ *
+ */
+#ifndef MSG_H
+#define MSG_H
+
+#include <stdint.h>							/* uint8_t */
+
+#define TARGET 0x30							/* command C3, target type */
+#define AOZ 0x10							/* command C3, area of operation zone */
+#define EZ 0x20								/* command C3, exclusion zone */
+#define BULK 0x50							/* many AOZ/EZ records in one message */
+#define ZDEL 0x60							/* delete a zone */
+#define ZTTL 0x70							/* a zone with a time to live */
+#define CREDIT 0x40							/* how many messages may be sent now */
+#define TBATCH 0x90							/* many targets in one message */
+#define MSG_EXT 0x08						/* type flag: 32-bit msgid trailer */
+#define MSG_TIME 0x04						/* type flag: timed, with MSG_EXT */
+#define MSG_TYPE(t) ((t) & ~(MSG_EXT|MSG_TIME))	/* type with the format flags removed */
+#define MSG_POLY 0x01						/* zone flag: a polygon, not a box */
+#define MSG_CIRCLE 0x02						/* zone flag: a circle, not a box */
+#define MSG_SHAPE(t) ((t) & 0x03)			/* zone shape flags */
+
+#define R_SIZE 2 							/* legacy response: status, msgid */
+#define RSIZE   2
+#define TSIZE   10							/* legacy target */
+#define A_ESIZE 16							/* legacy AOZ/EZ */
+#define RSIZE_X (RSIZE+3)					/* extended response */
+#define TSIZE_X (TSIZE+3)					/* extended target */
+#define A_ESIZE_X (A_ESIZE+3)				/* extended AOZ/EZ */
+#define TSTAMP  8							/* a time in a timed message */
+#define RSIZE_T (RSIZE_X+1+4*TSTAMP)		/* timed response */
+#define TSIZE_T (TSIZE_X+TSTAMP)			/* timed target */
+#define A_ESIZE_T (A_ESIZE_X+TSTAMP)		/* timed AOZ/EZ */
+#define MSG_MAXLEN A_ESIZE_T				/* longest fixed-size message */
+#define MAXVERT 32							/* most polygon vertices: under 256 bytes */
+#define PSIZE(n) (2+7*(n)+1)				/* legacy polygon zone of n vertices */
+#define PSIZE_X(n) (PSIZE(n)+3)				/* extended polygon zone */
+#define CSIZE   13							/* legacy circle zone */
+#define CSIZE_X (CSIZE+3)					/* extended circle zone */
+#define KSIZE   2							/* legacy credit query */
+#define KSIZE_X (KSIZE+3)					/* extended credit query */
+#define CIRCLE_MAX 10000000					/* largest radius, metres */
+#define BULK_HDR 5							/* type, length, count */
+#define BULK_MAX 65535						/* longest bulk message */
+#define TREC (TSIZE-1)						/* a target record in a TBATCH */
+#define TBATCH_MAX 256						/* most targets in a TBATCH */
+#define TBATCH_RSPMAX (BULK_HDR+TBATCH_MAX+4)	/* longest TBATCH answer */
+
+#define ACK 0x80							/* AOZ/EZ accepted by hardware */
+#define NAK 0x81							/* AOZ/EZ refused, or target failed the zone check */
+#define BUSY 0x82							/* not sent: the server is overloaded */
+
+typedef struct c1 {							/* target message */
+	uint8_t type;
+
+	int8_t lat_deg;
+	uint8_t lat_min;
+	uint8_t lat_sec;
+	int16_t long_deg;
+	uint8_t long_min;
+	uint8_t long_sec;
+
+	uint8_t weapon;
+
+	uint8_t msgid;
+} c1_t;
+
+/*
+ * msgmake1() -- builds a legacy target message alternating between
+ * weapon 1 and 2.
+ *
+ * returns: the message length.
+ */
+int msgmake1(uint8_t *bp);
+
+/*
+ * msgmake2() -- builds a legacy AOZ/EZ message, alternating between
+ * the two zone types.
+ *
+ * returns: the message length.
+ */
+int msgmake2(uint8_t *bp);
+
+/*
+ * msgmake1x(), msgmake2x() -- as msgmake1() and msgmake2() but in the
+ * extended format; the msgid is a 32-bit sequence number.
+ *
+ * returns: the message length.
+ */
+int msgmake1x(uint8_t *bp);
+int msgmake2x(uint8_t *bp);
+
+/*
+ * msgmake1t(), msgmake2t() -- as msgmake1x() and msgmake2x() but
+ * timed, sent at now (nanoseconds since the epoch).
+ *
+ * returns: the message length.
+ */
+int msgmake1t(uint8_t *bp,uint64_t now);
+int msgmake2t(uint8_t *bp,uint64_t now);
+
+/*
+ * msgmakepoly(), msgmakepolyx() -- build a polygon zone of type AOZ
+ * or EZ with n vertices at lat[i], lng[i] arc-seconds. A coordinate
+ * between 0 and -1 degree loses its sign, as in the target layout.
+ *
+ * returns: the message length.
+ */
+int msgmakepoly(uint8_t *bp,uint8_t type,int n,const int32_t *lat,const int32_t *lng);
+int msgmakepolyx(uint8_t *bp,uint8_t type,int n,const int32_t *lat,const int32_t *lng);
+
+/*
+ * msgmakecircle(), msgmakecirclex() -- build a circle zone of type AOZ
+ * or EZ centered at lat, lng arc-seconds, of radius metres.
+ *
+ * returns: the message length.
+ */
+int msgmakecircle(uint8_t *bp,uint8_t type,int32_t lat,int32_t lng,uint32_t radius);
+int msgmakecirclex(uint8_t *bp,uint8_t type,int32_t lat,int32_t lng,uint32_t radius);
+
+/*
+ * msgmakebulk(), msgmakebulkx() -- build a bulk message from count
+ * zone messages, as built by msgmake2(), msgmakepoly() or
+ * msgmakecircle(), laid end to end in the len bytes at zones.
+ *
+ * returns: the message length; 0 if it would exceed BULK_MAX.
+ */
+int msgmakebulk(uint8_t *bp,const uint8_t *zones,int len,int count);
+int msgmakebulkx(uint8_t *bp,const uint8_t *zones,int len,int count);
+
+/*
+ * msgmaketbatch(), msgmaketbatchx() -- build a TBATCH message from
+ * count target messages, as built by msgmake1(), laid end to end in
+ * the len bytes at targets.
+ *
+ * returns: the message length; 0 if count exceeds TBATCH_MAX.
+ */
+int msgmaketbatch(uint8_t *bp,const uint8_t *targets,int len,int count);
+int msgmaketbatchx(uint8_t *bp,const uint8_t *targets,int len,int count);
+
+/*
+ * rspbatch() -- builds the answer to a TBATCH message of type type
+ * and msgid msgid: count verdicts, from verdict, or all BUSY if
+ * verdict is NULL.
+ *
+ * returns: the answer's length.
+ */
+int rspbatch(uint8_t *bp,uint8_t type,uint32_t msgid,int count,const uint8_t *verdict);
+
+/*
+ * msgmakedel(), msgmakettl() -- build a legacy ZDEL for, or a ZTTL
+ * of ttl seconds with, the zone message at zone (as built by
+ * msgmake2(), msgmakepoly() or msgmakecircle()).
+ *
+ * returns: the message length; 0 if zone is not a well formed zone.
+ */
+int msgmakedel(uint8_t *bp,const uint8_t *zone);
+int msgmakettl(uint8_t *bp,uint16_t ttl,const uint8_t *zone);
+
+/*
+ * msglen() -- the length of a fixed-size message given its type byte.
+ *
+ * returns: the message length; 0 if the type is unknown or variable.
+ */
+int msglen(uint8_t type);
+
+/*
+ * msgsize() -- the length of the message at bp, of which have bytes
+ * (at least one) have arrived. Unlike msglen() it knows the
+ * variable-length messages.
+ *
+ * returns: the message length; 0 if the type or header is invalid;
+ * -1 if more bytes are needed to tell.
+ */
+int msgsize(const uint8_t *bp,int have);
+
+/*
+ * msgid_get(), msgid_set() -- read or write the msgid trailer of a
+ * message (or of a response) of length len, in either format. A
+ * message's type byte gives its format; a response's length does.
+ */
+uint32_t msgid_get(const uint8_t *bp,int len);
+void msgid_set(uint8_t *bp,int len,uint32_t msgid);
+
+/*
+ * msgtime_get(), msgtime_set() -- read or write the client's send time
+ * in a message of length len; msgtime_get() returns 0 for a message
+ * that is not timed.
+ */
+uint64_t msgtime_get(const uint8_t *bp,int len);
+void msgtime_set(uint8_t *bp,int len,uint64_t t);
+
+/*
+ * msgbody() -- the bytes of the message at bp, of length len, before
+ * its send time, if timed, and its msgid.
+ */
+int msgbody(const uint8_t *bp,int len);
+
+/*
+ * rsplen() -- the length of the response to a message of type type.
+ */
+int rsplen(uint8_t type);
+
+/*
+ * rspmake() -- builds the response with status status to a message
+ * of type type and msgid msgid. If the type is timed, ts holds the four
+ * times to give (see above), or is NULL for none; otherwise it is
+ * ignored.
+ *
+ * returns: the response's length.
+ */
+int rspmake(uint8_t *bp,uint8_t type,uint8_t status,uint32_t msgid,const uint64_t *ts);
+
+/*
+ * rsptimes() -- reads the four times from the timed response at bp
+ * into ts.
+ */
+void rsptimes(const uint8_t *bp,uint64_t *ts);
+
+/*
+ * msgprint() -- prints a message on the screen in hex
+ */
+void msgprint(char *tag,uint8_t *bp,int len);
+
+#endif /* MSG_H */
@@ -0,0 +1,147 @@
+/*
+ * pool.c -- a work-stealing pool of threads (see pool.h)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pool.h"
+
+#define POOL_MAX 64							/* most threads */
+#define CACHELINE 64
+
+typedef struct run {						/* chunks [top,bottom) left to a thread */
+	_Atomic uint64_t span;					/* top in the high half, bottom in the low */
+	char pad[CACHELINE-sizeof(uint64_t)];
+} run_t;
+
+static run_t runs[POOL_MAX+1];				/* the caller's is runs[0] */
+static pthread_t threads[POOL_MAX];
+static int nthreads;
+static pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cv = PTHREAD_COND_INITIALIZER;
+static uint64_t gen;						/* loops started; under mu */
+static uint64_t startgen;					/* gen when the threads started */
+static int stopping;						/* under mu */
+static _Atomic int finished;				/* threads done with this loop */
+static _Atomic unsigned long long steals;
+
+static void (*jobfn)(void *arg,int lo,int hi);	/* the loop: set before gen moves on */
+static void *jobarg;
+static int jobn,jobgrain;
+
+/* take a chunk from run r: its owner from the bottom, a thief from the top */
+static int take(run_t *r,int own,uint32_t *chunk) {
+	uint64_t s = atomic_load_explicit(&r->span,memory_order_acquire), ns;
+	uint32_t top,bot;
+
+	do {
+		top = s >> 32;
+		bot = (uint32_t)s;
+		if(top >= bot)
+			return 0;
+		ns = own ? ((uint64_t)top << 32 | (bot-1)) : ((uint64_t)(top+1) << 32 | bot);
+	} while(!atomic_compare_exchange_weak_explicit(&r->span,&s,ns,memory_order_acq_rel,memory_order_acquire));
+	*chunk = own ? bot-1 : top;
+	return 1;
+}
+
+/* run chunks, our own first, then anyone's, until there are none */
+static void work(int self) {
+	uint32_t chunk;
+	int k,lo,hi;
+
+	for(;;) {
+		if(!take(&runs[self],1,&chunk)) {
+			for(k=1; k<=nthreads; k++)
+				if(take(&runs[(self+k)%(nthreads+1)],0,&chunk))
+					break;
+			if(k > nthreads)
+				return;
+			atomic_fetch_add_explicit(&steals,1,memory_order_relaxed);
+		}
+		lo = chunk*jobgrain;
+		hi = lo+jobgrain < jobn ? lo+jobgrain : jobn;
+		jobfn(jobarg,lo,hi);
+	}
+}
+
+static void *pool_thread(void *arg) {
+	int self = (int)(intptr_t)arg;
+	uint64_t seen = startgen;
+
+	for(;;) {
+		pthread_mutex_lock(&mu);
+		while(seen == gen && !stopping)
+			pthread_cond_wait(&cv,&mu);
+		seen = gen;
+		if(stopping) {
+			pthread_mutex_unlock(&mu);
+			return NULL;
+		}
+		pthread_mutex_unlock(&mu);
+		work(self);
+		atomic_fetch_add_explicit(&finished,1,memory_order_release);
+	}
+}
+
+int pool_start(int n) {
+	int i;
+
+	if(n > POOL_MAX)
+		n = POOL_MAX;
+	stopping = 0;							/* after a pool_stop() */
+	startgen = gen;
+	for(i=0; i<n; i++) {
+		if(pthread_create(&threads[i],NULL,pool_thread,(void*)(intptr_t)(i+1)) != 0) {
+			pool_stop();
+			return -1;
+		}
+		nthreads++;
+	}
+	return 0;
+}
+
+void pool_run(void (*fn)(void *arg,int lo,int hi),void *arg,int n,int grain) {
+	uint32_t chunks = (n+grain-1)/grain, i, parts = nthreads+1;
+
+	if(nthreads == 0 || chunks < 2) {
+		if(n > 0)
+			fn(arg,0,n);
+		return;
+	}
+	jobfn = fn;
+	jobarg = arg;
+	jobn = n;
+	jobgrain = grain;
+	for(i=0; i<parts; i++)					/* neighbouring chunks, so neighbouring items, to each */
+		atomic_store_explicit(&runs[i].span,(uint64_t)(i*chunks/parts) << 32 | ((i+1)*chunks/parts),
+							  memory_order_relaxed);
+	atomic_store_explicit(&finished,0,memory_order_relaxed);
+	pthread_mutex_lock(&mu);
+	gen++;
+	pthread_cond_broadcast(&cv);
+	pthread_mutex_unlock(&mu);
+	work(0);
+	while(atomic_load_explicit(&finished,memory_order_acquire) < nthreads)
+		sched_yield();						/* none may still be looking at this loop */
+}
+
+unsigned long long pool_steals(void) {
+	return atomic_load_explicit(&steals,memory_order_relaxed);
+}
+
+void pool_stop(void) {
+	int i;
+
+	pthread_mutex_lock(&mu);
+	stopping = 1;
+	pthread_cond_broadcast(&cv);
+	pthread_mutex_unlock(&mu);
+	for(i=0; i<nthreads; i++)
+		pthread_join(threads[i],NULL);
+	nthreads = 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * pool.h -- a work-stealing pool of threads for loops over many items
+ *
+ * Description: pool_run() splits a loop into chunks and deals each
+ * thread, and the caller, a run of neighbouring chunks. Each takes
+ * chunks from the near end of its own run; one that runs out steals
+ * from the far end of another's, so a thread held up by slow items
+ * (a target in a polygon's box costs more than one outside every
+ * zone) does not hold up the loop. A run is a pair of indexes changed
+ * with compare-and-swap, so taking and stealing need no lock; threads
+ * sleep on a condition variable between loops.
+ *
+ */
+#ifndef POOL_H
+#define POOL_H
+
+/*
+ * pool_start() -- starts nthreads threads to help pool_run()
+ *
+ * returns: 0 on success; -1 on error.
+ */
+int pool_start(int nthreads);
+
+/*
+ * pool_run() -- calls fn(arg,lo,hi) for ranges [lo,hi) of at most
+ * grain items that together cover [0,n), on the pool's threads and
+ * the caller's, and returns when every call has. With no pool, or
+ * fewer than two chunks, the caller does it all.
+ */
+void pool_run(void (*fn)(void *arg,int lo,int hi),void *arg,int n,int grain);
+
+/*
+ * pool_steals() -- chunks taken from another thread's run since the
+ * pool started
+ */
+unsigned long long pool_steals(void);
+
+/*
+ * pool_stop() -- stops the threads
+ */
+void pool_stop(void);
+
+#endif /* POOL_H */
@@ -0,0 +1,259 @@
+/*
+ * replay.c -- re-drives a capture from s_hw -C against a server
+ *
+ * Description: opens one connection per captured client connection
+ * and sends each captured message on it at its captured time, divided
+ * by the speed factor (-s 1 for real time, -s 10 for ten times faster,
+ * -s 0 for as fast as possible). Messages go out in capture order, so
+ * the order within each connection is preserved. Responses are read
+ * and counted as they arrive; the captured responses give the number
+ * of bytes expected back.
+ *
+ * Each connection uses the transport it was captured on: TCP to port
+ * -p, datagrams to UDP port -u, or Unix packets to the socket at -U.
+ * A capture with datagrams or Unix packets needs -u or -U.
+ *
+ * usage: replay [-a addr] [-p port] [-u port] [-U path] [-s speed] capture-file
+ *
+ */
+#include <stdio.h>		/* printf */
+#include <stdlib.h> 		/* EXIT_FAILURE & EXIT_SUCCESS */
+#include <string.h>		/* memset */
+#include <arpa/inet.h>		/* htons & inet_addr */
+#include <sys/socket.h>		/* socket calls */
+#include <sys/un.h>			/* sockaddr_un */
+#include <sys/epoll.h>
+#include <netinet/tcp.h>	/* TCP_NODELAY */
+#include <unistd.h>		/* close */
+#include <errno.h>
+#include <time.h>
+#include "defs.h"
+#include "msg.h"
+#include "capture.h"
+
+#define MAXEV 64
+#define IDLE_MS 2000						/* give up on responses after this */
+
+static int *fds;							/* socket per captured connection */
+static uint8_t *hows;						/* and its transport, CAP_TCP ... */
+static uint32_t nconn;
+static int ep;
+static uint64_t rspbytes;					/* response bytes received */
+static struct sockaddr_in servaddr;
+static struct sockaddr_in udpaddr;			/* port 0 if not given */
+static struct sockaddr_un unixaddr;			/* empty path if not given */
+
+static uint64_t nsnow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+/* read whatever responses have arrived, waiting up to ms */
+static int drain(int ms) {
+	struct epoll_event evs[MAXEV];
+	uint8_t buf[4096];
+	ssize_t n;
+	int i, nev;
+
+	nev = epoll_wait(ep,evs,MAXEV,ms);
+	for(i=0; i<nev; i++) {
+		uint32_t conn = evs[i].data.u32;
+		int fd = fds[conn];
+		while((n = recv(fd,buf,sizeof(buf),MSG_DONTWAIT)) > 0)
+			rspbytes += n;
+		if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+			epoll_ctl(ep,EPOLL_CTL_DEL,fd,NULL);
+			close(fd);
+			fds[conn] = -2;					/* closed; never reopened */
+		}
+	}
+	return nev;
+}
+
+/* make room in the tables for connection conn */
+static void conn_table(uint32_t conn) {
+	uint32_t n = conn*2+16, i;
+
+	if(conn < nconn)
+		return;
+	fds = realloc(fds,n*sizeof(int));
+	hows = realloc(hows,n);
+	for(i=nconn; i<n; i++) {
+		fds[i] = -1;
+		hows[i] = CAP_TCP;
+	}
+	nconn = n;
+}
+
+/* the socket for a captured connection, opened on its transport if it is new */
+static int conn_fd(uint32_t conn) {
+	struct sockaddr *to = (struct sockaddr*)&servaddr;
+	socklen_t tolen = sizeof(servaddr);
+	int fd, one = 1, how;
+
+	conn_table(conn);
+	if(fds[conn] != -1)
+		return fds[conn];
+	switch(how = hows[conn]) {
+	case CAP_UDP:
+		if(udpaddr.sin_port == 0)
+			errorExit("replay: the capture has datagrams: give -u port\n");
+		fd = socket(AF_INET,SOCK_DGRAM,0);
+		to = (struct sockaddr*)&udpaddr;
+		break;
+	case CAP_UNIX:
+		if(unixaddr.sun_path[0] == '\0')
+			errorExit("replay: the capture has Unix clients: give -U path\n");
+		fd = socket(AF_UNIX,SOCK_SEQPACKET,0);
+		to = (struct sockaddr*)&unixaddr;
+		tolen = sizeof(unixaddr);
+		break;
+	default:
+		fd = socket(AF_INET,SOCK_STREAM,IPPROTO_TCP);
+		break;
+	}
+	if(fd < 0)
+		errorExit("replay: Error creating socket\n");
+	if(connect(fd,to,tolen) < 0) {
+		printf("replay: Error calling connect (%s)\n",strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if(how == CAP_TCP)
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+	else if(how == CAP_UDP) {
+		int big = 4<<20;					/* room for a burst of answers */
+		setsockopt(fd,SOL_SOCKET,SO_RCVBUF,&big,sizeof(big));
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.u32 = conn };
+	epoll_ctl(ep,EPOLL_CTL_ADD,fd,&ev);
+	return fds[conn] = fd;
+}
+
+/* send all of a message, reading responses while the socket is full */
+static void sendmsg_all(int fd,const uint8_t *bp,int len) {
+	ssize_t n;
+
+	while(len > 0) {
+		if((n = send(fd,bp,len,MSG_DONTWAIT|MSG_NOSIGNAL)) < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				errorExit("replay: Error on send\n");
+			drain(1);
+			continue;
+		}
+		bp += n;
+		len -= n;
+	}
+}
+
+/* wait until the monotonic time t, reading responses meanwhile */
+static void wait_until(uint64_t t) {
+	uint64_t now;
+	struct timespec ts;
+
+	while((now = nsnow()) + 1000000 < t)
+		drain((int)((t-now)/1000000));
+	if(now < t) {
+		ts.tv_sec = t/1000000000ull;
+		ts.tv_nsec = t%1000000000ull;
+		clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL);
+	}
+}
+
+static void usage(char *prog) {
+	fprintf(stderr,"usage: %s [-a addr] [-p port] [-u port] [-U path] [-s speed] capture-file\n",prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc,char **argv) {
+	char *addr = "127.0.0.1";					/* producers are usually local */
+	uint16_t port = TCP_ECHO_PORT, uport = 0;
+	char *upath = NULL;
+	double speed = 1;
+	uint64_t t0, expect = 0, nmsg = 0, last = 0;
+	uint8_t *cap, *bp, *end;
+	long size;
+	FILE *f;
+	int opt;
+
+	while((opt = getopt(argc,argv,"a:p:u:U:s:")) != -1) {
+		switch(opt) {
+		case 'a': addr = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'u': uport = atoi(optarg); break;
+		case 'U': upath = optarg; break;
+		case 's': speed = atof(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if(optind != argc-1 || speed < 0 || (upath != NULL && strlen(upath) >= sizeof(unixaddr.sun_path)))
+		usage(argv[0]);
+
+	if((f = fopen(argv[optind],"rb")) == NULL)
+		errorExit("replay: cannot open capture\n");
+	fseek(f,0,SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	cap = malloc(size);
+	if(size < CAP_HDRSZ || fread(cap,size,1,f) != 1 || memcmp(cap,CAP_MAGIC,8) != 0)
+		errorExit("replay: not a capture file\n");
+	fclose(f);
+
+	memset(&servaddr,0,sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_port = htons(port);
+	if(inet_aton(addr,&servaddr.sin_addr) <= 0)
+		errorExit("replay: Error on inet_aton\n");
+	udpaddr = servaddr;
+	udpaddr.sin_port = htons(uport);
+	unixaddr.sun_family = AF_UNIX;
+	if(upath != NULL)
+		strcpy(unixaddr.sun_path,upath);
+	if((ep = epoll_create1(0)) < 0)
+		errorExit("replay: Error calling epoll_create1\n");
+
+	t0 = nsnow();
+	end = cap+size;
+	for(bp=cap+CAP_HDRSZ; bp+CAP_RECSZ <= end && bp+CAP_RECSZ+cap_get16(bp+13) <= end; bp+=CAP_RECSZ+cap_get16(bp+13)) {
+		uint64_t ts = cap_get64(bp);
+		uint32_t conn = cap_get32(bp+8);
+		int kind = bp[12], len = cap_get16(bp+13);
+
+		last = ts;
+		if(kind == CAP_RSP) {				/* what the server should answer */
+			if(conn != 0)
+				expect += len;
+			continue;
+		}
+		if(speed > 0)
+			wait_until(t0 + (uint64_t)(ts/speed));
+		switch(kind) {
+		case CAP_OPEN:						/* no transport: an older capture, TCP */
+			conn_table(conn);
+			hows[conn] = len > 0 ? bp[CAP_RECSZ] : CAP_TCP;
+			if(hows[conn] != CAP_UDP)		/* datagrams need no socket until they come */
+				conn_fd(conn);
+			break;
+		case CAP_MSG:
+			if(conn_fd(conn) >= 0) {
+				sendmsg_all(fds[conn],bp+CAP_RECSZ,len);
+				nmsg++;
+			}
+			break;
+		case CAP_CLOSE:						/* let the server answer, then close */
+			if(conn < nconn && fds[conn] >= 0)
+				shutdown(fds[conn],SHUT_WR);
+			break;
+		}
+		drain(0);
+	}
+	double sent = (double)(nsnow()-t0)/1e9;
+	while(rspbytes < expect && drain(IDLE_MS) > 0)	/* wait for the last responses */
+		;
+
+	printf("replayed %llu messages in %.3fs (captured over %.3fs): %.0f msgs/s\n",
+		   (unsigned long long)nmsg,sent,last/1e9,sent > 0 ? nmsg/sent : 0);
+	printf("response bytes: %llu received, %llu captured\n",
+		   (unsigned long long)rspbytes,(unsigned long long)expect);
+	exit(rspbytes == expect ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -1,6 +1,93 @@
 /* 
  * Server with hardware and connection to the server
  * 
+ * Clients may keep their connection open and pipeline several
+ * messages. Every message sent to the hardware is tagged with a
+ * sequence number from a sliding window over the device, so the
+ * responses from hwresponse() are matched back to the client and
+ * msgid that asked, however many requests are in flight. The number
+ * of requests in flight is bounded per client (-c) and for the device
+ * (-w). With -x the device link uses the extended format with 32-bit
+ * msgids instead of 8-bit ones that roll over at 255. -q stops the
+ * per-message trace. -C file captures all traffic for replay.
+ *
+ * -P cpu hands the hardware to a polling thread pinned to cpu (see
+ * hwpoll.h), with SCHED_FIFO priority -F prio if given. The achieved
+ * poll rate and response jitter are reported every REPORT seconds.
+ *
+ * Polygon zones, bulk zone uploads, zone deletes and zones with a time
+ * to live are handled and answered by the server itself, since the
+ * hardware only knows single box zones. -z sets the most zones kept.
+ * A target outside every AOZ or inside an EZ is answered NAK at once,
+ * by the server, and never sent to the hardware, even when the
+ * client's window or the device's is full or the deadline has passed.
+ *
+ * -d ms answers a target the hardware has judged within the last ms
+ * milliseconds with that verdict, without asking the hardware again
+ * (see dedup.h). A copy of a target still at the hardware waits for
+ * that one's verdict and is answered with it.
+ *
+ * -u port also takes messages as UDP datagrams, one message to a
+ * datagram, read and answered in batches with recvmmsg() and
+ * sendmmsg(). A datagram's response goes back to the address it came
+ * from. Each sender's msgids should count up by one; gaps and
+ * reordering are counted in the metrics. Datagrams are read UDPBATCH
+ * at a time whatever the device window: those the server answers
+ * itself are answered at once, and the rest wait in a queue of
+ * UDPQUEUE for room at the device, in order. One that finds the queue
+ * full is answered BUSY, so an invalid target is never stuck behind
+ * valid ones.
+ *
+ * -U path also listens on a Unix SOCK_SEQPACKET socket, for producers
+ * on the same host. Every packet is exactly one message, so these
+ * clients never deal with partial reads; otherwise they are served
+ * just as TCP clients are.
+ *
+ * -o port or -o path streams every hardware response, with the
+ * msgid and type it answers, to any number of observers (see subs.h).
+ *
+ * -I moves the TCP clients onto an io_uring (see uring.h): a multishot
+ * accept, a multishot recv per client into provided buffers, and sends
+ * queued as responses are made, all handed to the kernel by one
+ * io_uring_enter() per pass of the event loop, which also waits.
+ * Everything else stays on epoll, and the ring polls the epoll
+ * descriptor, so epoll_wait() is called only when it has something.
+ * Without io_uring the server says so and uses epoll alone.
+ *
+ * -H path restarts without downtime (see handoff.h). A server given -H
+ * waits there for its successor; one started with the same -H while it
+ * runs takes over its listening sockets, clients and zones once the
+ * hardware has answered everything in flight, and the old one exits.
+ *
+ * Nothing is written to the fifo that it has no room for: the words
+ * of every request in flight are counted against its depth, and a
+ * client whose next message would not fit waits, as it does for the
+ * device window, and is not read from meanwhile, so a saturated device
+ * pushes back on producers instead of losing their messages. A CREDIT
+ * message asks how many more a client may send now (see msg.h).
+ *
+ * -D ms gives every message for the hardware a deadline of ms
+ * milliseconds from when it was read (for a datagram, from when the
+ * kernel received it). A message that has waited so long that, with
+ * the device's recent round trip, it would miss its deadline is
+ * answered BUSY at once instead of being sent. How long messages
+ * waited, and how many were shed, are in the metrics.
+ *
+ * A TBATCH message carries many targets (see msg.h). They are checked
+ * against the zones together, split among -T threads of a
+ * work-stealing pool (see pool.h) as well as the event loop, and the
+ * valid ones go to the hardware back to back, as far as the device
+ * has room, the rest as it makes room. The client gets one answer
+ * with every target's verdict once the last is in. A client has one
+ * TBATCH at the hardware at a time; it counts once against its window.
+ *
+ * A timed message (MSG_TIME, see msg.h) is answered with the client's
+ * send time and when the server read it, wrote it to the hardware and
+ * read the hardware's answer, so that its latency can be split by hop.
+ *
+ * -m port (on 127.0.0.1) or -m path (a Unix socket) serves the server
+ * and fifo counters to Prometheus (see metrics.h).
+ * 
 */
 
 #include <stdio.h>		/* printf */
@@ -8,194 +95,1708 @@
 #include <string.h>		/* memset */
 #include <arpa/inet.h>		/* htons & inet_addr */
 #include <sys/socket.h>		/* socket calls */
+#include <sys/epoll.h>		/* epoll_create1, epoll_wait */
+#include <sys/timerfd.h>		/* periodic hwpoll report */
+#include <sys/un.h>		/* sockaddr_un */
+#include <netinet/tcp.h>	/* TCP_NODELAY */
 #include <unistd.h>		/* close */
 #include <errno.h>
+#include <signal.h>
 #include <sys/types.h>					/* open */
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>		/* clock_gettime */
 #include "hw.h"
 #include "defs.h"
-#include "msg.c"
+#include "msg.h"
+#include "seqwin.h"
+#include "zones.h"
+#include "capture.h"
+#include "hwpoll.h"
+#include "metrics.h"
+#include "dedup.h"
+#include "subs.h"
+#include "uring.h"
+#include "handoff.h"
+#include "pool.h"
 
 /* largest message to send to hardware */
 #define MAXBUF  1500
-#define RSIZE   2
-#define TSIZE   10
-#define A_ESIZE 16
-#define TARGET  0x30
-#define AOZ     0x10
-#define EZ      0x20
+#define MAXCONN 1024                    /* largest client descriptor */
+#define MAXEV   64                      /* events per epoll_wait */
+#define DEVWIN  16                      /* default device window */
+#define CLIWIN  4                       /* default per-client window */
+#define PACKETS 16                      /* Unix packets read per wakeup */
+#define REPORT  10                      /* seconds between hwpoll reports */
+#define DEDUPSLOTS 4096                 /* recent target verdicts kept (-d) */
+#define UNCHECKED 1                     /* no zone check made yet: checkTables() never returns 1 */
+#define EV_LISTEN (-1)                  /* epoll data for descriptors that are not clients */
+#define EV_HWPOLL (-2)
+#define EV_REPORT (-3)
+#define EV_EXPIRE (-4)
+#define EV_UDP (-5)
+#define EV_UNIX (-6)
+#define EV_HANDOFF (-7)
+#define EV_SUBS (-8)                    /* and below: observers */
+#define UDPBATCH 64                     /* datagrams per recvmmsg and sendmmsg */
+#define UDPQUEUE 1024                   /* datagrams waiting for room at the device */
+#define HWPOLLS 64                      /* empty hardware polls before looking at the clients again */
+#define UDPPEERS 1024                   /* UDP senders followed for msgid gaps */
+#define PEND_UDP (-1)                   /* pend_t fd of a request from a datagram */
+#define PENDKEYS 1024                   /* chains of targets at the device, by key (-d) */
+#define COPIES 4096                     /* most copies waiting on targets at the device */
+#define URENTRIES 256                   /* io_uring submission slots (-I) */
+#define URBUFS 256                      /* and provided receive buffers */
+#define UR_ACCEPT 1                     /* low bits of a request's user_data; the rest is its conn_t */
+#define UR_RECV 2
+#define UR_SEND 3
+#define UR_CANCEL 4
+#define UR_EPOLL 5
+#define UR_DATA(c,op) ((uint64_t)(uintptr_t)(c) | (op))
+
+#define HWWORDS ((A_ESIZE_X+3)/4)      /* fifo words of the longest request */
+#define HANDOFF_WAIT 5000               /* ms to wait for the hardware before handing off anyway */
+#define TBGRAIN 16                      /* targets per chunk of a TBATCH zone check */
+
+#define SYS(call) (METRIC_INC(syscalls),(call))    /* count a system call of the event loop */
 
 static uint8_t msgbuf[MAXBUF];			/* a message buffer */
+static uint8_t rspbuf[MAXBUF];			/* a hardware response */
 
-static uint8_t AOZtable[MAXBUF][4];         /* table of AOZ */
+typedef struct batch {                  /* a TBATCH at the hardware */
+    uint8_t type;                       /* the client's, for the format of the answer */
+    uint32_t msgid;
+    int count;                          /* targets */
+    int next;                           /* the next to send */
+    int left;                           /* verdicts still to come from the hardware */
+    uint64_t stamp;                     /* when it was read, us */
+    uint8_t ok[TBATCH_MAX];             /* passed the zone check, for the hardware to judge */
+    uint8_t verdict[TBATCH_MAX];
+    uint8_t rec[TBATCH_MAX*TREC];       /* the target records */
+} batch_t;
 
-static uint8_t EZtable[MAXBUF][4];         /* table of EZ */
+typedef struct conn {                   /* a client connection */
+    int fd;
+    uint32_t gen;                       /* distinguishes reuse of fd */
+    uint32_t inflight;                  /* requests at the hardware */
+    int eof;                            /* no more messages will arrive */
+    int waiting;                        /* on the wait queue for a window */
+    int packet;                         /* SOCK_SEQPACKET: a message per recv */
+    int ring;                           /* I/O through the io_uring (-I) */
+    int armed;                          /* a multishot recv is outstanding */
+    int cancelling;                     /* and has been asked to stop */
+    int closed;                         /* freed once its ops have completed */
+    int ops;                            /* io_uring requests outstanding */
+    size_t sending;                     /* bytes of wbuf a send has taken */
+    uint32_t events;                    /* current epoll interest */
+    size_t rlen;                        /* bytes in rbuf */
+    size_t rcap;                        /* and its size */
+    size_t wlen;                        /* bytes in wbuf */
+    size_t owed;                        /* and kept there for answers still to come */
+    uint64_t stamp;                     /* when the message at the head of rbuf was read, us */
+    uint64_t stamp2;                    /* and the bytes from split on */
+    size_t split;                       /* 0 if all of rbuf is as old as stamp */
+    batch_t *batch;                     /* its TBATCH at the hardware, if any */
+    uint8_t *rbuf;                      /* partial and unprocessed messages */
+    uint8_t wbuf[MAXBUF];               /* responses not yet sent */
+    uint8_t rbuf0[MAXBUF];              /* rbuf until a bulk message needs more */
+} conn_t;
 
-static int AOZ_index;
-static int EZ_index;
+typedef struct pend {                   /* a request at the hardware */
+    int fd;                             /* connection that sent it */
+    uint32_t gen;
+    uint32_t msgid;                     /* the client's msgid */
+    uint8_t type;                       /* the client's message type */
+    uint64_t key;                       /* of a target, for dedup */
+    uint64_t sent;                      /* when it went to the device, us */
+    uint64_t read;                      /* when the message was read, us */
+    uint64_t tclient;                   /* the client's send time, if timed */
+    uint32_t words;                     /* fifo words it took */
+    struct sockaddr_in peer;            /* sender of a datagram */
+    batch_t *batch;                     /* of a TBATCH target; msgid is its place there */
+    struct pend *same;                  /* next target at the device on its key's chain (-d) */
+    struct pend *copies;                /* identical targets answered with its verdict */
+    struct pend *next;                  /* free list, or the next copy */
+} pend_t;
 
+static conn_t *conns[MAXCONN];
+static uint32_t conngen;
+static int waitq[MAXCONN];              /* connections blocked on a window */
+static int waithead,waitlen;
+static int epfd;
+static int fdout,fdin;
 
+static seqwin_t devwin;                 /* requests in flight at the device */
+static pend_t *pends;                   /* one per device window slot */
+static pend_t *freepend;
+static pend_t *pendkeys[PENDKEYS];      /* targets at the device, by key (-d) */
+static pend_t *freecopy;                /* spare pend_ts for copies */
+static int ncopies;                     /* and how many are waiting */
+static int xdev;                        /* device uses extended msgids */
+static uint32_t fifodepth;              /* transmit fifo words; 0 if the driver does not say */
+static uint32_t fifowords;              /* words of the requests in flight */
+static uint32_t cliwin = CLIWIN;
+static int verbose = 1;                 /* print every message (-q turns off) */
+static volatile sig_atomic_t stop;      /* SIGINT or SIGTERM received */
+static int pollcpu = -1;                /* core of the polling thread (-P) */
+static int uring;                       /* clients on the io_uring (-I) */
+static int epready = 1;                 /* and epoll may have events */
+static int accepting;                   /* and its accept is armed */
+static char *hopath;                    /* -H: where a successor finds us */
+static int hosock = -1;                 /* listening there */
+static int hoconn = -1;                 /* the successor, once it has come: take no more messages */
+static uint32_t hodeadline;             /* when to stop waiting for the hardware */
+static dedup_t dedup;                   /* recent target verdicts (-d) */
+static uint32_t dedupms;                /* and how long they last; 0 for off */
+static uint64_t deadline;               /* -D, in us; 0 for none */
+static uint32_t hwrtt;                  /* device round trip, us, averaged */
+static int poolthreads;                 /* -T: threads helping check a TBATCH */
 
-/* If message AOZ, add to AOZ table
-   if message EZ, add to EZ table
-   if message Target, check that it's wihtin 
-   AOZ and outside of EZ
-   Output:
-   if AOZ, return 2
-   if EZ, return 2
-   if valid Target, return 0
-   else -1
-*/
-int checkTables(int size){
-    int ret = 0;
-    int in_aoz = 1;                 /* assumes that no aoz contains target */
-    int out_ez = 0;                 /* assumes that all ez dont contain target */
-    if (size == A_ESIZE){
-        /* add aoz to table */
-        uint8_t  first_long[4];
-        uint8_t  first_lat[3];
-        uint8_t  second_long[4];
-        uint8_t  second_lat[3];
-        if (msgbuf[0]==AOZ || msgbuf[0]==EZ) {
-            /* get first long coord */
-            first_long[0] = msgbuf[1];
-            first_long[1] = msgbuf[2];
-            first_long[2] = msgbuf[3];
-            first_long[3] = msgbuf[4];
+typedef struct peer {                   /* a UDP sender and the msgid it should send next */
+    uint32_t addr;
+    uint16_t port;
+    uint8_t used;
+    uint32_t next;
+} peer_t;
+
+static int udpsock = -1;                /* -u */
+static uint32_t udpgen;                 /* connection number datagrams are captured under */
+static peer_t peers[UDPPEERS];
+static uint8_t udpin[UDPBATCH][MAXBUF];
+static struct sockaddr_in udpfrom[UDPBATCH];
+static _Alignas(struct cmsghdr) char udpctl[UDPBATCH][CMSG_SPACE(sizeof(struct timespec))+CMSG_SPACE(sizeof(uint32_t))];  /* receive times, overflows */
+static uint8_t udpout[UDPBATCH][RSIZE_T];   /* responses waiting for sendmmsg() */
+static struct sockaddr_in udpto[UDPBATCH];
+static struct iovec outiov[UDPBATCH];
+static struct mmsghdr outmsg[UDPBATCH];
+static int nout;
+
+typedef struct udpwait {                /* a datagram waiting for room at the device */
+    uint8_t msg[A_ESIZE_T];
+    int len;
+    uint64_t stamp;                     /* when the kernel received it */
+    struct sockaddr_in from;
+} udpwait_t;
+
+static udpwait_t udpq[UDPQUEUE];
+static int udpqhead,udpqlen;
+
+
+static void conn_update(conn_t *c);
+static void conn_process(conn_t *c);
+static void conn_watch(conn_t *c);
+static void wake_waiters(void);
+static void conn_reply(conn_t *c,uint8_t type,uint32_t msgid,uint8_t status,const uint64_t *ts);
+static void udp_reply(const struct sockaddr_in *to,uint8_t type,uint32_t msgid,uint8_t status,const uint64_t *ts);
+static void udp_queue(const struct sockaddr_in *to,const uint8_t *rsp,int rlen);
+static int conn_grow(conn_t *c,size_t size);
+
+static void conn_free(conn_t *c) {
+    if (c->rbuf != c->rbuf0) free(c->rbuf);
+    free(c);
+}
+
+/* a ring client is freed only once the kernel is done with it */
+static void conn_close(conn_t *c) {
+    cap_write(c->gen,CAP_CLOSE,NULL,0);
+    if (c->ring) SYS(shutdown(c->fd,SHUT_RDWR));    /* ends its recv */
+    else SYS(epoll_ctl(epfd,EPOLL_CTL_DEL,c->fd,NULL));
+    SYS(close(c->fd));
+    conns[c->fd] = NULL;
+    METRIC_DEC(open);
+    c->closed = 1;
+    if (c->ops == 0) conn_free(c);
+}
+
+/* set up a client on an accepted descriptor; NULL if it had to be closed */
+static conn_t *conn_new(int fd,int packet) {
+    int one = 1;
+    conn_t *c;
+
+    if (fd >= MAXCONN || (c = calloc(1,sizeof(conn_t))) == NULL){
+        fprintf(stderr,"SERVER: too many connections\n");
+        SYS(close(fd));
+        return NULL;
+    }
+    c->fd = fd;
+    c->rbuf = c->rbuf0;
+    c->rcap = MAXBUF;
+    if (!packet) SYS(setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one)));   /* responses are tiny */
+    else if (conn_grow(c,BULK_MAX) < 0){    /* room for the longest packet */
+        fprintf(stderr,"SERVER: out of memory\n");
+        SYS(close(fd));
+        free(c);
+        return NULL;
+    }
+    c->packet = packet;
+    c->gen = ++conngen;
+    conns[fd] = c;
+    uint8_t how = packet ? CAP_UNIX : CAP_TCP;
+    cap_write(c->gen,CAP_OPEN,&how,1);
+    METRIC_INC(accepted);
+    METRIC_INC(open);
+    return c;
+}
+
+/* start serving a client, on the ring or on epoll */
+static void conn_watch(conn_t *c) {
+    if (uring && !c->packet) c->ring = 1;
+    else {
+        struct epoll_event ev = { .events = EPOLLIN, .data.fd = c->fd };
+        c->events = EPOLLIN;
+        if (SYS(epoll_ctl(epfd,EPOLL_CTL_ADD,c->fd,&ev)) < 0){
+            errorExit("SERVER: Error calling epoll_ctl\n");
+        }
+    }
+    conn_process(c);                    /* a client taken over may have sent already */
+}
+
+static void conn_accept(int sock,int packet) {
+    int fd;
+    conn_t *c;
+
+    while ((fd = SYS(accept4(sock,NULL,NULL,SOCK_NONBLOCK))) >= 0){
+        if ((c = conn_new(fd,packet)) != NULL) conn_watch(c);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK){
+        errorExit("SERVER: Error calling accept\n");
+    }
+}
+
+/* room in rbuf for more: a packet is only read into an empty rbuf, so it cannot be cut short */
+static int conn_room(conn_t *c) {
+    return c->packet ? c->rlen == 0 : c->rlen < c->rcap;
+}
+
+/*
+ * read while the client has nothing unsent, even with its window full:
+ * the window holds back what goes to the hardware, not what the server
+ * answers itself, such as an invalid target
+ */
+static int conn_readable(conn_t *c) {
+    return !c->eof && hoconn < 0 && !c->waiting && c->wlen == 0 && conn_room(c);
+}
+
+/*
+ * a ring client's recv stays armed until rbuf holds MAXBUF, or the
+ * whole of a longer message; past that the client waits, as an epoll
+ * client does when it is not readable
+ */
+static int ring_wants(conn_t *c) {
+    int size = c->rlen ? msgsize(c->rbuf,c->rlen) : 0;
+
+    return !c->eof && hoconn < 0 && !c->waiting && (c->rlen < MAXBUF || (size > 0 && c->rlen < (size_t)size));
+}
+
+static void ring_update(conn_t *c) {
+    if (ring_wants(c)){
+        if (c->armed) return;
+        if (ur_recv(c->fd,UR_DATA(c,UR_RECV)) < 0){
+            errorExit("SERVER: Error queueing on the io_uring\n");
+        }
+        c->armed = 1;
+        c->ops++;
+    }
+    else if (c->armed && !c->cancelling){
+        if (ur_cancel(UR_DATA(c,UR_RECV),UR_DATA(NULL,UR_CANCEL)) < 0){
+            errorExit("SERVER: Error queueing on the io_uring\n");
+        }
+        c->cancelling = 1;
+    }
+}
+
+static void conn_update(conn_t *c) {
+    uint32_t events = (conn_readable(c) ? EPOLLIN : 0) | (c->wlen ? EPOLLOUT : 0);
+
+    if (c->eof && c->inflight == 0 && c->wlen == 0 && c->rlen == 0){
+        conn_close(c);
+        return;
+    }
+    if (c->ring){
+        ring_update(c);
+        return;
+    }
+    if (events != c->events){
+        struct epoll_event ev = { .events = events, .data.fd = c->fd };
+        SYS(epoll_ctl(epfd,EPOLL_CTL_MOD,c->fd,&ev));
+        c->events = events;
+    }
+}
+
+static void conn_flush(conn_t *c) {
+    ssize_t nsent;
+
+    if (c->wlen == 0) return;
+    if (c->ring){                       /* one send at a time; responses made meanwhile go next */
+        if (c->sending) return;
+        if (ur_send(c->fd,c->wbuf,c->wlen,UR_DATA(c,UR_SEND)) < 0){
+            errorExit("SERVER: Error queueing on the io_uring\n");
+        }
+        c->sending = c->wlen;
+        c->ops++;
+        return;
+    }
+    if ((nsent = SYS(send(c->fd,(void*)c->wbuf,c->wlen,MSG_NOSIGNAL))) < 0){
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+        c->wlen = 0;                    /* client has gone away */
+        c->rlen = 0;
+        c->eof = 1;
+        return;
+    }
+    memmove(c->wbuf,c->wbuf+nsent,c->wlen-nsent);
+    c->wlen -= nsent;
+}
+
+/* microseconds on the monotonic clock: how long messages wait */
+static uint64_t now_us(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000ull + ts.tv_nsec/1000;
+}
+
+/*
+ * the times for the answer to a message of type type, if it is timed:
+ * the client's, then when it was read, sent to the hardware and
+ * answered there, on the now_us() clock or 0 for never, as the
+ * client's clock would have them
+ *
+ * returns: ts; NULL if the message is not timed.
+ */
+static const uint64_t *rsp_times(uint64_t *ts,uint8_t type,uint64_t client,uint64_t read,uint64_t sent,uint64_t done) {
+    struct timespec real;
+    uint64_t off;
+
+    if (!(type & MSG_TIME)) return NULL;
+    clock_gettime(CLOCK_REALTIME,&real);
+    off = real.tv_sec*1000000000ull + real.tv_nsec - now_us()*1000;    /* realtime less monotonic, ns */
+    ts[0] = client;
+    ts[1] = read ? read*1000+off : 0;
+    ts[2] = sent ? sent*1000+off : 0;
+    ts[3] = done ? done*1000+off : 0;
+    return ts;
+}
+
+/* as rsp_times(), for a message of size bytes at bp read at read and answered without the hardware */
+static const uint64_t *msg_times(uint64_t *ts,const uint8_t *bp,int size,uint64_t read) {
+    return rsp_times(ts,bp[0],msgtime_get(bp,size),read,0,0);
+}
+
+/* note the time bytes were added to an rbuf that held had bytes */
+static void conn_stamp(conn_t *c,size_t had,uint64_t now) {
+    if (had == 0){
+        c->stamp = now;
+        c->split = 0;
+    }
+    else if (c->split == 0){            /* later reads count as this one: a little old, never young */
+        c->stamp2 = now;
+        c->split = had;
+    }
+}
+
+/* remove the message of size bytes at the head of rbuf */
+static void conn_consume(conn_t *c,size_t size) {
+    c->rlen -= size;
+    memmove(c->rbuf,c->rbuf+size,c->rlen);
+    if (c->split > size) c->split -= size;
+    else if (c->split){                 /* the next message is one of the newer bytes */
+        c->stamp = c->stamp2;
+        c->split = 0;
+    }
+}
+
+/* one recv(); returns 1 if it took a message or bytes, 0 if there was nothing to take */
+static int conn_recv1(conn_t *c) {
+    ssize_t nrecv;
+
+    if (c->eof || !conn_room(c)){       /* nothing more we can take yet */
+        conn_process(c);
+        return 0;
+    }
+    if ((nrecv = SYS(recv(c->fd,(void*)(c->rbuf+c->rlen),c->rcap-c->rlen,c->packet ? MSG_TRUNC : 0))) < 0){
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+        nrecv = 0;                      /* treat a reset like a close */
+    }
+    if (c->packet && nrecv > 0 && ((size_t)nrecv > c->rcap || msgsize(c->rbuf,nrecv) != nrecv)){
+        METRIC_INC(badpacket);          /* not one whole message: skip it, the next is intact */
+        return 1;
+    }
+    if (nrecv == 0)
+        c->eof = 1;                     /* answer what was already sent */
+    else conn_stamp(c,c->rlen,now_us());
+    c->rlen += nrecv;
+    conn_process(c);
+    return nrecv > 0;
+}
+
+/* a stream takes all it can in one recv(); packets come one at a time */
+static void conn_recv(conn_t *c) {
+    int fd = c->fd, i;
+
+    for (i = 1; conn_recv1(c) && i < PACKETS; i++)
+        if (conns[fd] != c || !c->packet || !conn_readable(c)) break;   /* closed, or no room */
+}
+
+/* remember a connection that has messages but no window to send them; it is not read from until it has */
+static void conn_wait(conn_t *c) {
+    if (c->waiting || waitlen == MAXCONN) return;
+    METRIC_INC(creditwaits);
+    c->waiting = 1;
+    waitq[(waithead+waitlen++)%MAXCONN] = c->fd;
+}
+
+/* fifo words of a request of len bytes */
+static uint32_t hw_words(int len) {
+    return (len+3)/4;
+}
+
+/* room at the device for another request of words fifo words */
+static int dev_room(uint32_t words) {
+    return !seqwin_full(&devwin) && (fifodepth == 0 || fifowords + words <= fifodepth);
+}
+
+/* requests of any kind the device has room for now */
+static uint32_t dev_free(void) {
+    uint32_t n = devwin.size - devwin.inflight;
+
+    if (fifodepth != 0 && (fifodepth - fifowords)/HWWORDS < n) n = (fifodepth - fifowords)/HWWORDS;
+    return n;
+}
+
+/* publish the device occupancy */
+static void dev_count(void) {
+    METRIC_SET(inflight,devwin.inflight);
+    METRIC_SET(fifowords,fifowords);
+    if (devwin.inflight > atomic_load_explicit(&metrics.inflightmax,memory_order_relaxed))
+        METRIC_SET(inflightmax,devwin.inflight);
+}
+
+/* milliseconds on a coarse clock: enough for a dedup window */
+static uint32_t now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+    return ts.tv_sec*1000u + ts.tv_nsec/1000000;
+}
+
+/*
+ * note who sent a client message, read at stamp, for its answer: a
+ * datagram if c is NULL, or one of c's batch b if b is not, with its
+ * place there as its msgid
+ */
+static void pend_fill(pend_t *p,conn_t *c,const struct sockaddr_in *peer,batch_t *b,const uint8_t *bp,int len,uint64_t stamp) {
+    if (c != NULL){
+        p->fd = c->fd;
+        p->gen = c->gen;
+        if (b == NULL){                 /* a batch counts once */
+            c->inflight++;
+            c->owed += rsplen(bp[0]);
+        }
+    }
+    else {
+        p->fd = PEND_UDP;
+        p->gen = udpgen;
+        p->peer = *peer;
+    }
+    p->msgid = msgid_get(bp,len);
+    p->type = bp[0];
+    p->batch = b;
+    p->key = dedup_key(bp);
+    p->read = stamp;
+    p->tclient = msgtime_get(bp,len);
+    p->copies = NULL;
+}
+
+/* the chain of targets at the device a key would be on */
+static pend_t **pend_chain(uint64_t key) {
+    return &pendkeys[((key * 11400714819323198485ull) >> 32) % PENDKEYS];
+}
+
+/* take a target off its key's chain: it is no longer at the device */
+static void pend_unkey(pend_t *p) {
+    pend_t **pp;
+
+    if (!dedupms || MSG_TYPE(p->type) != TARGET) return;
+    for (pp = pend_chain(p->key); *pp != NULL && *pp != p; pp = &(*pp)->same)
+        ;
+    if (*pp != NULL) *pp = p->same;
+}
+
+/*
+ * attach a target to an identical one already at the device (-d), to
+ * be answered with its verdict instead of asking the hardware again;
+ * sent by c or from peer as for pend_fill()
+ *
+ * returns: 1 if attached; 0 to send it to the hardware.
+ */
+static int pend_attach(conn_t *c,const struct sockaddr_in *peer,batch_t *b,const uint8_t *bp,int len,uint64_t stamp) {
+    uint64_t key;
+    pend_t *o, *p;
+
+    if (!dedupms || MSG_TYPE(bp[0]) != TARGET || ncopies == COPIES) return 0;
+    key = dedup_key(bp);
+    for (o = *pend_chain(key); o != NULL && o->key != key; o = o->same)
+        ;
+    if (o == NULL) return 0;
+    if ((p = freecopy) != NULL) freecopy = p->next;
+    else if ((p = malloc(sizeof(pend_t))) == NULL) return 0;
+    pend_fill(p,c,peer,b,bp,len,stamp);
+    p->sent = 0;                        /* never went to the device */
+    p->words = 0;
+    p->next = o->copies;                /* newest first */
+    o->copies = p;
+    ncopies++;
+    METRIC_INC(dupes);
+    return 1;
+}
+
+/*
+ * answer a request with status, the hardware's at done or BUSY; a
+ * TBATCH target is answered with the rest of its batch. Nothing of p
+ * is read after it returns.
+ *
+ * returns: its client, to process; NULL if none.
+ */
+static conn_t *pend_answer(pend_t *p,uint8_t status,uint64_t done) {
+    uint64_t ts[4];
+    uint8_t rsp[RSIZE_T];
+    conn_t *c;
+    int rlen;
+
+    if (p->batch != NULL){
+        p->batch->verdict[p->msgid] = status;
+        p->batch->left--;
+    }
+    else {
+        rlen = rspmake(rsp,p->type,status,p->msgid,rsp_times(ts,p->type,p->tclient,p->read,p->sent,done));
+        cap_write(p->gen,CAP_RSP,rsp,rlen);
+        if (p->fd == PEND_UDP){
+            udp_queue(&p->peer,rsp,rlen);   /* sent with the rest of this pass's */
+            METRIC_INC(rsps[METRIC_TYPE(p->type)]);
+            return NULL;
+        }
+    }
+    if ((c = conns[p->fd]) == NULL || c->gen != p->gen){
+        METRIC_INC(gone);
+        return NULL;
+    }
+    if (p->batch != NULL) return c;
+    memcpy(c->wbuf+c->wlen,rsp,rlen);
+    c->wlen += rlen;
+    c->inflight--;
+    c->owed -= rlen;
+    METRIC_INC(rsps[METRIC_TYPE(p->type)]);
+    return c;
+}
+
+/* answer the copies attached to a request as it was answered, in the order they came, and free them */
+static void pend_copies(pend_t *q,uint8_t status,uint64_t done) {
+    pend_t *next, *old = NULL;
+    conn_t *c;
+
+    for (; q != NULL; q = next){        /* oldest first */
+        next = q->next;
+        q->next = old;
+        old = q;
+    }
+    for (q = old; q != NULL; q = next){
+        next = q->next;
+        c = pend_answer(q,status,done);
+        q->next = freecopy;
+        freecopy = q;
+        ncopies--;
+        if (c != NULL) conn_process(c);
+    }
+}
+
+/* release a request the hardware would not take, answering it and its copies BUSY; returns its client */
+static conn_t *hw_refused(uint8_t *bp,int len) {
+    pend_t *p, *copies;
+    conn_t *c;
+
+    if ((p = seqwin_ack(&devwin,msgid_get(bp,len))) == NULL) return NULL;
+    METRIC_INC(refused);
+    fifowords -= p->words;
+    dev_count();
+    pend_unkey(p);
+    copies = p->copies;
+    p->sent = 0;                        /* it was not taken */
+    p->next = freepend;
+    freepend = p;
+    c = pend_answer(p,BUSY,0);
+    pend_copies(copies,BUSY,0);         /* none yet if refused as it was written */
+    return c;
+}
+
+/*
+ * send one client message, read at stamp, to the hardware under a
+ * device sequence number; sent by c or from peer as for pend_fill()
+ */
+static void hw_submit(conn_t *c,const struct sockaddr_in *peer,batch_t *b,uint8_t *bp,int len,uint64_t stamp) {
+    uint8_t type = bp[0];
+    int body = msgbody(bp,len);         /* bytes before the send time and msgid */
+    int hwlen = xdev ? body+4 : body+1;
+    pend_t *p = freepend, **pp;
+
+    freepend = p->next;
+    pend_fill(p,c,peer,b,bp,len,stamp);
+    p->sent = now_us();
+    p->words = hw_words(hwlen);
+    fifowords += p->words;
+    metrics_delay(p->sent > stamp ? p->sent-stamp : 0);
+    if (dedupms && MSG_TYPE(type) == TARGET){  /* for copies to find */
+        pp = pend_chain(p->key);
+        p->same = *pp;
+        *pp = p;
+    }
+
+    memcpy(msgbuf,bp,body);
+    msgbuf[0] = xdev ? (MSG_TYPE(type) | MSG_EXT) : MSG_TYPE(type);
+    msgid_set(msgbuf,hwlen,seqwin_open(&devwin,p));
+    dev_count();
+    if (verbose) msgprint("send hw",msgbuf,hwlen);
+
+    if ((pollcpu >= 0 ? hwpoll_submit(msgbuf,hwlen) : hwwrite(fdout,(void*)msgbuf,hwlen)) < 0)
+        hw_refused(msgbuf,hwlen);
+}
+
+/* make room in rbuf for a message of size bytes */
+static int conn_grow(conn_t *c,size_t size) {
+    uint8_t *p = realloc(c->rbuf == c->rbuf0 ? NULL : c->rbuf,size);
+
+    if (p == NULL) return -1;
+    if (c->rbuf == c->rbuf0) memcpy(p,c->rbuf0,c->rlen);
+    c->rbuf = p;
+    c->rcap = size;
+    return 0;
+}
+
+/* messages the server answers itself: the hardware knows only single box zones */
+static int srv_local(uint8_t type) {
+    return MSG_SHAPE(type) || MSG_TYPE(type) == BULK || MSG_TYPE(type) == ZDEL || MSG_TYPE(type) == ZTTL ||
+        MSG_TYPE(type) == CREDIT;
+}
+
+/* fifo words a client message of size bytes would take; 0 if it never goes to the hardware */
+static uint32_t msg_words(const uint8_t *bp,int size) {
+    if (srv_local(bp[0])) return 0;
+    return hw_words(msgbody(bp,size) + (xdev ? 4 : 1));
+}
+
+/* a client's credit: what it may send now without waiting, beyond inflight at the device and queued at the server */
+static uint8_t msg_credit(uint32_t inflight,uint32_t queued) {
+    uint32_t own = cliwin > inflight+queued ? cliwin-inflight-queued : 0;
+    uint32_t dev = dev_free(), n;
+
+    dev = dev > (uint32_t)waitlen ? dev-waitlen : 0;   /* after the clients already waiting */
+    n = own < dev ? own : dev;
+    return n > 255 ? 255 : n;
+}
+
+/* complete messages in a client's rbuf after the first skip bytes */
+static uint32_t conn_queued(conn_t *c,size_t skip) {
+    uint32_t n = 0;
+    int size;
+
+    while (skip < c->rlen && (size = msgsize(c->rbuf+skip,c->rlen-skip)) > 0 && skip+size <= c->rlen){
+        skip += size;
+        n++;
+    }
+    return n;
+}
+
+/* answer a client directly, without the hardware */
+static void conn_reply(conn_t *c,uint8_t type,uint32_t msgid,uint8_t status,const uint64_t *ts) {
+    uint8_t *rsp = c->wbuf+c->wlen;
+    int rlen = rspmake(rsp,type,status,msgid,ts);
+
+    cap_write(c->gen,CAP_RSP,rsp,rlen);
+    c->wlen += rlen;
+    METRIC_INC(rsps[METRIC_TYPE(type)]);
+}
+
+/* answer a client's TBATCH with a verdict per target, or BUSY for all if verdict is NULL */
+static void conn_frame(conn_t *c,uint8_t type,uint32_t msgid,int count,const uint8_t *verdict) {
+    uint8_t *rsp = c->wbuf+c->wlen;
+    int rlen = rspbatch(rsp,type,msgid,count,verdict);
+
+    cap_write(c->gen,CAP_RSP,rsp,rlen);
+    c->wlen += rlen;
+    METRIC_INC(rsps[METRIC_TYPE(type)]);
+}
+
+/* answer a client message BUSY: it was not acted on */
+static void conn_busy(conn_t *c,const uint8_t *bp,int size) {
+    uint64_t ts[4];
+
+    if (MSG_TYPE(bp[0]) == TBATCH) conn_frame(c,bp[0],msgid_get(bp,size),bp[3] | bp[4]<<8,NULL);
+    else conn_reply(c,bp[0],msgid_get(bp,size),BUSY,msg_times(ts,bp,size,c->stamp));
+}
+
+/* capture and count a client message */
+static void msg_count(uint32_t gen,uint8_t *bp,int size) {
+    cap_write(gen,CAP_MSG,bp,size);
+    METRIC_INC(msgs[METRIC_TYPE(bp[0])]);
+}
+
+/*
+ * a target's zone check, made before anything else so that a target
+ * outside every AOZ or inside an EZ is answered at once, whatever the
+ * windows; UNCHECKED for other messages, whose check has effects
+ */
+static int msg_zones(const uint8_t *bp,int size) {
+    return MSG_TYPE(bp[0]) == TARGET ? checkTables(bp,msgbody(bp,size)+1) : UNCHECKED;
+}
+
+/*
+ * check a client message against the zones and the recent verdicts;
+ * ret is its zone check from msg_zones(), made only once
+ *
+ * returns: 1 to answer it here with *status; 0 to send it to the
+ * hardware.
+ */
+static int msg_check(uint32_t gen,uint8_t *bp,int size,int ret,uint8_t *status) {
+    msg_count(gen,bp,size);
+    if (MSG_TYPE(bp[0]) == BULK) ret = zones_bulk(bp,size);
+    else if (ret == UNCHECKED) ret = checkTables(bp,msgbody(bp,size)+1);  /* as the legacy message */
+    if (srv_local(bp[0]) || (ret < 0 && MSG_TYPE(bp[0]) != TARGET)){   /* incl. a zone with no room */
+        *status = ret == 2 ? ACK : NAK;
+        return 1;
+    }
+    if (ret < 0){                       /* an invalid target: NAK, without the hardware */
+        METRIC_INC(badtarget);
+        *status = NAK;
+        return 1;
+    }
+    if (dedupms && MSG_TYPE(bp[0]) == TARGET && dedup_get(&dedup,dedup_key(bp),now_ms(),status)){
+        METRIC_INC(dupes);              /* a resend: same verdict */
+        return 1;
+    }
+    return 0;
+}
+
+/* count a message read at stamp as shed if it would miss the deadline; 1 if so */
+static int msg_late(uint64_t stamp) {
+    uint64_t now = now_us(), wait, ahead;
+
+    wait = now > stamp ? now-stamp : 0;
+    ahead = devwin.inflight == 0 ? 0 : (uint64_t)hwrtt*(seqwin_full(&devwin) ? 2 : 1);
+    if (wait + ahead <= deadline) return 0;
+    METRIC_INC(shed);
+    metrics_delay(wait);
+    return 1;
+}
+
+/*
+ * shed a message for the hardware, read at stamp, that could no longer
+ * be answered within the deadline: it would wait a round trip at the
+ * device, and another for a place there if the window is full. An idle
+ * device takes it whatever the last round trips were, so the estimate
+ * cannot stay stale with nothing being sent.
+ *
+ * returns: 1 if it was shed, to be answered BUSY; 0 to handle it.
+ */
+static int msg_shed(uint32_t gen,uint8_t *bp,int size,uint64_t stamp) {
+    if (deadline == 0 || srv_local(bp[0]) || !msg_late(stamp)) return 0;
+    msg_count(gen,bp,size);
+    return 1;
+}
+
+/* check a share of a batch's targets against the zones, on any of the pool's threads */
+static void batch_check(void *arg,int lo,int hi) {
+    batch_t *b = arg;
+    int i;
+
+    for (i = lo; i < hi; i++){
+        uint8_t *rec = b->rec + i*TREC;
+        b->ok[i] = rec[0] == TARGET && checkTables(rec,TSIZE) == 0;
+    }
+}
+
+/* take on a client's TBATCH of size bytes, answering at once the targets that fail the zone check or were judged just now; -1 if out of memory */
+static int batch_start(conn_t *c,const uint8_t *bp,int size) {
+    uint32_t now = dedupms ? now_ms() : 0;
+    batch_t *b;
+    int i;
+
+    if ((b = malloc(sizeof(batch_t))) == NULL) return -1;
+    b->type = bp[0];
+    b->msgid = msgid_get(bp,size);
+    b->count = bp[3] | bp[4]<<8;
+    b->next = 0;
+    b->left = 0;
+    b->stamp = c->stamp;
+    memcpy(b->rec,bp+BULK_HDR,b->count*TREC);
+    METRIC_ADD(batched,b->count);
+    pool_run(batch_check,b,b->count,TBGRAIN);     /* the zones do not change meanwhile */
+    if (poolthreads) METRIC_SET(steals,pool_steals());
+    for (i = 0; i < b->count; i++){
+        if (!b->ok[i]){
+            METRIC_INC(badtarget);
+            b->verdict[i] = NAK;
+        }
+        else if (dedupms && dedup_get(&dedup,dedup_key(b->rec+i*TREC),now,&b->verdict[i])){
+            METRIC_INC(dupes);
+            b->ok[i] = 0;
+        }
+        else b->left++;
+    }
+    c->batch = b;
+    c->inflight++;                      /* answered as one */
+    c->owed += TBATCH_RSPMAX;
+    return 0;
+}
 
-            /* get first lat coord */
-            first_lat[0] = msgbuf[5];
-            first_lat[1] = msgbuf[6];
-            first_lat[2] = msgbuf[7];
+/*
+ * send a client's batch on to the hardware, back to back, as far as
+ * the device has room, and answer it once every verdict is in
+ *
+ * returns: 1 while it has targets left to send; 0 once it has none.
+ */
+static int batch_run(conn_t *c) {
+    batch_t *b = c->batch;
+    uint8_t msg[TSIZE];
 
-            /* get second long coord */
-            second_long[0] = msgbuf[8];
-            second_long[1] = msgbuf[9];
-            second_long[2] = msgbuf[10];
-            second_long[3] = msgbuf[11];
+    for (; b->next < b->count; b->next++){
+        if (!b->ok[b->next]) continue;
+        memcpy(msg,b->rec+b->next*TREC,TREC);
+        msg[TREC] = b->next;
+        if (pend_attach(c,NULL,b,msg,TSIZE,b->stamp)) continue;
+        if (!dev_room(hw_words(xdev ? TSIZE_X : TSIZE))){
+            conn_wait(c);
+            return 1;
+        }
+        hw_submit(c,NULL,b,msg,TSIZE,b->stamp);
+    }
+    if (b->left == 0){
+        conn_frame(c,b->type,b->msgid,b->count,b->verdict);
+        c->inflight--;
+        c->owed -= TBATCH_RSPMAX;
+        c->batch = NULL;
+        free(b);
+    }
+    return 0;
+}
+
+/* handle every complete message the windows allow */
+static void conn_process(conn_t *c) {
+    if (c->batch != NULL && batch_run(c)){  /* whatever follows it waits */
+        conn_flush(c);
+        conn_update(c);
+        return;
+    }
+    while (c->rlen > 0 && hoconn < 0){  /* handing off: the successor handles the rest */
+        int size = msgsize(c->rbuf,c->rlen);
+        if (size == 0 || (size > (int)c->rcap && conn_grow(c,size) < 0)){ /* unknown message: drop the client */
+            fprintf(stderr,"SERVER: unknown message type %02x\n",c->rbuf[0]);
+            METRIC_INC(badtype);
+            c->eof = 1;
+            c->rlen = 0;
+            break;
+        }
+        if (size < 0 || c->rlen < (size_t)size){    /* wait for the rest */
+            if (c->eof) c->rlen = 0;    /* which will never come */
+            break;
+        }
+        int need = MSG_TYPE(c->rbuf[0]) == TBATCH ? TBATCH_RSPMAX : rsplen(c->rbuf[0]);
+        if (c->wlen + c->owed + need > MAXBUF) break;   /* no room to answer */
+        if (MSG_TYPE(c->rbuf[0]) == CREDIT){    /* at once, whatever the windows */
+            msg_count(c->gen,c->rbuf,size);
+            conn_reply(c,c->rbuf[0],msgid_get(c->rbuf,size),msg_credit(c->inflight,conn_queued(c,size)),NULL);
+            conn_consume(c,size);
+            continue;
+        }
+        uint8_t status;
+        uint64_t ts[4];
+        int zret = msg_zones(c->rbuf,size);
+        if (zret < 0){                  /* an invalid target: NAK, even with the windows full */
+            msg_check(c->gen,c->rbuf,size,zret,&status);
+            conn_reply(c,c->rbuf[0],msgid_get(c->rbuf,size),status,msg_times(ts,c->rbuf,size,c->stamp));
+            conn_consume(c,size);
+            continue;
+        }
+        if (msg_shed(c->gen,c->rbuf,size,c->stamp)){    /* even with the windows full */
+            conn_busy(c,c->rbuf,size);
+            conn_consume(c,size);
+            continue;
+        }
+        if (c->inflight >= cliwin) break;
+        if (MSG_TYPE(c->rbuf[0]) == TBATCH){    /* its targets go as the device has room */
+            if (c->batch != NULL) break;
+            msg_count(c->gen,c->rbuf,size);
+            if (batch_start(c,c->rbuf,size) < 0) conn_busy(c,c->rbuf,size);
+            conn_consume(c,size);
+            if (c->batch != NULL && batch_run(c)) break;
+            continue;
+        }
+        uint32_t words = msg_words(c->rbuf,size);
+        if (words && !dev_room(words)){ /* what is answered here never waits */
+            conn_wait(c);
+            break;
+        }
+        switch (msg_check(c->gen,c->rbuf,size,zret,&status)){
+        case 1: conn_reply(c,c->rbuf[0],msgid_get(c->rbuf,size),status,msg_times(ts,c->rbuf,size,c->stamp)); break;
+        case 0:
+            if (!pend_attach(c,NULL,NULL,c->rbuf,size,c->stamp)) hw_submit(c,NULL,NULL,c->rbuf,size,c->stamp);
+            break;
+        }
+        conn_consume(c,size);
+    }
+    conn_flush(c);
+    conn_update(c);
+}
 
-            /* get second lat coord */
-            second_lat[0] = msgbuf[12];
-            second_lat[1] = msgbuf[13];
-            second_lat[2] = msgbuf[14];            
+/* send the queued datagram responses */
+static void udp_flush(void) {
+    int i = 0, n;
 
-            /* insert into appropiate table */
-            if (msgbuf[0]==AOZ){
+    while (i < nout){
+        if ((n = SYS(sendmmsg(udpsock,outmsg+i,nout-i,MSG_DONTWAIT))) > 0){
+            i += n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK){
+            METRIC_INC(udpunsent);      /* this one's sender has gone: skip it */
+            i++;
+            continue;
+        }
+        METRIC_ADD(udpunsent,nout-i);   /* socket buffer full: lost like any datagram */
+        break;
+    }
+    nout = 0;
+}
+
+/* queue a response to the sender of a datagram */
+static void udp_queue(const struct sockaddr_in *to,const uint8_t *rsp,int rlen) {
+    if (nout == UDPBATCH) udp_flush();
+    memcpy(udpout[nout],rsp,rlen);
+    udpto[nout] = *to;
+    outiov[nout].iov_base = udpout[nout];
+    outiov[nout].iov_len = rlen;
+    memset(&outmsg[nout],0,sizeof(outmsg[nout]));
+    outmsg[nout].msg_hdr.msg_name = &udpto[nout];
+    outmsg[nout].msg_hdr.msg_namelen = sizeof(udpto[nout]);
+    outmsg[nout].msg_hdr.msg_iov = &outiov[nout];
+    outmsg[nout].msg_hdr.msg_iovlen = 1;
+    nout++;
+}
+
+/* answer a datagram directly, without the hardware */
+static void udp_reply(const struct sockaddr_in *to,uint8_t type,uint32_t msgid,uint8_t status,const uint64_t *ts) {
+    uint8_t rsp[RSIZE_T];
+    int rlen = rspmake(rsp,type,status,msgid,ts);
+
+    cap_write(udpgen,CAP_RSP,rsp,rlen);
+    udp_queue(to,rsp,rlen);
+    METRIC_INC(rsps[METRIC_TYPE(type)]);
+}
+
+/* count the msgids a sender skipped: each sender's should count up by one */
+static void udp_seq(const struct sockaddr_in *from,uint32_t msgid,int ext) {
+    uint32_t addr = from->sin_addr.s_addr, mask = ext ? 0xffffffffu : 0xff, d;
+    peer_t *p = &peers[((addr * 2654435761u) ^ from->sin_port) % UDPPEERS];
+
+    if (!p->used || p->addr != addr || p->port != from->sin_port){ /* new, or displaced another */
+        p->used = 1;
+        p->addr = addr;
+        p->port = from->sin_port;
+        p->next = (msgid+1) & mask;
+        return;
+    }
+    d = (msgid - p->next) & mask;
+    if (d > mask/2){                    /* behind: late or repeated */
+        METRIC_INC(udpreorder);
+        return;
+    }
+    METRIC_ADD(udpgaps,d);
+    p->next = (msgid+1) & mask;
+}
+
+/*
+ * when the kernel received a datagram, on the now_us() clock (now if
+ * it did not say), noting how many it has dropped for want of buffer
+ */
+static uint64_t udp_stamp(struct msghdr *m,uint64_t now,const struct timespec *real) {
+    struct cmsghdr *cm;
+    struct timespec ts;
+    uint64_t stamp = now;
+    uint32_t drops;
+    int64_t age;
+
+    for (cm = CMSG_FIRSTHDR(m); cm != NULL; cm = CMSG_NXTHDR(m,cm)){
+        if (cm->cmsg_level != SOL_SOCKET) continue;
+        if (cm->cmsg_type == SO_RXQ_OVFL){  /* a running total */
+            memcpy(&drops,CMSG_DATA(cm),sizeof(drops));
+            METRIC_SET(udpoverflow,drops);
+        }
+        else if (cm->cmsg_type == SCM_TIMESTAMPNS){
+            memcpy(&ts,CMSG_DATA(cm),sizeof(ts));
+            age = (int64_t)(real->tv_sec-ts.tv_sec)*1000000 + (real->tv_nsec-ts.tv_nsec)/1000;
+            if (age > 0 && (uint64_t)age < now) stamp = now-age;
+        }
+    }
+    return stamp;
+}
+
+/* a datagram for the hardware: to it now if it has room and none are queued ahead, otherwise to the queue */
+static void udp_submit(const struct sockaddr_in *from,uint8_t *bp,int len,uint64_t stamp) {
+    udpwait_t *w;
+    uint64_t ts[4];
+
+    if (pend_attach(NULL,from,NULL,bp,len,stamp)) return;
+    if (udpqlen == 0 && dev_room(msg_words(bp,len))){
+        hw_submit(NULL,from,NULL,bp,len,stamp);
+        return;
+    }
+    if (udpqlen == UDPQUEUE || len > (int)sizeof(w->msg)){  /* no room to wait: not acted on */
+        udp_reply(from,bp[0],msgid_get(bp,len),BUSY,msg_times(ts,bp,len,stamp));
+        return;
+    }
+    w = &udpq[(udpqhead+udpqlen++)%UDPQUEUE];
+    memcpy(w->msg,bp,len);
+    w->len = len;
+    w->stamp = stamp;
+    w->from = *from;
+}
 
-                
-                AOZtable[AOZ_index][0] = first_long;
-                AOZtable[AOZ_index][1] = first_lat;
-                AOZtable[AOZ_index][2] = second_long;
-                AOZtable[AOZ_index][3] = second_lat;
-                AOZ_index ++;
+/* send queued datagrams on to the device, in order, as far as it has room */
+static void udp_drain(void) {
+    udpwait_t *w;
+    uint64_t ts[4];
+
+    while (udpqlen > 0){
+        w = &udpq[udpqhead];
+        if (deadline && msg_late(w->stamp))     /* it waited too long here */
+            udp_reply(&w->from,w->msg[0],msgid_get(w->msg,w->len),BUSY,msg_times(ts,w->msg,w->len,w->stamp));
+        else if (!pend_attach(NULL,&w->from,NULL,w->msg,w->len,w->stamp)){
+            if (!dev_room(msg_words(w->msg,w->len))) break;
+            hw_submit(NULL,&w->from,NULL,w->msg,w->len,w->stamp);
+        }
+        udpqhead = (udpqhead+1)%UDPQUEUE;
+        udpqlen--;
+    }
+}
+
+/*
+ * read whole batches of datagrams, a queue's worth at most: those
+ * answered here are answered at once, even with the queue full, and
+ * the rest go to the device as it has room, or BUSY if the queue has
+ * none
+ */
+static void udp_recv(void) {
+    struct mmsghdr in[UDPBATCH];
+    struct iovec iov[UDPBATCH];
+    struct timespec real;
+    uint64_t now;
+    int i, n, reads = 0;
+
+    do {
+        memset(in,0,sizeof(in));
+        for (i = 0; i < UDPBATCH; i++){
+            iov[i].iov_base = udpin[i];
+            iov[i].iov_len = MAXBUF;
+            in[i].msg_hdr.msg_name = &udpfrom[i];
+            in[i].msg_hdr.msg_namelen = sizeof(udpfrom[i]);
+            in[i].msg_hdr.msg_iov = &iov[i];
+            in[i].msg_hdr.msg_iovlen = 1;
+            in[i].msg_hdr.msg_control = udpctl[i];
+            in[i].msg_hdr.msg_controllen = sizeof(udpctl[i]);
+        }
+        if ((n = SYS(recvmmsg(udpsock,in,UDPBATCH,MSG_DONTWAIT,NULL))) <= 0) break;
+        now = now_us();
+        clock_gettime(CLOCK_REALTIME,&real);    /* the clock of the kernel's stamps */
+        METRIC_ADD(udpdgrams,n);
+        for (i = 0; i < n; i++){
+            uint8_t *bp = udpin[i], status;
+            uint64_t ts[4];
+            int len = in[i].msg_len;
+            uint64_t stamp = udp_stamp(&in[i].msg_hdr,now,&real);
+            if ((in[i].msg_hdr.msg_flags & MSG_TRUNC) || len < 1 || msgsize(bp,len) != len || MSG_TYPE(bp[0]) == TBATCH){
+                METRIC_INC(udpbad);     /* not exactly one message */
+                continue;
+            }
+            udp_seq(&udpfrom[i],msgid_get(bp,len),bp[0] & MSG_EXT);
+            if (MSG_TYPE(bp[0]) == CREDIT){
+                msg_count(udpgen,bp,len);
+                udp_reply(&udpfrom[i],bp[0],msgid_get(bp,len),msg_credit(0,0),NULL);
+                continue;
+            }
+            int zret = msg_zones(bp,len);
+            if (zret >= 0 && msg_shed(udpgen,bp,len,stamp)){   /* an invalid target is NAKed below */
+                udp_reply(&udpfrom[i],bp[0],msgid_get(bp,len),BUSY,msg_times(ts,bp,len,stamp));
+                continue;
             }
-            else{
-                EZtable[AOZ_index][0] = first_long;
-                EZtable[AOZ_index][1] = first_lat;
-                EZtable[AOZ_index][2] = second_long;
-                EZtable[AOZ_index][3] = second_lat;
-                EZ_index ++;
+            switch (msg_check(udpgen,bp,len,zret,&status)){
+            case 1: udp_reply(&udpfrom[i],bp[0],msgid_get(bp,len),status,msg_times(ts,bp,len,stamp)); break;
+            case 0: udp_submit(&udpfrom[i],bp,len,stamp); break;
             }
         }
-        ret = 2;
+        udp_flush();
+    } while (n == UDPBATCH && ++reads < UDPQUEUE/UDPBATCH);  /* more may be waiting; the clients and hardware too */
+}
+
+/* match a hardware response to its request and answer the client */
+static void hw_complete(uint8_t *bp,ssize_t cnt) {
+    pend_t *p, *copies;
+    conn_t *c;
+
+    if (verbose) msgprint("recv h",bp,cnt);
+    if ((p = seqwin_ack(&devwin,msgid_get(bp,cnt))) == NULL){
+        cap_write(0,CAP_RSP,bp,cnt);
+        METRIC_INC(unmatched);
+        fprintf(stderr,"SERVER: response to unknown msgid dropped\n");
+        return;
     }
-    else{
-        /* go through AZ and check if in 1 of them at least */
-        for (int i =0; i <AOZ_index; i++){
-            /* check if within aoz */
-            if (AOZtable[i][0] % 2== 0) in_aoz = 0;
+    uint64_t done = now_us(), rtt = done - p->sent;
+    fifowords -= p->words;
+    hwrtt = (7*(uint64_t)hwrtt + (rtt < UINT32_MAX ? rtt : UINT32_MAX))/8;
+    METRIC_SET(hwrtt,hwrtt);
+    if (dedupms && MSG_TYPE(p->type) == TARGET) dedup_put(&dedup,p->key,now_ms(),bp[0]);
+    pend_unkey(p);
+    if (p->batch != NULL) subs_publish(p->batch->type,bp[0],p->batch->msgid);
+    else subs_publish(p->type,bp[0],p->msgid);
+    dev_count();
+    copies = p->copies;
+    p->next = freepend;                 /* free before anything can submit */
+    freepend = p;
+    if ((c = pend_answer(p,bp[0],done)) != NULL) conn_process(c);  /* may have been waiting on its window */
+    pend_copies(copies,bp[0],done);
+    wake_waiters();
+}
+
+/* collect responses from the polling thread */
+static void hwpoll_drain(int efd) {
+    uint64_t n;
+    int len;
+    conn_t *c;
+
+    if (SYS(read(efd,&n,sizeof(n))) < 0 && errno != EAGAIN) return;
+    while ((len = hwpoll_complete(rspbuf)) != 0){
+        if (len > 0){
+            hw_complete(rspbuf,len);
+        }
+        else if ((c = hw_refused(rspbuf,-len)) != NULL){
+            conn_process(c);
+            wake_waiters();
         }
-        /* check EZ and if not within */
-        for(int i = 0; i <EZ_index;i++){
-            if (EZtable[i][0] % 2== 0) out_ez = 1;
+    }
+}
+
+/* give the device window to connections blocked on it */
+static void wake_waiters(void) {
+    conn_t *c;
+
+    if (udpqlen) udp_drain();           /* datagrams first: they were read first */
+    while (waitlen > 0 && dev_room(HWWORDS)){      /* wake blocked clients */
+        int fd = waitq[waithead];
+        waithead = (waithead+1)%MAXCONN;
+        waitlen--;
+        if ((c = conns[fd]) != NULL){
+            c->waiting = 0;
+            conn_process(c);
         }
+    }
+}
 
+/* append what a ring recv delivered to rbuf */
+static void conn_take(conn_t *c,const uint8_t *bp,int n) {
+    if (c->rlen + n > c->rcap && conn_grow(c,c->rlen+n) < 0){
+        fprintf(stderr,"SERVER: out of memory\n");
+        c->eof = 1;                     /* drop the client */
+        c->rlen = 0;
+        return;
     }
-    if (in_aoz == 0 && out_ez == 0) ret = 0;
-    else  ret = -1;
+    memcpy(c->rbuf+c->rlen,bp,n);
+    conn_stamp(c,c->rlen,now_us());
+    c->rlen += n;
+}
 
-    return ret;
+/* keep a multishot accept armed on the listening socket */
+static void ring_accept(int sock) {
+    if (ur_accept(sock,UR_DATA(NULL,UR_ACCEPT)) < 0){
+        errorExit("SERVER: Error queueing on the io_uring\n");
+    }
+    accepting = 1;
+}
 
+/* act on one io_uring completion */
+static void ring_complete(int sock,uint64_t data,int res,uint32_t flags) {
+    conn_t *c = (conn_t*)(uintptr_t)(data & ~(uint64_t)7);
 
+    switch (data & 7){
+    case UR_ACCEPT:
+        if (!(flags & IORING_CQE_F_MORE)) accepting = 0;
+        if (res == -ECANCELED && hoconn >= 0) return;
+        if (res < 0){
+            errorExit("SERVER: Error calling accept\n");
+        }
+        if ((c = conn_new(res,0)) != NULL) conn_watch(c);
+        if (!accepting && hoconn < 0) ring_accept(sock);
+        return;
+    case UR_EPOLL:
+        epready = 1;
+        if (!(flags & IORING_CQE_F_MORE) && ur_poll(epfd,EPOLLIN,UR_DATA(NULL,UR_EPOLL)) < 0){
+            errorExit("SERVER: Error queueing on the io_uring\n");
+        }
+        return;
+    case UR_RECV:
+        if (!(flags & IORING_CQE_F_MORE)){  /* the recv has ended */
+            c->armed = c->cancelling = 0;
+            c->ops--;
+        }
+        if (flags & IORING_CQE_F_BUFFER){
+            unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (res > 0 && !c->closed) conn_take(c,ur_buf(bid),res);
+            ur_buf_put(bid);
+        }
+        if (res == 0 || (res < 0 && res != -ENOBUFS && res != -ECANCELED))
+            c->eof = 1;                 /* answer what was already sent; a reset is a close */
+        break;
+    case UR_SEND:
+        c->ops--;
+        c->sending = 0;
+        if (c->closed) break;
+        if (res < 0){
+            c->wlen = 0;                /* client has gone away */
+            c->rlen = 0;
+            c->eof = 1;
+            break;
+        }
+        memmove(c->wbuf,c->wbuf+res,c->wlen-res);
+        c->wlen -= res;
+        break;
+    default:                            /* a cancel: its recv's completion says the rest */
+        return;
+    }
+    if (c->closed){
+        if (c->ops == 0) conn_free(c);
+        return;
+    }
+    conn_process(c);
 }
 
-int main(int argc, char **argv){
-    int sock,client_sock;
+/* handle every completion the io_uring has posted */
+static void ring_drain(int sock) {
+    struct io_uring_cqe *cqe;
 
-	int yes =1;
-	
-	struct sockaddr_in servaddr;
+    while ((cqe = ur_cqe()) != NULL){
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        uint32_t flags = cqe->flags;
+        ur_seen();
+        ring_complete(sock,data,res,flags);
+    }
+}
 
-	uint16_t port = TCP_ECHO_PORT;
+/* a successor has come: take no more connections or messages, and let the hardware finish */
+static void handoff_begin(int sock,int usock) {
+    int fd;
+
+    if ((fd = SYS(accept4(hosock,NULL,NULL,SOCK_CLOEXEC))) < 0) return;
+    hoconn = fd;
+    SYS(epoll_ctl(epfd,EPOLL_CTL_DEL,hosock,NULL));
+    SYS(close(hosock));                 /* the successor listens at hopath next */
+    hosock = -1;
+    if (!uring) SYS(epoll_ctl(epfd,EPOLL_CTL_DEL,sock,NULL));   /* new ones wait in the backlogs */
+    else if (accepting && ur_cancel(UR_DATA(NULL,UR_ACCEPT),UR_DATA(NULL,UR_CANCEL)) < 0){
+        errorExit("SERVER: Error queueing on the io_uring\n");
+    }
+    if (usock >= 0) SYS(epoll_ctl(epfd,EPOLL_CTL_DEL,usock,NULL));
+    if (udpsock >= 0) SYS(epoll_ctl(epfd,EPOLL_CTL_DEL,udpsock,NULL));
+    subs_stop();                        /* observers reconnect to the successor */
+    metrics_stop();                     /* which serves the metrics from now on */
+    hodeadline = now_ms() + HANDOFF_WAIT;
+    for (fd = 0; fd < MAXCONN; fd++)
+        if (conns[fd] != NULL) conn_update(conns[fd]);  /* stop reading */
+    printf("[Handing off...]\n");
+    fflush(stdout);
+}
+
+/* nothing left for the hardware, or the kernel, to finish */
+static int handoff_ready(void) {
+    int fd;
+
+    if (accepting || ((devwin.inflight || udpqlen) && (int32_t)(now_ms() - hodeadline) < 0)) return 0;
+    for (fd = 0; fd < MAXCONN; fd++)
+        if (conns[fd] != NULL && conns[fd]->ops) return 0;
+    return 1;
+}
+
+/* give the successor our sockets, zones and clients, each client with what it sent that we have not handled and what we have not sent it */
+static void handoff_finish(int sock,int usock) {
+    uint8_t *zbuf = NULL;
+    size_t zlen = 0, off;
+    int fd, n = 0, ok;
+
+    if (devwin.inflight) fprintf(stderr,"SERVER: handing off with %u requests unanswered\n",devwin.inflight);
+    ok = ho_send(hoconn,HO_LISTEN,sock,NULL,0,NULL,0) == 0 &&
+        (udpsock < 0 || ho_send(hoconn,HO_UDP,udpsock,NULL,0,NULL,0) == 0) &&
+        (usock < 0 || ho_send(hoconn,HO_UNIX,usock,NULL,0,NULL,0) == 0) &&
+        zones_save(&zbuf,&zlen) == 0;
+    for (off = 0; ok && off < zlen; off += HO_CHUNK)
+        ok = ho_send(hoconn,HO_ZONES,-1,zbuf+off,zlen-off < HO_CHUNK ? zlen-off : HO_CHUNK,NULL,0) == 0;
+    free(zbuf);
+    for (fd = 0; ok && fd < MAXCONN; fd++){
+        conn_t *c = conns[fd];
+        if (c == NULL) continue;
+        ok = ho_send(hoconn,c->packet ? HO_PACKET : HO_CONN,fd,c->rbuf,c->rlen,c->wbuf,c->wlen) == 0;
+        n++;
+    }
+    if (!ok || ho_send(hoconn,HO_END,-1,NULL,0,NULL,0) < 0){
+        errorExit("SERVER: the successor went away during the handoff\n");
+    }
+    printf("[Handed off %d connections]\n",n);
+    stop = 1;
+}
+
+/* take over the sockets, zones and clients of the server at hopath */
+static void handoff_take(int ho,int *sock,int *usock) {
+    static uint8_t buf[HO_BUFSZ];
+    uint8_t *zbuf = NULL, *p;
+    size_t zlen = 0;
+    uint32_t alen, blen;
+    int kind, fd, n = 0;
+    conn_t *c;
+
+    while ((kind = ho_recv(ho,&fd,buf,&alen,&blen)) != HO_END){
+        switch (kind){
+        case HO_LISTEN: *sock = fd; break;
+        case HO_UDP: udpsock = fd; break;
+        case HO_UNIX: *usock = fd; break;
+        case HO_ZONES:
+            if ((p = realloc(zbuf,zlen+alen)) == NULL){
+                errorExit("SERVER: out of memory\n");
+            }
+            memcpy(p+zlen,buf,alen);
+            zbuf = p;
+            zlen += alen;
+            break;
+        case HO_CONN:
+        case HO_PACKET:
+            fcntl(fd,F_SETFL,O_NONBLOCK);
+            if (blen > MAXBUF || (c = conn_new(fd,kind == HO_PACKET)) == NULL) break;
+            if (alen > c->rcap && conn_grow(c,alen) < 0){
+                errorExit("SERVER: out of memory\n");
+            }
+            memcpy(c->rbuf,buf,alen);   /* served once the event loop is up */
+            c->rlen = alen;
+            c->stamp = now_us();
+            memcpy(c->wbuf,buf+alen,blen);
+            c->wlen = blen;
+            n++;
+            break;
+        case -1:
+            errorExit("SERVER: the handoff was cut short\n");
+        default:
+            if (fd >= 0) close(fd);
+        }
+    }
+    close(ho);
+    if (zlen && zones_load(zbuf,zlen) < 0) fprintf(stderr,"SERVER: could not keep every zone\n");
+    free(zbuf);
+    printf("[Took over %d connections]\n",n);
+}
+
+/* the TCP listening socket, bound to servaddr */
+static int tcp_listen(struct sockaddr_in *servaddr) {
+	int sock, yes = 1;
 
 	/* Create a TCP socket */
-	if ((sock = socket(AF_INET,SOCK_STREAM, IPPROTO_TCP)) < 0){
+	if ((sock = socket(AF_INET,SOCK_STREAM|SOCK_NONBLOCK, IPPROTO_TCP)) < 0){
 		errorExit("SERVER: Error creating listening socket.\n");
 	}
 	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1) {
     	errorExit("SERVER: Setsockopt\n");
 	}
 
+	if (bind(sock, (struct sockaddr *) servaddr, sizeof(*servaddr)) < 0 ){
+		errorExit("SERVER: Error calling bind\n");
+	}
+
+	if (listen(sock, LISTENQ) < 0 ){
+   		errorExit("SERVER: Error calling listen\n");
+	}
+	return sock;
+}
+
+static void usage(char *prog) {
+    fprintf(stderr,"usage: %s [-p port] [-q] [-C capture file] [-P cpu [-F prio]] [-u port] [-U path] [-I] [-H path] [-D deadline ms] [-T threads] [-m port|path] [-o port|path] [-z zones] [-d ms] [-x] [-w device window] [-c client window]\n",prog);
+    exit(EXIT_FAILURE);
+}
+
+static void onsignal(int sig) {
+    stop = 1;
+}
+
+int main(int argc, char **argv){
+    int sock = -1,opt;
+    uint32_t dwin = DEVWIN;
+    char *capname = NULL;
+    char *metricsat = NULL;
+    char *subsat = NULL;
+    char *unixpath = NULL;
+    int usock = -1;
+    int prio = 0, efd, tfd, xfd, hofd;
+    uint32_t secs = 0;                  /* seconds on the zone expiry clock */
+    struct sigaction sa;
+
+	struct sockaddr_in servaddr;
+
+	uint16_t port = TCP_ECHO_PORT;
+	uint16_t udpport = 0;
+
+    while ((opt = getopt(argc,argv,"p:u:U:IH:D:T:qC:P:F:m:o:z:d:xw:c:")) != -1){
+        switch (opt){
+        case 'p': port = atoi(optarg); break;
+        case 'u': udpport = atoi(optarg); break;
+        case 'U': unixpath = optarg; break;
+        case 'I': uring = 1; break;
+        case 'H': hopath = optarg; break;
+        case 'D': deadline = atoi(optarg)*1000ull; break;
+        case 'T': poolthreads = atoi(optarg); break;
+        case 'q': verbose = 0; break;
+        case 'C': capname = optarg; break;
+        case 'P': pollcpu = atoi(optarg); break;
+        case 'F': prio = atoi(optarg); break;
+        case 'm': metricsat = optarg; break;
+        case 'o': subsat = optarg; break;
+        case 'x': xdev = 1; break;
+        case 'w': dwin = atoi(optarg); break;
+        case 'c': cliwin = atoi(optarg); break;
+        case 'z': zones_limit(atoi(optarg)); break;
+        case 'd': dedupms = atoi(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (cliwin == 0 || cliwin*RSIZE_X + 2*TBATCH_RSPMAX > MAXBUF) usage(argv[0]);  /* and a TBATCH's answer, and one shed */
+    if (dwin == 0 || seqwin_init(&devwin,dwin,xdev ? 32 : 8) < 0){
+        errorExit("SERVER: device window too large for the msgid size\n");
+    }
+    if ((pends = calloc(devwin.size,sizeof(pend_t))) == NULL ||
+        (dedupms && dedup_init(&dedup,dedupms,DEDUPSLOTS) < 0)){
+        errorExit("SERVER: out of memory\n");
+    }
+    for (uint32_t i = 0; i < devwin.size; i++){
+        pends[i].next = freepend;
+        freepend = &pends[i];
+    }
+    if (capname != NULL && cap_open(capname) < 0){
+        errorExit("SERVER: cannot open capture file\n");
+    }
+    if (poolthreads < 0 || pool_start(poolthreads) < 0){
+        errorExit("SERVER: cannot start the zone check threads\n");
+    }
+    METRIC_SET(devwin,devwin.size);
+    memset(&sa,0,sizeof(sa));           /* stop cleanly so the capture is complete */
+    sa.sa_handler = onsignal;
+    sigaction(SIGINT,&sa,NULL);
+    sigaction(SIGTERM,&sa,NULL);
+
+    if (hopath != NULL && (hofd = ho_connect(hopath)) >= 0){   /* a server is running: take over */
+        printf("[Taking over...]\n");
+        fflush(stdout);
+        handoff_take(hofd,&sock,&usock);
+    }
+    if (metricsat != NULL && metrics_start(metricsat) < 0){
+        errorExit("SERVER: cannot serve metrics\n");
+    }
+
 	/* set up the server address */
 	memset(&servaddr, 0, sizeof(servaddr));
 	servaddr.sin_family = AF_INET;
 	servaddr.sin_port   = htons(port);
 	servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
 
-	if (bind(sock, (struct sockaddr *) &servaddr, sizeof(servaddr)) < 0 ){
-		errorExit("SERVER: Error calling bind\n");
-	}
+	if (sock < 0) sock = tcp_listen(&servaddr);
 
 	printf("[Listening...]\n");
 
-	if (listen(sock, LISTENQ) < 0 ){
-   		errorExit("SERVER: Error calling listen\n");
-	}
+    fdout = open(DEVOUT,O_WRONLY);				/* open the hardware for read and write */
+	fdin = open(DEVIN,O_RDONLY);				/* open the hardware for read and write */
 
-    int fdout = open(DEVOUT,O_WRONLY);				/* open the hardware for read and write */
-	int fdin = open(DEVIN,O_RDONLY);				/* open the hardware for read and write */
-
-    AOZ_index = 0;
-    EZ_index = 0;
-    while (1){
-        client_sock = accept(sock,NULL,NULL) ;
-        if(client_sock < 0 ) {
-				errorExit("SERVER: Error calling accept\n");
+    if ((epfd = epoll_create1(0)) < 0){
+        errorExit("SERVER: Error calling epoll_create1\n");
+    }
+    if (uring && ur_init(URENTRIES,URBUFS,MAXBUF) < 0){
+        fprintf(stderr,"SERVER: io_uring unavailable, using epoll\n");
+        uring = 0;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = EV_LISTEN };
+    if (uring){                         /* the ring accepts, and watches epoll for the rest */
+        ring_accept(sock);
+        if (ur_poll(epfd,EPOLLIN,UR_DATA(NULL,UR_EPOLL)) < 0){
+            errorExit("SERVER: Error queueing on the io_uring\n");
         }
-
-        ssize_t nrecv;
-        if ((nrecv = recv(client_sock,(void*)msgbuf,A_ESIZE,0)) < 0){
-            errorExit("Error on recv\n");
+    }
+    else if (epoll_ctl(epfd,EPOLL_CTL_ADD,sock,&ev) < 0){
+        errorExit("SERVER: Error calling epoll_ctl\n");
+    }
+    if (udpport != 0 && udpsock < 0){   /* datagram ingest */
+        int big = 4<<20;
+        servaddr.sin_port = htons(udpport);
+        if ((udpsock = socket(AF_INET,SOCK_DGRAM|SOCK_NONBLOCK,0)) < 0 ||
+            bind(udpsock,(struct sockaddr *) &servaddr,sizeof(servaddr)) < 0){
+            errorExit("SERVER: Error binding the UDP socket\n");
+        }
+        setsockopt(udpsock,SOL_SOCKET,SO_RCVBUF,&big,sizeof(big)); /* room for a burst */
+    }
+    if (udpsock >= 0){                  /* our own, or taken over */
+        int one = 1;
+        setsockopt(udpsock,SOL_SOCKET,SO_TIMESTAMPNS,&one,sizeof(one));   /* how long each waited for us */
+        setsockopt(udpsock,SOL_SOCKET,SO_RXQ_OVFL,&one,sizeof(one));      /* and how many never got here */
+        udpgen = ++conngen;
+        uint8_t how = CAP_UDP;
+        cap_write(udpgen,CAP_OPEN,&how,1);
+        ev.data.fd = EV_UDP;
+        epoll_ctl(epfd,EPOLL_CTL_ADD,udpsock,&ev);
+    }
+    if (unixpath != NULL && usock < 0){ /* local producers */
+        struct sockaddr_un un;
+        memset(&un,0,sizeof(un));
+        un.sun_family = AF_UNIX;
+        if (strlen(unixpath) >= sizeof(un.sun_path)) usage(argv[0]);
+        strcpy(un.sun_path,unixpath);
+        unlink(unixpath);               /* left by an earlier run */
+        if ((usock = socket(AF_UNIX,SOCK_SEQPACKET|SOCK_NONBLOCK,0)) < 0 ||
+            bind(usock,(struct sockaddr *) &un,sizeof(un)) < 0 || listen(usock,LISTENQ) < 0){
+            errorExit("SERVER: Error listening on the Unix socket\n");
+        }
+    }
+    if (usock >= 0){
+        ev.data.fd = EV_UNIX;
+        epoll_ctl(epfd,EPOLL_CTL_ADD,usock,&ev);
+    }
+    if (subsat != NULL && subs_start(subsat,epfd,EV_SUBS) < 0){
+        errorExit("SERVER: cannot listen for observers\n");
+    }
+    if (pollcpu >= 0){                  /* low-latency polling core mode */
+        struct itimerspec its = { { REPORT, 0 }, { REPORT, 0 } };
+        if ((efd = hwpoll_start(fdout,fdin,pollcpu,prio,devwin.size)) < 0){
+            errorExit("SERVER: cannot start the polling thread\n");
         }
-        int size = A_ESIZE;
-        if (msgbuf[0] == TARGET){
-            size = TSIZE;
+        METRIC_SET(unlocked,!hwpoll_locked());
+        ev.data.fd = EV_HWPOLL;
+        epoll_ctl(epfd,EPOLL_CTL_ADD,efd,&ev);
+        if ((tfd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK)) >= 0){
+            timerfd_settime(tfd,0,&its,NULL);
+            ev.data.fd = EV_REPORT;
+            epoll_ctl(epfd,EPOLL_CTL_ADD,tfd,&ev);
         }
-        msgprint("send hw",msgbuf,size);
+    }
+    else if (hwinit(fdout) < 0){        /* map and reset it now, not on the first message */
+        errorExit("SERVER: cannot prepare the hardware\n");
+    }
+    fifodepth = atomic_load(&hwstats.txdepth);
 
-        int ret= checkTables(size);
-        if (ret == 0) continue;
-        hwwrite(fdout,(void*)msgbuf,TSIZE);
+    if ((xfd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK)) >= 0){   /* zone expiry, every second */
+        struct itimerspec its = { { 1, 0 }, { 1, 0 } };
+        timerfd_settime(xfd,0,&its,NULL);
+        ev.data.fd = EV_EXPIRE;
+        epoll_ctl(epfd,EPOLL_CTL_ADD,xfd,&ev);
+    }
+    if (hopath != NULL){                /* for our own successor */
+        if ((hosock = ho_listen(hopath)) < 0){
+            errorExit("SERVER: cannot listen for a successor\n");
+        }
+        ev.data.fd = EV_HANDOFF;
+        epoll_ctl(epfd,EPOLL_CTL_ADD,hosock,&ev);
+    }
+    for (int fd = 0; fd < MAXCONN; fd++)    /* clients taken over */
+        if (conns[fd] != NULL) conn_watch(conns[fd]);
+    while (!stop){
+        struct epoll_event evs[MAXEV];
+        int n,i;
         ssize_t cnt;
-        
-        
-        while((cnt=hwresponse(fdin,(void*)msgbuf,MAXBUF))==0) { /* wait for a message */
-            printf(".");														 /* print a dot for debug */
-            fflush(stdout);
-        }				/* send ith message to hardware */
-        printf("\n");
-        msgprint("recv h",msgbuf,cnt);
-        
 
-        ssize_t nsent;
-        if ((nsent = send(client_sock,(void*)msgbuf,RSIZE,0)) < 0){
-            errorExit("Error on recv\n");
-            msgprint("sending again",msgbuf,cnt);
+        /* block only when the hardware owes us nothing */
+        if (uring){                     /* submit this pass's sends and recvs, and wait, at once */
+            if (((devwin.inflight && pollcpu < 0) || epready || hoconn >= 0 ? ur_submit() : ur_wait()) < 0){
+                if (errno == EINTR) continue;
+                errorExit("SERVER: Error calling io_uring_enter\n");
+            }
+            ring_drain(sock);
+            n = 0;                      /* a level-triggered descriptor may still be ready after */
+            if (epready && (epready = n = SYS(epoll_wait(epfd,evs,MAXEV,0))) < 0){
+                if (errno == EINTR) continue;
+                errorExit("SERVER: Error calling epoll_wait\n");
+            }
+        }
+        else if ((n = SYS(epoll_wait(epfd,evs,MAXEV,(devwin.inflight && pollcpu < 0) || hoconn >= 0 ? 0 : -1))) < 0){
+            if (errno == EINTR) continue;
+            errorExit("SERVER: Error calling epoll_wait\n");
+        }
+        for (i = 0; i < n; i++){
+            conn_t *c;
+            if (evs[i].data.fd == EV_LISTEN){
+                conn_accept(sock,0);
+                continue;
+            }
+            if (evs[i].data.fd == EV_HANDOFF){
+                handoff_begin(sock,usock);
+                continue;
+            }
+            if (evs[i].data.fd == EV_UNIX){
+                conn_accept(usock,1);
+                continue;
+            }
+            if (evs[i].data.fd == EV_HWPOLL){
+                hwpoll_drain(efd);
+                continue;
+            }
+            if (evs[i].data.fd == EV_EXPIRE){
+                uint64_t ticks;
+                if (SYS(read(xfd,&ticks,sizeof(ticks))) > 0) zones_expire(secs += ticks);
+                continue;
+            }
+            if (evs[i].data.fd == EV_UDP){
+                udp_recv();
+                continue;
+            }
+            if (evs[i].data.fd <= EV_SUBS){
+                subs_event(evs[i].data.fd,evs[i].events);
+                continue;
+            }
+            if (evs[i].data.fd == EV_REPORT){
+                uint64_t ticks;
+                if (SYS(read(tfd,&ticks,sizeof(ticks))) > 0) hwpoll_report(stdout);
+                fflush(stdout);
+                continue;
+            }
+            if ((c = conns[evs[i].data.fd]) == NULL) continue;
+            if (evs[i].events & EPOLLOUT) conn_flush(c);
+            if (evs[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR)) conn_recv(c);
+            if (conns[evs[i].data.fd] == c) conn_update(c);
         }
 
-
+        if (devwin.inflight && pollcpu < 0){    /* poll a while, not a system call a poll */
+            for (int empty = 0; devwin.inflight && empty < HWPOLLS; empty++){
+                while((cnt=hwresponse(fdin,(void*)rspbuf,MAXBUF))>0) { /* collect responses */
+                    hw_complete(rspbuf,cnt);
+                    empty = 0;
+                }
+            }
+        }
+        if (nout) udp_flush();          /* datagram responses go out together */
+        subs_flush();                   /* observers get this pass's responses at once */
+        if (hoconn >= 0 && handoff_ready()) handoff_finish(sock,usock);
+    }
+    if (uring) ur_exit();
+    if (pollcpu >= 0){
+        hwpoll_report(stdout);
+        hwpoll_stop();
+    }
+    if (usock >= 0){
+        close(usock);
+        if (unixpath != NULL && hoconn < 0) unlink(unixpath);   /* not the successor's */
+    }
+    if (hosock >= 0){
+        close(hosock);
+        unlink(hopath);
     }
+    pool_stop();
+    subs_stop();
+    metrics_stop();
+    cap_close();
     if(close(sock) <0){
 		errorExit("Error closing socket\n");
 	}
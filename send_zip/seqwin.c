@@ -0,0 +1,70 @@
+/*
+ * seqwin.c -- sliding window of in-flight sequence numbers (see seqwin.h)
+ *
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include "seqwin.h"
+
+int seqwin_init(seqwin_t *w,uint32_t size,int bits) {
+	uint32_t n;
+
+	w->mask = (bits >= 32) ? 0xffffffffu : ((1u<<bits)-1);
+	for(n=1; n<size; n<<=1)					/* round up to a power of two */
+		;
+	if(n==0 || n > w->mask/2+1)				/* must not exceed half the space */
+		return -1;
+	w->size = n;
+	w->base = w->next = 0;
+	w->inflight = 0;
+	if((w->slot = calloc(n,sizeof(void*))) == NULL)
+		return -1;
+	return 0;
+}
+
+void seqwin_free(seqwin_t *w) {
+	free(w->slot);
+	w->slot = NULL;
+}
+
+/* distance from the window base to seq, in sequence space */
+static uint32_t seqwin_off(const seqwin_t *w,uint32_t seq) {
+	return (seq - w->base) & w->mask;
+}
+
+int seqwin_full(const seqwin_t *w) {
+	return seqwin_off(w,w->next) >= w->size;
+}
+
+uint32_t seqwin_open(seqwin_t *w,void *data) {
+	uint32_t seq = w->next;
+
+	w->slot[seq & (w->size-1)] = data;
+	w->next = (seq+1) & w->mask;
+	w->inflight++;
+	return seq;
+}
+
+void *seqwin_oldest(const seqwin_t *w,uint32_t *seq) {
+	if(w->inflight == 0)
+		return NULL;
+	*seq = w->base;							/* the base is never answered */
+	return w->slot[w->base & (w->size-1)];
+}
+
+void *seqwin_ack(seqwin_t *w,uint32_t seq) {
+	void *data;
+	uint32_t i;
+
+	seq &= w->mask;
+	if(seqwin_off(w,seq) >= seqwin_off(w,w->next))	/* not in flight */
+		return NULL;
+	i = seq & (w->size-1);
+	if((data = w->slot[i]) == NULL)					/* already answered */
+		return NULL;
+	w->slot[i] = NULL;
+	w->inflight--;
+	while(w->base != w->next && w->slot[w->base & (w->size-1)] == NULL)
+		w->base = (w->base+1) & w->mask;			/* slide past answered requests */
+	return data;
+}
@@ -0,0 +1,70 @@
+/*
+ * seqwin.h -- sliding window of in-flight sequence numbers
+ *
+ * Description: hands out sequence numbers for requests sent to the
+ * hardware and matches the responses that come back. Sequence numbers
+ * are 8, 16 or 32 bits wide and compared with serial number
+ * arithmetic, so they may wrap around as long as the window is no
+ * more than half the sequence space. A response whose msgid is not in
+ * flight (late, duplicate, or from before a wraparound) is refused
+ * rather than matched to the wrong request.
+ *
+ */
+#ifndef SEQWIN_H
+#define SEQWIN_H
+
+#include <stdint.h>
+
+typedef struct seqwin {
+	uint32_t base;						/* oldest unanswered sequence number */
+	uint32_t next;						/* next sequence number to hand out */
+	uint32_t size;						/* window size (power of two) */
+	uint32_t mask;						/* sequence space - 1 */
+	uint32_t inflight;					/* requests awaiting a response */
+	void **slot;						/* caller data per sequence number */
+} seqwin_t;
+
+/*
+ * seqwin_init() -- creates a window of size requests over bits-wide
+ * sequence numbers. size is rounded up to a power of two.
+ *
+ * returns: 0 on success; -1 if size exceeds half the sequence space.
+ */
+int seqwin_init(seqwin_t *w,uint32_t size,int bits);
+
+/*
+ * seqwin_free() -- releases the window
+ */
+void seqwin_free(seqwin_t *w);
+
+/*
+ * seqwin_full() -- true if no more requests may be sent until the
+ * oldest one is answered.
+ */
+int seqwin_full(const seqwin_t *w);
+
+/*
+ * seqwin_open() -- records data against the next sequence number.
+ *
+ * returns: the sequence number; the window must not be full.
+ */
+uint32_t seqwin_open(seqwin_t *w,void *data);
+
+/*
+ * seqwin_oldest() -- the oldest request still in flight, and its
+ * sequence number in *seq
+ *
+ * returns: the data recorded by seqwin_open(); NULL if none is in
+ * flight.
+ */
+void *seqwin_oldest(const seqwin_t *w,uint32_t *seq);
+
+/*
+ * seqwin_ack() -- matches a response to its request.
+ *
+ * returns: the data recorded by seqwin_open(); NULL if seq is not in
+ * flight.
+ */
+void *seqwin_ack(seqwin_t *w,uint32_t seq);
+
+#endif /* SEQWIN_H */
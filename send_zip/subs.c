@@ -0,0 +1,198 @@
+/*
+ * subs.c -- a stream of every hardware response, for observers (see subs.h)
+ *
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include "metrics.h"
+#include "subs.h"
+
+#define MAXSUBS 64							/* observers at once */
+#define RINGRECS 4096						/* records an observer may fall behind */
+#define RINGSIZE (RINGRECS*SUB_RECSZ)		/* records never wrap */
+
+typedef struct sub {
+	int fd;									/* -1 if the slot is free */
+	uint64_t cur;							/* ring bytes sent */
+	uint32_t events;						/* current epoll interest */
+} sub_t;
+
+static uint8_t ring[RINGSIZE];
+static uint64_t head;						/* ring bytes ever written */
+static sub_t subs[MAXSUBS];
+static int nsubs;							/* slots in use, up to the highest */
+static int epfd, base, lsock = -1;
+static char *upath;							/* Unix socket to remove at exit */
+
+static void sub_close(int i) {
+	epoll_ctl(epfd,EPOLL_CTL_DEL,subs[i].fd,NULL);
+	close(subs[i].fd);
+	subs[i].fd = -1;
+	METRIC_DEC(observers);
+}
+
+static void sub_watch(int i,uint32_t events) {
+	struct epoll_event ev = { .events = events, .data.fd = base-1-i };
+
+	if(events != subs[i].events && epoll_ctl(epfd,EPOLL_CTL_MOD,subs[i].fd,&ev) == 0)
+		subs[i].events = events;
+}
+
+/* send observer i what it has not yet seen */
+static void sub_send(int i) {
+	sub_t *s = &subs[i];
+	ssize_t n;
+
+	if(head - s->cur > RINGSIZE){          /* overwritten before it was sent */
+		if(s->cur % SUB_RECSZ){            /* part way through a record: lost its place */
+			METRIC_INC(obsdropped);
+			sub_close(i);
+			return;
+		}
+		METRIC_ADD(obskipped,(head - s->cur) / SUB_RECSZ);
+		s->cur = head;
+	}
+	while(s->cur < head){
+		size_t off = s->cur % RINGSIZE, len = head - s->cur;
+		if(len > RINGSIZE - off) len = RINGSIZE - off;
+		if((n = send(s->fd,ring+off,len,MSG_NOSIGNAL|MSG_DONTWAIT)) < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK){
+				sub_watch(i,EPOLLIN|EPOLLOUT);  /* wait for room */
+				return;
+			}
+			sub_close(i);
+			return;
+		}
+		s->cur += n;
+	}
+	sub_watch(i,EPOLLIN);
+}
+
+static void sub_accept(void) {
+	int fd, i, one = 1;
+
+	while((fd = accept4(lsock,NULL,NULL,SOCK_NONBLOCK|SOCK_CLOEXEC)) >= 0){
+		for(i = 0; i < nsubs && subs[i].fd >= 0; i++)
+			;
+		if(i == MAXSUBS){
+			close(fd);                      /* too many observers */
+			continue;
+		}
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+		struct epoll_event ev = { .events = EPOLLIN, .data.fd = base-1-i };
+		if(epoll_ctl(epfd,EPOLL_CTL_ADD,fd,&ev) < 0){
+			close(fd);
+			continue;
+		}
+		subs[i].fd = fd;
+		subs[i].cur = head;                 /* from now on */
+		subs[i].events = EPOLLIN;
+		if(i == nsubs) nsubs++;
+		METRIC_INC(observers);
+	}
+}
+
+int subs_start(const char *where,int ep,int tag) {
+	int yes = 1, i;
+
+	if(strchr(where,'/') != NULL){
+		struct sockaddr_un un;
+
+		memset(&un,0,sizeof(un));
+		un.sun_family = AF_UNIX;
+		if(strlen(where) >= sizeof(un.sun_path)) return -1;
+		strcpy(un.sun_path,where);
+		unlink(where);                      /* left by an earlier run */
+		if((lsock = socket(AF_UNIX,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0)) < 0) return -1;
+		if(bind(lsock,(struct sockaddr*)&un,sizeof(un)) < 0) goto fail;
+		upath = strdup(where);
+	}
+	else {
+		struct sockaddr_in in;
+
+		memset(&in,0,sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_port = htons(atoi(where));
+		in.sin_addr.s_addr = htonl(INADDR_ANY);
+		if((lsock = socket(AF_INET,SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC,0)) < 0) return -1;
+		setsockopt(lsock,SOL_SOCKET,SO_REUSEADDR,&yes,sizeof(yes));
+		if(bind(lsock,(struct sockaddr*)&in,sizeof(in)) < 0) goto fail;
+	}
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = tag };
+	if(listen(lsock,MAXSUBS) < 0 || epoll_ctl(ep,EPOLL_CTL_ADD,lsock,&ev) < 0) goto fail;
+	for(i = 0; i < MAXSUBS; i++)
+		subs[i].fd = -1;
+	epfd = ep;
+	base = tag;
+	return 0;
+
+ fail:
+	close(lsock);
+	lsock = -1;
+	return -1;
+}
+
+void subs_event(int tag,uint32_t events) {
+	int i = base-1-tag;
+	char junk[256];
+	ssize_t n;
+
+	if(tag == base){
+		sub_accept();
+		return;
+	}
+	if(i < 0 || i >= nsubs || subs[i].fd < 0) return;
+	if(events & (EPOLLIN|EPOLLHUP|EPOLLERR)){
+		while((n = recv(subs[i].fd,junk,sizeof(junk),MSG_DONTWAIT)) > 0)
+			;                               /* observers have nothing to say */
+		if(n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)){
+			sub_close(i);
+			return;
+		}
+	}
+	if(events & EPOLLOUT) sub_send(i);
+}
+
+void subs_publish(uint8_t type,uint8_t status,uint32_t msgid) {
+	uint8_t *r = ring + head % RINGSIZE;
+
+	if(lsock < 0) return;
+	r[0] = type;
+	r[1] = status;
+	r[2] = msgid;                           /* little endian */
+	r[3] = msgid>>8;
+	r[4] = msgid>>16;
+	r[5] = msgid>>24;
+	head += SUB_RECSZ;
+}
+
+void subs_flush(void) {
+	int i;
+
+	for(i = 0; i < nsubs; i++)
+		if(subs[i].fd >= 0 && subs[i].cur != head && !(subs[i].events & EPOLLOUT))
+			sub_send(i);
+}
+
+void subs_stop(void) {
+	int i;
+
+	if(lsock < 0) return;
+	for(i = 0; i < nsubs; i++)
+		if(subs[i].fd >= 0) sub_close(i);
+	close(lsock);
+	lsock = -1;
+	if(upath != NULL){
+		unlink(upath);
+		free(upath);
+		upath = NULL;
+	}
+}
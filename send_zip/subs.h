@@ -0,0 +1,65 @@
+/*
+ * subs.h -- a stream of every hardware response, for observers
+ *
+ * Description: an observer connects to the subscribe socket (a TCP
+ * port or a Unix socket) and from then on receives a record of every
+ * response the hardware returns, whichever client asked:
+ *
+ *   type     the client's message type (MSG_EXT set for a 32-bit msgid)
+ *   status   the hardware's response status
+ *   msgid    the client's msgid, 32 bits little endian
+ *
+ * Each target of a TBATCH the hardware judges gets a record of its
+ * own, with the TBATCH's type and msgid, so several records may share
+ * one msgid.
+ *
+ * Records go into one ring shared by every observer; each observer has
+ * its own cursor into it and is sent what it has not yet seen once per
+ * pass of the event loop. Nothing waits on an observer: one that falls
+ * a whole ring behind skips to the newest record, or is dropped if it
+ * was part way through a record. Anything an observer sends is
+ * ignored.
+ *
+ */
+#ifndef SUBS_H
+#define SUBS_H
+
+#include <stdint.h>
+
+#define SUB_RECSZ 6							/* type, status, msgid */
+
+/*
+ * subs_start() -- listens for observers at where: a path (anything
+ * containing a '/') for a Unix socket, otherwise a TCP port. Its
+ * descriptors are added to epoll instance ep with data.fd tags from
+ * tag downwards; hand events with those tags to subs_event().
+ *
+ * returns: 0 on success; -1 on error.
+ */
+int subs_start(const char *where,int ep,int tag);
+
+/*
+ * subs_event() -- handles epoll events for a tag given out by
+ * subs_start(): new observers, observers leaving, and observers ready
+ * for more.
+ */
+void subs_event(int tag,uint32_t events);
+
+/*
+ * subs_publish() -- adds the response status to a message of type
+ * type and msgid msgid to the ring.
+ */
+void subs_publish(uint8_t type,uint8_t status,uint32_t msgid);
+
+/*
+ * subs_flush() -- sends each observer what it has not yet seen, as
+ * far as it will take without blocking.
+ */
+void subs_flush(void);
+
+/*
+ * subs_stop() -- disconnects the observers and stops listening
+ */
+void subs_stop(void);
+
+#endif /* SUBS_H */
@@ -0,0 +1,291 @@
+/*
+ * uring.c -- an io_uring for the client sockets (see uring.h)
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "metrics.h"
+#include "uring.h"
+
+#define LOAD(p) __atomic_load_n((p),__ATOMIC_ACQUIRE)
+#define STORE(p,v) __atomic_store_n((p),(v),__ATOMIC_RELEASE)
+
+static int ufd = -1;
+static unsigned *sqhead,*sqtail,*sqarray,sqmask,sqentries;
+static unsigned *cqhead,*cqtail,cqmask;
+static struct io_uring_sqe *sqes;
+static struct io_uring_cqe *cqes;
+static unsigned sqnext;						/* tail once the queued requests are published */
+static unsigned queued;						/* requests not yet submitted */
+static void *sqmap,*cqmap;
+static size_t sqmapsz,cqmapsz,sqesz;
+
+static struct io_uring_buf_ring *bring;		/* provided buffers */
+static uint8_t *bufs;
+static unsigned nbufs,bufsize;
+static uint16_t btail;
+static size_t bringsz;
+
+static int enter(unsigned nsub,unsigned wait) {
+	METRIC_INC(syscalls);
+	return syscall(__NR_io_uring_enter,ufd,nsub,wait,wait ? IORING_ENTER_GETEVENTS : 0,NULL,0);
+}
+
+/* a zeroed submission slot, submitting what is queued if the ring is full */
+static struct io_uring_sqe *getsqe(void) {
+	struct io_uring_sqe *sqe;
+
+	if(queued == sqentries && ur_submit() <= 0)
+		return NULL;
+	sqe = &sqes[sqnext & sqmask];
+	memset(sqe,0,sizeof(*sqe));
+	sqarray[sqnext & sqmask] = sqnext & sqmask;
+	return sqe;
+}
+
+/* publish the slot getsqe() returned */
+static int putsqe(void) {
+	STORE(sqtail,++sqnext);
+	queued++;
+	return 0;
+}
+
+int ur_accept(int sock,uint64_t data) {
+	struct io_uring_sqe *sqe = getsqe();
+
+	if(sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = sock;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->accept_flags = SOCK_CLOEXEC;
+	sqe->user_data = data;
+	return putsqe();
+}
+
+int ur_recv(int fd,uint64_t data) {
+	struct io_uring_sqe *sqe = getsqe();
+
+	if(sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = UR_BGID;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->user_data = data;
+	return putsqe();
+}
+
+int ur_send(int fd,const void *buf,size_t len,uint64_t data) {
+	struct io_uring_sqe *sqe = getsqe();
+
+	if(sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buf;
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = data;
+	return putsqe();
+}
+
+int ur_poll(int fd,unsigned events,uint64_t data) {
+	struct io_uring_sqe *sqe = getsqe();
+
+	if(sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->poll32_events = events;
+	sqe->user_data = data;
+	return putsqe();
+}
+
+int ur_cancel(uint64_t target,uint64_t data) {
+	struct io_uring_sqe *sqe = getsqe();
+
+	if(sqe == NULL)
+		return -1;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->addr = target;
+	sqe->user_data = data;
+	return putsqe();
+}
+
+int ur_submit(void) {
+	int n;
+
+	if(queued == 0)
+		return 0;
+	while((n = enter(queued,0)) < 0 && errno == EINTR)
+		;
+	if(n < 0)
+		return -1;
+	queued -= n;
+	return n;
+}
+
+int ur_wait(void) {
+	int n;
+
+	if(ur_cqe() != NULL)
+		return ur_submit();
+	if((n = enter(queued,1)) < 0)
+		return -1;							/* EINTR: let the caller look at its signals */
+	queued -= n;
+	return n;
+}
+
+struct io_uring_cqe *ur_cqe(void) {
+	unsigned head = *cqhead;
+
+	if(head == LOAD(cqtail))
+		return NULL;
+	return &cqes[head & cqmask];
+}
+
+void ur_seen(void) {
+	STORE(cqhead,*cqhead+1);
+}
+
+uint8_t *ur_buf(unsigned bid) {
+	return bufs + (size_t)bid*bufsize;
+}
+
+void ur_buf_put(unsigned bid) {
+	struct io_uring_buf *b = &bring->bufs[btail & (nbufs-1)];
+
+	b->addr = (uint64_t)(uintptr_t)ur_buf(bid);	/* not resv: in bufs[0] it is the tail */
+	b->len = bufsize;
+	b->bid = bid;
+	STORE(&bring->tail,++btail);
+}
+
+/* map the rings of a new io_uring */
+static int ur_map(struct io_uring_params *p) {
+	sqmapsz = p->sq_off.array + p->sq_entries*sizeof(unsigned);
+	cqmapsz = p->cq_off.cqes + p->cq_entries*sizeof(struct io_uring_cqe);
+	if((p->features & IORING_FEAT_SINGLE_MMAP) && cqmapsz > sqmapsz)
+		sqmapsz = cqmapsz;
+	sqmap = mmap(NULL,sqmapsz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ufd,IORING_OFF_SQ_RING);
+	if(sqmap == MAP_FAILED)
+		return -1;
+	if(p->features & IORING_FEAT_SINGLE_MMAP)
+		cqmap = sqmap;
+	else if((cqmap = mmap(NULL,cqmapsz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ufd,IORING_OFF_CQ_RING)) == MAP_FAILED)
+		return -1;
+	sqesz = p->sq_entries*sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL,sqesz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ufd,IORING_OFF_SQES);
+	if(sqes == MAP_FAILED)
+		return -1;
+
+	sqhead = (unsigned*)((char*)sqmap + p->sq_off.head);
+	sqtail = (unsigned*)((char*)sqmap + p->sq_off.tail);
+	sqmask = *(unsigned*)((char*)sqmap + p->sq_off.ring_mask);
+	sqarray = (unsigned*)((char*)sqmap + p->sq_off.array);
+	sqentries = p->sq_entries;
+	cqhead = (unsigned*)((char*)cqmap + p->cq_off.head);
+	cqtail = (unsigned*)((char*)cqmap + p->cq_off.tail);
+	cqmask = *(unsigned*)((char*)cqmap + p->cq_off.ring_mask);
+	cqes = (struct io_uring_cqe*)((char*)cqmap + p->cq_off.cqes);
+	sqnext = *sqtail;
+	return 0;
+}
+
+/* register nbuf provided buffers of bufsz bytes and fill the ring with them */
+static int ur_bufs(unsigned nbuf,unsigned bufsz) {
+	struct io_uring_buf_reg reg;
+	unsigned i;
+
+	nbufs = nbuf;
+	bufsize = bufsz;
+	bringsz = nbuf*sizeof(struct io_uring_buf);
+	bring = mmap(NULL,bringsz,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_POPULATE,-1,0);
+	if(bring == MAP_FAILED) {
+		bring = NULL;
+		return -1;
+	}
+	if((bufs = malloc((size_t)nbuf*bufsz)) == NULL)
+		return -1;
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)bring;
+	reg.ring_entries = nbuf;
+	reg.bgid = UR_BGID;
+	if(syscall(__NR_io_uring_register,ufd,IORING_REGISTER_PBUF_RING,&reg,1) < 0)
+		return -1;
+	btail = 0;
+	for(i=0; i<nbuf; i++)
+		ur_buf_put(i);
+	return 0;
+}
+
+/* a multishot recv over a socket pair must deliver into a provided buffer and stay armed */
+static int ur_selftest(void) {
+	struct io_uring_cqe *cqe;
+	int sv[2], ok = 0;
+
+	if(socketpair(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0,sv) < 0)
+		return -1;
+	if(ur_recv(sv[0],0) == 0 && ur_submit() == 1 && write(sv[1],"x",1) == 1 &&
+	   (ur_cqe() != NULL || enter(0,1) >= 0) && (cqe = ur_cqe()) != NULL) {
+		ok = cqe->res == 1 && (cqe->flags & IORING_CQE_F_MORE) && (cqe->flags & IORING_CQE_F_BUFFER);
+		if(cqe->flags & IORING_CQE_F_BUFFER)
+			ur_buf_put(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+		ur_seen();
+	}
+	close(sv[1]);							/* ends the recv */
+	while(ok && (cqe = ur_cqe()) == NULL && enter(0,1) >= 0)
+		;
+	if(ok && cqe != NULL) {
+		ok = cqe->res == 0 && !(cqe->flags & IORING_CQE_F_MORE);
+		ur_seen();
+	}
+	close(sv[0]);
+	return ok ? 0 : -1;
+}
+
+int ur_init(unsigned entries,unsigned nbuf,unsigned bufsz) {
+	struct io_uring_params p;
+
+	memset(&p,0,sizeof(p));
+	if((ufd = syscall(__NR_io_uring_setup,entries,&p)) < 0)
+		return -1;
+	if(!(p.features & IORING_FEAT_NODROP) || ur_map(&p) < 0 ||
+	   ur_bufs(nbuf,bufsz) < 0 || ur_selftest() < 0) {
+		ur_exit();
+		return -1;
+	}
+	return 0;
+}
+
+void ur_exit(void) {
+	if(ufd >= 0)
+		close(ufd);							/* cancels whatever is outstanding */
+	ufd = -1;
+	if(sqes != NULL && sqes != MAP_FAILED)
+		munmap(sqes,sqesz);
+	if(cqmap != NULL && cqmap != MAP_FAILED && cqmap != sqmap)
+		munmap(cqmap,cqmapsz);
+	if(sqmap != NULL && sqmap != MAP_FAILED)
+		munmap(sqmap,sqmapsz);
+	if(bring != NULL)
+		munmap(bring,bringsz);
+	free(bufs);
+	sqes = NULL;
+	sqmap = cqmap = NULL;
+	bring = NULL;
+	bufs = NULL;
+	queued = 0;
+}
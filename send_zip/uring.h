@@ -0,0 +1,100 @@
+/*
+ * uring.h -- an io_uring for the client sockets, without liburing
+ *
+ * Description: one submission and completion ring, set up with the
+ * raw system calls and mapped into the process. Requests are queued
+ * in the submission ring and handed to the kernel together by one
+ * io_uring_enter() (ur_submit()), however many sockets they are for;
+ * completions are read straight out of shared memory, with no system
+ * call at all. An event loop can wait in the same call that submits
+ * (ur_wait()), and have the ring watch an epoll descriptor for
+ * everything else with a multishot poll.
+ *
+ * Receives are multishot and take their buffers from a ring of
+ * provided buffers (group UR_BGID): one armed recv keeps delivering
+ * whatever arrives, each completion naming the buffer it filled, which
+ * goes back to the ring with ur_buf_put() once it has been copied out.
+ * Accepts are multishot too. Every request carries 64 bits of
+ * user_data that come back in its completions.
+ *
+ * Only the thread that called ur_init() may use the ring.
+ *
+ */
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#define UR_BGID 0							/* provided buffer group */
+
+/*
+ * ur_init() -- sets up a ring of entries submissions and nbuf provided
+ * buffers of bufsz bytes (nbuf a power of two), then checks that the
+ * kernel can run a multishot recv into them.
+ *
+ * returns: 0 on success; -1 if io_uring, or a feature of it this needs,
+ * is unavailable.
+ */
+int ur_init(unsigned entries,unsigned nbuf,unsigned bufsz);
+
+/*
+ * ur_accept() -- queues a multishot accept on the listening socket sock.
+ * ur_recv() -- queues a multishot recv on fd into provided buffers.
+ * ur_send() -- queues a send of len bytes at buf, which must stay put
+ * until it completes.
+ * ur_poll() -- queues a multishot poll of fd for events (POLLIN...),
+ * completing each time fd is woken.
+ * ur_cancel() -- queues a cancel of the request carrying target.
+ *
+ * returns: 0 on success; -1 if the ring was full and could not be
+ * submitted.
+ */
+int ur_accept(int sock,uint64_t data);
+int ur_recv(int fd,uint64_t data);
+int ur_send(int fd,const void *buf,size_t len,uint64_t data);
+int ur_poll(int fd,unsigned events,uint64_t data);
+int ur_cancel(uint64_t target,uint64_t data);
+
+/*
+ * ur_submit() -- hands every queued request to the kernel
+ *
+ * returns: the number submitted; -1 on error.
+ */
+int ur_submit(void);
+
+/*
+ * ur_wait() -- hands every queued request to the kernel and, unless a
+ * completion is already waiting, blocks until one is posted
+ *
+ * returns: the number submitted; -1 on error, including EINTR.
+ */
+int ur_wait(void);
+
+/*
+ * ur_cqe() -- the oldest completion not yet seen, which stays valid
+ * until ur_seen().
+ *
+ * returns: the completion; NULL if there is none.
+ */
+struct io_uring_cqe *ur_cqe(void);
+
+/*
+ * ur_seen() -- releases the completion ur_cqe() returned
+ */
+void ur_seen(void);
+
+/*
+ * ur_buf() -- the provided buffer bid, named by a completion
+ * ur_buf_put() -- gives buffer bid back to the ring
+ */
+uint8_t *ur_buf(unsigned bid);
+void ur_buf_put(unsigned bid);
+
+/*
+ * ur_exit() -- cancels everything outstanding and frees the ring
+ */
+void ur_exit(void);
+
+#endif /* URING_H */
@@ -0,0 +1,93 @@
+/*
+ * zonecheck.c -- checks circle zones against the exact distance
+ *
+ * Description: stores circle AOZs, one at a time, of any radius up to
+ * CIRCLE_MAX at any latitude, and checks each at CHECKPTS points within
+ * twice its radius against the haversine distance. Points within a
+ * centimetre of the edge are skipped, either answer will do there.
+ * Exits with failure at the first disagreement; run by make check.
+ *
+ * usage: zonecheck [circles]
+ *
+ */
+#include <stdio.h>							/* printf */
+#include <stdlib.h>							/* exit codes */
+#include <stdint.h>							/* uint8_t */
+#include <string.h>
+#include <math.h>
+#include "hw.h"
+#include "defs.h"
+#include "msg.h"
+#include "zones.h"
+
+#define CIRCLES 1000						/* default circles checked */
+#define CHECKPTS 2000						/* points checked against each circle */
+
+static uint64_t rng = 88172645463325252ull;
+
+static double uniform(void) {				/* [0,1) */
+	rng ^= rng << 13;
+	rng ^= rng >> 7;
+	rng ^= rng << 17;
+	return (rng >> 11) * (1.0/9007199254740992.0);
+}
+
+/* a corner in the target layout back to radians, as zones.c reads it */
+static void getcorner(const uint8_t *bp,double *lat,double *lng) {
+	int d = (int8_t)bp[0], ld = (int16_t)(bp[3] | bp[4]<<8);
+	int32_t s = bp[1]*60 + bp[2], ls = bp[5]*60 + bp[6];
+
+	*lat = (d < 0 ? d*3600 - s : d*3600 + s) / ARCSEC;
+	*lng = (ld < 0 ? ld*3600 - ls : ld*3600 + ls) / ARCSEC;
+}
+
+/* great circle distance in metres */
+static double haversine(double lat1,double lng1,double lat2,double lng2) {
+	double a = sin((lat2-lat1)/2), b = sin((lng2-lng1)/2);
+
+	return 2*EARTH_R * asin(sqrt(a*a + cos(lat1)*cos(lat2)*b*b));
+}
+
+int main(int argc,char *argv[]) {
+	uint8_t circ[CSIZE],pt[CSIZE],target[TSIZE];
+	double clat,clng,tlat,tlng,r,d,b,lat,lng;
+	long i,k,n,checked = 0;
+	int in;
+
+	n = argc > 1 ? atol(argv[1]) : CIRCLES;
+	if(n <= 0)
+		errorExit("usage: zonecheck [circles]\n");
+	for(i=0; i<n; i++) {
+		zones_reset();
+		r = floor(1 + uniform()*(CIRCLE_MAX-1));	/* whole metres, as sent */
+		if(i%4 == 0)
+			r = floor(1 + uniform()*100000);	/* and plenty of small ones */
+		msgmakecircle(circ,AOZ,(int32_t)((uniform()*178-89)*3600),(int32_t)((uniform()*360-180)*3600),r);
+		if(checkTables(circ,CSIZE) != 2)
+			errorExit("zonecheck: circle not stored\n");
+		getcorner(circ+1,&clat,&clng);
+		for(k=0; k<CHECKPTS; k++) {				/* a point at distance d on bearing b */
+			d = uniform()*2*r / EARTH_R;
+			b = uniform()*2*M_PI;
+			lat = asin(sin(clat)*cos(d) + cos(clat)*sin(d)*cos(b));
+			lng = clng + atan2(sin(b)*sin(d)*cos(clat),cos(d) - sin(clat)*sin(lat));
+			lng = remainder(lng,2*M_PI);
+			msgmakecircle(pt,AOZ,(int32_t)lrint(lat*ARCSEC),(int32_t)lrint(lng*ARCSEC),1);
+			memcpy(target+1,pt+1,7);			/* the corner, whole arc-seconds */
+			target[0] = TARGET;
+			getcorner(target+1,&tlat,&tlng);
+			d = haversine(clat,clng,tlat,tlng);
+			if(fabs(d-r) < 0.01)
+				continue;						/* on the edge: either answer will do */
+			in = checkTables(target,TSIZE) == 0;
+			if(in != (d <= r)) {
+				printf("zonecheck: circle r=%.0fm at %.4f,%.4f: point %.0fm away judged %s\n",
+					   r,clat*180/M_PI,clng*180/M_PI,d,in ? "inside" : "outside");
+				exit(EXIT_FAILURE);
+			}
+			checked++;
+		}
+	}
+	printf("zonecheck: %ld circles, %ld points agree\n",n,checked);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,654 @@
+/*
+ * zones.c -- the AOZ and EZ store (see zones.h)
+ *
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "msg.h"
+#include "zones.h"
+
+#define LAT_LO  0							/* columns of a table row */
+#define LAT_HI  1
+#define LONG_LO 2
+#define LONG_HI 3
+
+zonestats_t zonestats;
+
+#define STAT_ADD(f,n) atomic_fetch_add_explicit(&zonestats.f,(n),memory_order_relaxed)
+
+/*
+ * Polygons are kept as edge tables, LANES edges to a vector so the
+ * crossing-number test runs on LANES edges at once (SSE on x86, NEON
+ * on ARM). Each polygon's edges are padded to a whole vector with
+ * flat edges, which never cross. Coordinates are floats: exact for
+ * arc-seconds, and a point within a fraction of an arc-second of an
+ * edge may fall either side of it.
+ */
+#define LANES 4
+#define MAXVEC ((MAXVERT+LANES-1)/LANES)	/* most edge vectors of a polygon */
+
+typedef float vf_t __attribute__((vector_size(LANES*sizeof(float))));
+typedef int32_t vi_t __attribute__((vector_size(LANES*sizeof(int32_t))));
+
+typedef struct edges {						/* LANES edges from (y0,x0) to (y1,...) */
+	vf_t y0,y1,x0;
+	vf_t k;									/* dx/dy; 0 for a flat edge */
+} edges_t;
+
+/*
+ * A circle is tested with an equirectangular distance, the longitude
+ * difference scaled by the mean of the cosines of the two latitudes
+ * (the center's is precomputed, the target's is worked out once per
+ * check). Its error is under (radius^2 / 4cos^2 lat) of the radius,
+ * lat being the circle's furthest latitude from the equator; only a
+ * target that close to the edge pays for the exact haversine test. A
+ * circle that comes within POLAR of a pole, or so large that the error
+ * bound reaches half its radius, always takes the exact test.
+ */
+#define POLAR (80/180.0*M_PI)
+
+typedef struct circle {
+	double lat,lng;							/* center, radians */
+	double coslat;
+	double lo2,hi2;							/* squared distance (radians) surely inside, surely outside */
+	double hav;								/* sin^2(radius/2), for the exact test */
+	int exact;								/* near a pole: always the exact test */
+} circle_t;
+
+typedef struct point {						/* a target, ready for the circle test */
+	double lat,lng,coslat;
+} point_t;
+
+typedef struct zone {
+	struct zone *hnext;						/* hash chain */
+	struct zone *tnext,**tprev;				/* timer wheel slot, if it expires */
+	uint64_t hash;							/* of its record, to find it again */
+	uint32_t expires;						/* wheel time it expires; 0 for never */
+	int row;								/* in its table */
+	uint8_t table;
+	uint8_t nvec;							/* edge vectors of a polygon */
+	uint8_t reclen;
+	uint8_t *rec;							/* its record, for zones_save() */
+	union {
+		edges_t *edge;						/* a polygon */
+		circle_t *circ;						/* a circle */
+	};
+} zone_t;
+
+/* -------- arena -------- */
+
+/*
+ * Zones and edge tables are carved from CHUNK-byte chunks. A freed
+ * piece goes on the free list for its size class and is reused before
+ * the arena grows; chunks go back to malloc only on zones_reset().
+ */
+#define CHUNK (64*1024)
+#define ALIGN 64							/* pieces do not share cache lines */
+#define NCLASS 8							/* zone_t, 1, 2, 4 and 8 edge vectors, circle_t, short and long records */
+#define CIRCLASS 5
+#define RECCLASS 6
+#define RECSHORT 64							/* a box, a circle, a polygon of up to 8 vertices */
+
+static void *freelist[NCLASS];
+static uint8_t *chunks;						/* every chunk, linked through its first bytes */
+static uint8_t *carve;						/* unused end of the newest chunk */
+static size_t carvelen;
+
+static size_t classsize(int cls) {
+	size_t n = cls == 0 ? sizeof(zone_t) : cls == CIRCLASS ? sizeof(circle_t) :
+		cls == RECCLASS ? RECSHORT : cls == RECCLASS+1 ? PSIZE(MAXVERT)-1 : sizeof(edges_t) << (cls-1);
+	return (n+ALIGN-1) & ~(size_t)(ALIGN-1);
+}
+
+/* the smallest class holding nvec edge vectors */
+static int edgeclass(int nvec) {
+	int cls = 1;
+	while ((1 << (cls-1)) < nvec) cls++;
+	return cls;
+}
+
+static int recclass(int len) {
+	return len <= RECSHORT ? RECCLASS : RECCLASS+1;
+}
+
+static void *arena_get(int cls) {
+	size_t n = classsize(cls);
+	void *p;
+
+	if ((p = freelist[cls]) != NULL){
+		freelist[cls] = *(void**)p;
+		return p;
+	}
+	if (carvelen < n){                      /* the rest of this chunk is lost */
+		uint8_t *c = aligned_alloc(ALIGN,CHUNK);
+		if (c == NULL) return NULL;
+		*(uint8_t**)c = chunks;
+		chunks = c;
+		carve = c + ALIGN;
+		carvelen = CHUNK - ALIGN;
+		STAT_ADD(bytes,CHUNK);
+	}
+	p = carve;
+	carve += n;
+	carvelen -= n;
+	return p;
+}
+
+static void arena_put(int cls,void *p) {
+	*(void**)p = freelist[cls];
+	freelist[cls] = p;
+}
+
+/* -------- tables -------- */
+
+#define AOZBOX  0							/* the tables a target is checked against */
+#define EZBOX   1
+#define AOZPOLY 2
+#define EZPOLY  3
+#define AOZCIRC 4
+#define EZCIRC  5
+#define NTABLE  6
+
+typedef struct table {
+	int n, cap;
+	int32_t (*box)[4];						/* bounds, packed: the rows a lookup scans */
+	zone_t **zone;							/* the zone of each row */
+} table_t;
+
+static table_t tab[NTABLE];
+static uint32_t nzones, maxzones = ZONES_MAX;
+
+static int row_add(table_t *t,zone_t *z,const int32_t box[4]) {
+	if (t->n == t->cap){                    /* double the table */
+		int cap = t->cap ? 2*t->cap : 64;
+		int32_t (*b)[4] = realloc(t->box,cap*sizeof(*b));
+		zone_t **zp;
+		if (b == NULL) return -1;
+		t->box = b;
+		if ((zp = realloc(t->zone,cap*sizeof(*zp))) == NULL) return -1;
+		t->zone = zp;
+		t->cap = cap;
+	}
+	memcpy(t->box[t->n],box,sizeof(t->box[0]));
+	t->zone[t->n] = z;
+	z->row = t->n++;
+	return 0;
+}
+
+/* move the last row into the hole, so the rows stay packed */
+static void row_del(table_t *t,int row) {
+	if (row != --t->n){
+		memcpy(t->box[row],t->box[t->n],sizeof(t->box[0]));
+		t->zone[row] = t->zone[t->n];
+		t->zone[row]->row = row;
+	}
+}
+
+/* -------- hash of zones, to find one to delete -------- */
+
+static zone_t **htab;
+static uint32_t hsize;						/* buckets, a power of two */
+
+static uint64_t rechash(const uint8_t *bp,int len) {
+	uint64_t h = 14695981039346656037ull;	/* FNV-1a */
+	while (len--){
+		h ^= *bp++;
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static int hash_add(zone_t *z) {
+	uint32_t i;
+
+	if (nzones >= hsize){                   /* keep chains short: rehash at load 1 */
+		uint32_t n = hsize ? 2*hsize : 256;
+		zone_t **h = calloc(n,sizeof(zone_t*)), *p, *next;
+		if (h == NULL) return -1;
+		for (i = 0; i < hsize; i++)
+			for (p = htab[i]; p != NULL; p = next){
+				next = p->hnext;
+				p->hnext = h[p->hash & (n-1)];
+				h[p->hash & (n-1)] = p;
+			}
+		free(htab);
+		htab = h;
+		hsize = n;
+	}
+	z->hnext = htab[z->hash & (hsize-1)];
+	htab[z->hash & (hsize-1)] = z;
+	return 0;
+}
+
+static void hash_del(zone_t *z) {
+	zone_t **pp = &htab[z->hash & (hsize-1)];
+
+	while (*pp != z) pp = &(*pp)->hnext;
+	*pp = z->hnext;
+}
+
+/* -------- timer wheel -------- */
+
+/*
+ * WLEVELS wheels of WSLOTS one-second slots, each slot of a level
+ * spanning a whole turn of the level below. A zone is filed by how far
+ * off its expiry is; when a level's slot comes round its zones are
+ * refiled lower down, and those in the current level 0 slot expire.
+ */
+#define WBITS 6
+#define WSLOTS (1<<WBITS)
+#define WLEVELS 4							/* 2^24 seconds, well past a 16-bit ttl */
+
+static zone_t *wheel[WLEVELS][WSLOTS];
+static uint32_t wnow;						/* the second the wheel has reached */
+
+static void timer_add(zone_t *z) {
+	uint32_t d = z->expires - wnow;
+	int lvl = 0;
+	zone_t **slot;
+
+	while (lvl < WLEVELS-1 && d >= 1u << (WBITS*(lvl+1))) lvl++;
+	slot = &wheel[lvl][(z->expires >> (WBITS*lvl)) & (WSLOTS-1)];
+	if ((z->tnext = *slot) != NULL) z->tnext->tprev = &z->tnext;
+	z->tprev = slot;
+	*slot = z;
+}
+
+static void timer_del(zone_t *z) {
+	if ((*z->tprev = z->tnext) != NULL) z->tnext->tprev = z->tprev;
+}
+
+/* -------- the store -------- */
+
+/* give a zone, its edges or circle and its record back to the arena */
+static void zone_free(zone_t *z) {
+	if (z->edge != NULL) arena_put(z->nvec ? edgeclass(z->nvec) : CIRCLASS,z->edge);
+	if (z->rec != NULL) arena_put(recclass(z->reclen),z->rec);
+	arena_put(0,z);
+}
+
+static void zone_del(zone_t *z) {
+	row_del(&tab[z->table],z->row);
+	hash_del(z);
+	if (z->expires){
+		timer_del(z);
+		STAT_ADD(expiring,-1);
+	}
+	zone_free(z);
+	nzones--;
+	STAT_ADD(stored,-1);
+}
+
+/* degrees, minutes and seconds to signed arc-seconds */
+static int32_t arcsec(int deg,uint8_t min,uint8_t sec) {
+	int32_t s = min*60 + sec;
+	return deg < 0 ? deg*3600 - s : deg*3600 + s;
+}
+
+/* decode a corner in the target layout: lat deg/min/sec, long deg (LE)/min/sec */
+static void corner(const uint8_t *bp,int32_t *lat,int32_t *lng) {
+	*lat = arcsec((int8_t)bp[0],bp[1],bp[2]);
+	*lng = arcsec((int16_t)(bp[3] | bp[4]<<8),bp[5],bp[6]);
+}
+
+static int inside(const int32_t row[4],int32_t lat,int32_t lng) {
+	return lat >= row[LAT_LO] && lat <= row[LAT_HI] &&
+		lng >= row[LONG_LO] && lng <= row[LONG_HI];
+}
+
+/* the table for a zone record of at most have bytes, and its length; -1 if not a zone */
+static int rectable(const uint8_t *rec,int have,int *len) {
+	if (have < 1) return -1;
+	switch (rec[0]){
+	case AOZ: *len = A_ESIZE-1; return have < *len ? -1 : AOZBOX;
+	case EZ:  *len = A_ESIZE-1; return have < *len ? -1 : EZBOX;
+	case AOZ|MSG_POLY:
+	case EZ|MSG_POLY:
+		if (have < 2 || rec[1] < 3 || rec[1] > MAXVERT) return -1;
+		*len = PSIZE(rec[1])-1;
+		if (*len > have) return -1;
+		return rec[0] == (AOZ|MSG_POLY) ? AOZPOLY : EZPOLY;
+	case AOZ|MSG_CIRCLE:
+	case EZ|MSG_CIRCLE: {
+		if (have < CSIZE-1) return -1;		/* before the radius is read */
+		uint32_t r = rec[8] | rec[9]<<8 | rec[10]<<16 | (uint32_t)rec[11]<<24;
+		if (r == 0 || r > CIRCLE_MAX) return -1;
+		*len = CSIZE-1;
+		return rec[0] == (AOZ|MSG_CIRCLE) ? AOZCIRC : EZCIRC;
+	}
+	}
+	return -1;
+}
+
+/* the bounds of a circle record, which hold the whole circle, and its circle_t */
+static void circbounds(const uint8_t *rec,int32_t box[4],circle_t *c) {
+	int32_t lat,lng,dlat,dlng;
+	double r = (rec[8] | rec[9]<<8 | rec[10]<<16 | (uint32_t)rec[11]<<24) / EARTH_R;
+	double clat,far,band;
+
+	corner(rec+1,&lat,&lng);
+	clat = lat / ARCSEC;
+	far = fabs(clat) + r;
+	dlat = ceil(r*ARCSEC) + 1;
+	box[LAT_LO] = lat - dlat;
+	box[LAT_HI] = lat + dlat;
+	box[LONG_LO] = INT32_MIN;				/* over a pole or the antimeridian: any longitude */
+	box[LONG_HI] = INT32_MAX;
+	if (far < M_PI/2){                      /* widest at the latitude where the meridians touch it */
+		dlng = ceil(asin(sin(r) / cos(clat)) * ARCSEC) + 1;
+		if (lng-dlng >= -180*3600 && lng+dlng <= 180*3600){
+			box[LONG_LO] = lng - dlng;
+			box[LONG_HI] = lng + dlng;
+		}
+	}
+	if (c == NULL) return;
+	c->lat = clat;
+	c->lng = lng / ARCSEC;
+	c->coslat = cos(clat);
+	band = far > POLAR ? 0 : 1e-6 + r*r / (4*cos(far)*cos(far));
+	c->exact = far > POLAR || band >= 0.5;	/* the bound says nothing for a circle that big */
+	c->lo2 = r*(1-band) * r*(1-band);
+	c->hi2 = r*(1+band) * r*(1+band);
+	c->hav = sin(r/2) * sin(r/2);
+}
+
+/* the bounds of a zone record, and its edges if a polygon or its circle */
+static void recbounds(const uint8_t *rec,int32_t box[4],zone_t *z) {
+	int32_t lat[MAXVERT],lng[MAXVERT];
+	int i, n = 2;
+
+	if (MSG_SHAPE(rec[0]) == MSG_CIRCLE){
+		circbounds(rec,box,z ? z->circ : NULL);
+		return;
+	}
+	if (MSG_SHAPE(rec[0]) == MSG_POLY){
+		n = rec[1];
+		rec++;
+	}
+	for (i = 0; i < n; i++){
+		corner(rec+1+7*i,&lat[i],&lng[i]);
+		if (i == 0 || lat[i] < box[LAT_LO]) box[LAT_LO] = lat[i];
+		if (i == 0 || lat[i] > box[LAT_HI]) box[LAT_HI] = lat[i];
+		if (i == 0 || lng[i] < box[LONG_LO]) box[LONG_LO] = lng[i];
+		if (i == 0 || lng[i] > box[LONG_HI]) box[LONG_HI] = lng[i];
+	}
+	if (z == NULL || z->edge == NULL) return;
+	for (i = 0; i < (n+LANES-1)/LANES*LANES; i++){  /* edge i runs from vertex i to i+1 */
+		edges_t *e = &z->edge[i/LANES];
+		int l = i%LANES, j = (i+1)%n;
+		if (i >= n){                        /* padding */
+			e->y0[l] = e->y1[l] = e->x0[l] = e->k[l] = 0;
+			continue;
+		}
+		e->y0[l] = lat[i];
+		e->y1[l] = lat[j];
+		e->x0[l] = lng[i];
+		e->k[l] = lat[i] == lat[j] ? 0 : (float)(lng[j]-lng[i]) / (lat[j]-lat[i]);
+	}
+}
+
+/* store the zone record rec, in have bytes, to expire after ttl seconds if ttl > 0 */
+static zone_t *zone_add(const uint8_t *rec,int have,uint16_t ttl) {
+	int32_t box[4];
+	int len, t = rectable(rec,have,&len);
+	zone_t *z;
+
+	if (t < 0 || nzones >= maxzones || (z = arena_get(0)) == NULL) return NULL;
+	memset(z,0,sizeof(*z));
+	z->table = t;
+	z->hash = rechash(rec,len);
+	if (t == AOZPOLY || t == EZPOLY){
+		z->nvec = (rec[1]+LANES-1)/LANES;
+		if ((z->edge = arena_get(edgeclass(z->nvec))) == NULL){
+			arena_put(0,z);
+			return NULL;
+		}
+	}
+	if ((t == AOZCIRC || t == EZCIRC) && (z->circ = arena_get(CIRCLASS)) == NULL){
+		arena_put(0,z);
+		return NULL;
+	}
+	if ((z->rec = arena_get(recclass(len))) == NULL) goto fail;
+	memcpy(z->rec,rec,len);
+	z->reclen = len;
+	recbounds(rec,box,z);
+	if (row_add(&tab[t],z,box) < 0) goto fail;
+	if (hash_add(z) < 0){
+		row_del(&tab[t],z->row);
+		goto fail;
+	}
+	nzones++;
+	STAT_ADD(stored,1);
+	if (ttl > 0){
+		z->expires = wnow + ttl;
+		timer_add(z);
+		STAT_ADD(expiring,1);
+	}
+	return z;
+
+ fail:
+	zone_free(z);
+	return NULL;
+}
+
+/* delete a zone stored from the same record, in have bytes */
+static int zone_find_del(const uint8_t *rec,int have) {
+	int32_t box[4];
+	int len, t = rectable(rec,have,&len);
+	uint64_t h;
+	zone_t *z;
+
+	if (t < 0 || hsize == 0) return -1;
+	h = rechash(rec,len);
+	recbounds(rec,box,NULL);
+	for (z = htab[h & (hsize-1)]; z != NULL; z = z->hnext)
+		if (z->hash == h && z->table == t && memcmp(tab[t].box[z->row],box,sizeof(box)) == 0){
+			zone_del(z);
+			STAT_ADD(deleted,1);
+			return 2;
+		}
+	return -1;
+}
+
+/* crossing number: is (lat,lng) inside polygon z? */
+static int inpoly(const zone_t *z,int32_t lat,int32_t lng) {
+	const edges_t *e = z->edge, *end = e + z->nvec;
+	vf_t y = { lat, lat, lat, lat }, x = { lng, lng, lng, lng };
+	vi_t odd = { 0, 0, 0, 0 };
+
+	for (; e < end; e++){                   /* edges that straddle y and cross right of x */
+		vi_t straddle = (e->y0 > y) != (e->y1 > y);
+		odd ^= straddle & (x < e->x0 + (y - e->y0) * e->k);
+	}
+	return (odd[0] ^ odd[1] ^ odd[2] ^ odd[3]) != 0;
+}
+
+/* is p within circle c? */
+static int incircle(const circle_t *c,const point_t *p) {
+	double dlat = p->lat - c->lat, dlng = p->lng - c->lng, dx, d2, h;
+
+	if (dlng > M_PI) dlng -= 2*M_PI;        /* the short way round */
+	else if (dlng < -M_PI) dlng += 2*M_PI;
+	if (!c->exact){
+		dx = dlng * 0.5 * (c->coslat + p->coslat);
+		d2 = dx*dx + dlat*dlat;
+		if (d2 <= c->lo2) return 1;
+		if (d2 > c->hi2) return 0;
+	}
+	h = sin(dlat/2);                        /* near the edge: haversine */
+	dx = sin(dlng/2);
+	h = h*h + c->coslat * p->coslat * dx*dx;
+	return h <= c->hav;
+}
+
+static int inbox(const table_t *t,int32_t lat,int32_t lng) {
+	int i;
+
+	for (i = 0; i < t->n; i++)
+		if (inside(t->box[i],lat,lng)) return 1;
+	return 0;
+}
+
+static int inpolys(const table_t *t,int32_t lat,int32_t lng) {
+	int i;
+
+	for (i = 0; i < t->n; i++)
+		if (inside(t->box[i],lat,lng) && inpoly(t->zone[i],lat,lng)) return 1;
+	return 0;
+}
+
+static int incircles(const table_t *t,int32_t lat,int32_t lng,const point_t *p) {
+	int i;
+
+	for (i = 0; i < t->n; i++)
+		if (inside(t->box[i],lat,lng) && incircle(t->zone[i]->circ,p)) return 1;
+	return 0;
+}
+
+int checkTables(const uint8_t *msg,int size){
+    int32_t lat,lng;
+    point_t p;
+
+    switch (MSG_TYPE(msg[0])){
+    case ZDEL: return zone_find_del(msg+1,size-2);     /* less the type and msgid */
+    case ZTTL: return size < 4 ? -1 : zone_add(msg+3,size-4,msg[1] | msg[2]<<8) ? 2 : -1;
+    case TARGET: break;
+    default: {                              /* a zone: insert into the appropiate table */
+        uint8_t rec[PSIZE(MAXVERT)-1];
+        if (size < 2 || size-1 > sizeof(rec)) return -1;
+        memcpy(rec,msg,size-1);             /* the record is the legacy zone less its msgid */
+        rec[0] = MSG_TYPE(rec[0]);
+        return zone_add(rec,size-1,0) ? 2 : -1;
+    }
+    }
+
+    corner(msg+1,&lat,&lng);                /* the target */
+    if (tab[AOZCIRC].n || tab[EZCIRC].n){
+        p.lat = lat / ARCSEC;
+        p.lng = lng / ARCSEC;
+        p.coslat = cos(p.lat);
+    }
+    /* within at least one AOZ */
+    if (!inbox(&tab[AOZBOX],lat,lng) && !inpolys(&tab[AOZPOLY],lat,lng) &&
+        !incircles(&tab[AOZCIRC],lat,lng,&p)) return -1;
+    /* and outside every EZ */
+    if (inbox(&tab[EZBOX],lat,lng) || inpolys(&tab[EZPOLY],lat,lng) ||
+        incircles(&tab[EZCIRC],lat,lng,&p)) return -1;
+    return 0;
+}
+
+int zones_bulk(const uint8_t *msg,int size){
+    int count = msg[3] | msg[4]<<8;
+    int end = size - ((msg[0] & MSG_EXT) ? 4 : 1);     /* records end at the msgid */
+    zone_t **added;
+    int i, off, len = 0;
+
+    /* check every record, and that they all fit, before storing any */
+    for (i = 0, off = BULK_HDR; i < count; i++, off += len)
+        if (off >= end || rectable(msg+off,end-off,&len) < 0) return -1;
+    if (off != end || nzones+count > maxzones) return -1;
+    if ((added = malloc(count*sizeof(zone_t*))) == NULL) return -1;
+
+    for (i = 0, off = BULK_HDR; i < count; i++, off += len){
+        rectable(msg+off,end-off,&len);
+        if ((added[i] = zone_add(msg+off,len,0)) == NULL){    /* out of memory: undo */
+            while (i--) zone_del(added[i]);
+            free(added);
+            return -1;
+        }
+    }
+    free(added);
+    return 2;
+}
+
+int zones_expire(uint32_t now){
+    int lvl, n = 0;
+    zone_t *z, *next;
+
+    if (atomic_load_explicit(&zonestats.expiring,memory_order_relaxed) == 0){
+        wnow = now;                         /* nothing to expire: jump */
+        return 0;
+    }
+    while (wnow != now){
+        wnow++;
+        /* at the turn of a level, refile its current slot lower down */
+        for (lvl = 1; lvl < WLEVELS && (wnow & ((1u << (WBITS*lvl))-1)) == 0; lvl++){
+            zone_t **slot = &wheel[lvl][(wnow >> (WBITS*lvl)) & (WSLOTS-1)];
+            for (z = *slot, *slot = NULL; z != NULL; z = next){
+                next = z->tnext;
+                timer_add(z);
+            }
+        }
+        for (z = wheel[0][wnow & (WSLOTS-1)]; z != NULL; z = next){
+            next = z->tnext;
+            zone_del(z);
+            n++;
+        }
+    }
+    STAT_ADD(expired,n);
+    return n;
+}
+
+int zones_save(uint8_t **out,size_t *len){
+    uint8_t *buf, *p;
+    int t, i;
+
+    if ((buf = p = malloc((size_t)nzones*(2+PSIZE(MAXVERT)) + 1)) == NULL) return -1;
+    for (t = 0; t < NTABLE; t++)
+        for (i = 0; i < tab[t].n; i++){
+            zone_t *z = tab[t].zone[i];
+            uint32_t ttl = z->expires ? z->expires - wnow : 0;
+            if (z->expires && ttl == 0) ttl = 1;    /* due this second */
+            *p++ = ttl;
+            *p++ = ttl >> 8;
+            memcpy(p,z->rec,z->reclen);
+            p += z->reclen;
+        }
+    *out = buf;
+    *len = p - buf;
+    return 0;
+}
+
+int zones_load(const uint8_t *buf,size_t len){
+    size_t off = 0;
+    int n = 0, rlen;
+
+    while (off < len){
+        if (off+2 >= len || rectable(buf+off+2,len-off-2,&rlen) < 0) return -1;
+        if (zone_add(buf+off+2,rlen,buf[off] | buf[off+1]<<8) == NULL) return -1;
+        off += 2+rlen;
+        n++;
+    }
+    return n;
+}
+
+void zones_limit(uint32_t n) {
+    maxzones = n;
+}
+
+void zones_reset(void) {
+    int t;
+
+    for (t = 0; t < NTABLE; t++){
+        free(tab[t].box);
+        free(tab[t].zone);
+        memset(&tab[t],0,sizeof(tab[t]));
+    }
+    free(htab);
+    htab = NULL;
+    hsize = 0;
+    memset(wheel,0,sizeof(wheel));
+    memset(freelist,0,sizeof(freelist));
+    while (chunks != NULL){
+        uint8_t *next = *(uint8_t**)chunks;
+        free(chunks);
+        chunks = next;
+    }
+    carvelen = 0;
+    nzones = 0;
+    atomic_store(&zonestats.stored,0);
+    atomic_store(&zonestats.expiring,0);
+    atomic_store(&zonestats.bytes,0);
+}
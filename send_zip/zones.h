@@ -0,0 +1,113 @@
+/*
+ * zones.h -- the AOZ and EZ store used to validate targets
+ *
+ * Description: an AOZ or EZ message carries two corners of a box,
+ * each in the target layout (lat deg/min/sec, long deg/min/sec). A
+ * target is valid if it lies within at least one AOZ and outside
+ * every EZ. Corners are kept in arc-seconds so a check is a handful of
+ * integer compares per zone.
+ *
+ * A polygon zone (MSG_POLY) is stored as its bounding box and a table
+ * of its edges, precomputed when it arrives. A target is first
+ * checked against the box, and only a target inside the box pays for
+ * the crossing-number test over the edges.
+ *
+ * A circle zone (MSG_CIRCLE) is stored as a bounding box that holds
+ * the whole circle. A target inside the box is tested with a flat
+ * (equirectangular) distance to the center, and only one within its
+ * error of the edge with the exact haversine formula.
+ *
+ * The store grows as zones arrive, up to a limit (zones_limit()).
+ * Zones and edge tables come from an arena that grows in chunks and
+ * reuses whatever is freed, so memory follows the most zones ever
+ * stored at once. A zone may be deleted (ZDEL) or given a time to live
+ * (ZTTL); expiry runs from a hierarchical timer wheel, one O(1) step
+ * per second. The bounds a target is checked against are kept packed
+ * together, so removed zones cost a lookup nothing. Each zone keeps its
+ * record, so the store can be handed to another process whole.
+ *
+ */
+#ifndef ZONES_H
+#define ZONES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <math.h>
+
+#define ZONES_MAX 65536						/* default most zones stored */
+#define EARTH_R 6371008.8					/* mean radius, metres, for circles */
+#define ARCSEC (180*3600/M_PI)				/* arc-seconds to a radian */
+
+typedef struct zonestats {					/* readable from any thread */
+	_Atomic unsigned long long stored;		/* zones in the store */
+	_Atomic unsigned long long expiring;	/* of which have a time to live */
+	_Atomic unsigned long long expired;		/* zones removed when their time ran out */
+	_Atomic unsigned long long deleted;		/* zones removed by ZDEL */
+	_Atomic unsigned long long bytes;		/* arena memory */
+} zonestats_t;
+
+extern zonestats_t zonestats;
+
+/*
+ * checkTables() -- if msg is an AOZ, add it to the AOZ table; if an
+ * EZ, add it to the EZ table; if a ZTTL, add its zone to expire; if a
+ * ZDEL, delete its zone; if a target, check that it is within an AOZ
+ * and outside every EZ. size is the legacy message length. Checking
+ * a target only reads the store, so several threads may check
+ * targets at once while nothing changes it.
+ *
+ * returns: 2 if a zone was stored or deleted; 0 if the target is
+ * valid; -1 if the target is not valid, the zone is malformed, there
+ * is no room for it, or there is no such zone to delete.
+ */
+int checkTables(const uint8_t *msg,int size);
+
+/*
+ * zones_bulk() -- stores every zone record of the BULK message msg of
+ * length size, or, if any record is malformed or the store cannot
+ * hold them all, none of them.
+ *
+ * returns: 2 if the zones were stored; -1 if not.
+ */
+int zones_bulk(const uint8_t *msg,int size);
+
+/*
+ * zones_expire() -- advances the timer wheel to now (seconds, from
+ * the same clock as every earlier call) and removes the zones whose
+ * time has run out.
+ *
+ * returns: the number of zones removed.
+ */
+int zones_expire(uint32_t now);
+
+/*
+ * zones_save() -- copies every stored zone into a new buffer *out of
+ * *len bytes, for zones_load() in another process: for each, the
+ * seconds it has left to live (16 bits, little endian; 0 for forever)
+ * then its record, as in a ZTTL message. The caller frees *out.
+ *
+ * returns: 0 on success; -1 if out of memory.
+ */
+int zones_save(uint8_t **out,size_t *len);
+
+/*
+ * zones_load() -- stores the zones saved in buf, len bytes long
+ *
+ * returns: the number of zones stored; -1 if buf is malformed or the
+ * store could not hold them all.
+ */
+int zones_load(const uint8_t *buf,size_t len);
+
+/*
+ * zones_limit() -- sets the most zones the store will hold; zones
+ * already stored are kept.
+ */
+void zones_limit(uint32_t n);
+
+/*
+ * zones_reset() -- empties the store and frees its memory
+ */
+void zones_reset(void);
+
+#endif /* ZONES_H */